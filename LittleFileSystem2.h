@@ -24,16 +24,62 @@
 #include "BlockDevice.h"
 #include "PlatformMutex.h"
 #include "lfs2.h"
+#include "lfs2_trace.h"
 
 namespace mbed {
 
+struct lfs2_pooledfile;
+
 /**
  * LittleFileSystem2, a little file system
  *
  * Synchronization level: Thread safe
+ *
+ * By default every operation holds a single filesystem lock. If
+ * MBED_LFS2_FINE_GRAINED_LOCKING is enabled, each open file also gets its
+ * own lock. Operations that only touch a file's own state, such as
+ * file_tell, file_size, and reads that can be served entirely from the
+ * file's cache, then hold only that file's lock. This lets them run in
+ * parallel with each other and with slow operations on other files.
  */
 class LittleFileSystem2 : public mbed::FileSystem {
 public:
+    /** Operations with latency histograms */
+    enum stats_op {
+        STATS_OPEN,
+        STATS_READ,
+        STATS_WRITE,
+        STATS_SYNC,
+        STATS_OPS,
+    };
+
+    /** Number of buckets in each latency histogram. Bucket i counts
+     *  operations that took less than 2^i microseconds, the last bucket
+     *  also counts anything slower.
+     */
+    static const int STATS_BUCKETS = 20;
+
+    /** Filesystem statistics
+     *
+     *  The timing fields are only collected if MBED_LFS2_STATS is enabled,
+     *  otherwise they read as zero.
+     */
+    struct stats_t {
+        /** Counters kept by littlefs, see struct lfs2_fsstats */
+        struct lfs2_fsstats fs;
+
+        /** Number of times the filesystem lock was taken, not counting
+         *  nested acquisitions
+         */
+        uint32_t lock_count;
+
+        /** Total time spent waiting for the filesystem lock in microseconds */
+        uint64_t lock_wait_us;
+
+        /** Latency histograms indexed by stats_op */
+        uint32_t latency[STATS_OPS][STATS_BUCKETS];
+    };
+
     /** Lifetime of the LittleFileSystem2
      *
      *  @param name     Name of the file system in the tree.
@@ -56,12 +102,33 @@ public:
      *      Size of the lookahead buffer. A larger lookahead reduces the
      *      allocation scans and results in a faster filesystem but uses
      *      more RAM.
+     *  @param freemap
+     *      Track every block in a free-block map instead of the lookahead
+     *      buffer. Allocations no longer rescan the filesystem as it fills,
+     *      but this uses 1 bit of RAM per block on the device.
+     *  @param rcache_count
+     *      Number of lines in the read cache, each of cache_size. More lines
+     *      keep metadata and file pointers cached at the same time, which
+     *      reduces reads but uses more RAM.
+     *  @param dcache_count
+     *      Number of directories remembered by the path cache. Paths through
+     *      cached directories skip fetching each directory along the way. 0
+     *      disables the path cache.
+     *  @param max_open_files
+     *      Number of file handles preallocated at mount, each with its
+     *      buffers. Opening and closing files then never touches the heap,
+     *      and opening more files returns -ENFILE. 0 allocates each file
+     *      on open instead.
      */
     LittleFileSystem2(const char *name = NULL, mbed::BlockDevice *bd = NULL,
                      lfs2_size_t block_size = MBED_LFS2_BLOCK_SIZE,
                      uint32_t   block_cycles = MBED_LFS2_BLOCK_CYCLES,
                      lfs2_size_t cache_size = MBED_LFS2_CACHE_SIZE,
-                     lfs2_size_t lookahead = MBED_LFS2_LOOKAHEAD_SIZE);
+                     lfs2_size_t lookahead = MBED_LFS2_LOOKAHEAD_SIZE,
+                     bool freemap = MBED_LFS2_FREEMAP,
+                     lfs2_size_t rcache_count = MBED_LFS2_RCACHE_COUNT,
+                     lfs2_size_t dcache_count = MBED_LFS2_DCACHE_COUNT,
+                     lfs2_size_t max_open_files = MBED_LFS2_MAX_OPEN_FILES);
 
     virtual ~LittleFileSystem2();
 
@@ -103,11 +170,153 @@ public:
     virtual int mount(mbed::BlockDevice *bd);
 
     /** Unmount a file system from the underlying block device.
+     *
+     *  Fails with -EBUSY while files taken from the preallocated pool of
+     *  file handles are still open.
      *
      *  @return         0 on success, negative error code on failure
      */
     virtual int unmount();
 
+    /** Write a mount checkpoint.
+     *
+     *  Lets the next mount skip scanning the filesystem's metadata. The
+     *  checkpoint is dropped by the next write, so this is best called right
+     *  before unmounting. Enabling MBED_LFS2_CHECKPOINT_ON_UNMOUNT does this
+     *  automatically.
+     *
+     *  @return         0 on success, negative error code on failure
+     */
+    int checkpoint();
+
+    /** Erase free blocks ahead of time.
+     *
+     *  Fills a pool of up to MBED_LFS2_ERASE_POOL_COUNT erased blocks, so
+     *  later writes don't wait on an erase. Each call erases at most budget
+     *  blocks, so this can be called while idle or from a low-priority
+     *  thread without holding the filesystem for long.
+     *
+     *  @param budget   Maximum number of blocks to erase.
+     *  @return         Number of blocks erased, negative error code on failure
+     */
+    int maintain(lfs2_size_t budget);
+
+    /** Commit every queued file.
+     *
+     *  Files queued with file_queue that live in the same directory block
+     *  are written out with a single metadata commit, so either all of
+     *  their changes are on disk or none of them are.
+     *
+     *  @return         0 on success, negative error code on failure
+     */
+    int commit();
+
+    /** Compact metadata ahead of time.
+     *
+     *  Finishes any cleanup left behind by power-loss and compacts metadata
+     *  that is nearly full, so later writes are less likely to stall on a
+     *  compaction. Best called while the system is idle.
+     *
+     *  @return         0 on success, negative error code on failure
+     */
+    int gc();
+
+    /** Get filesystem statistics.
+     *
+     *  Counters are collected since mount or the last reset_stats.
+     *
+     *  @param stats    The stats structure to fill out.
+     *  @return         0 on success, negative error code on failure
+     */
+    int get_stats(stats_t *stats);
+
+    /** Reset filesystem statistics.
+     */
+    void reset_stats();
+
+    /** Take the oldest records out of the block device trace.
+     *
+     *  If MBED_LFS2_TRACE_SIZE is set, every read, program, erase and sync
+     *  since mount is recorded with its microsecond timestamp and duration,
+     *  keeping the newest MBED_LFS2_TRACE_SIZE records. The header followed
+     *  by the records is a trace file for the replay tool in
+     *  littlefs/tools. Call repeatedly to stream the trace out.
+     *
+     *  @param header   Header describing the records taken.
+     *  @param recs     Buffer for the records.
+     *  @param count    Maximum number of records to take.
+     *  @return         Number of records taken, or -ENOTSUP if tracing is
+     *                  disabled
+     */
+    int get_trace(struct lfs2_trace_header *header,
+                  struct lfs2_trace_rec *recs, lfs2_size_t count);
+
+    /** Queue a file's changes for the next commit.
+     *
+     *  Writes out the file's data but leaves its metadata for commit,
+     *  which groups the updates of many files into one write. Syncing or
+     *  closing the file commits it on its own instead.
+     *
+     *  @param file     File handle as returned by file_open.
+     *  @return         0 on success, negative error code on failure
+     */
+    int file_queue(mbed::fs_file_t file);
+
+    /** Read from a file into many buffers.
+     *
+     *  Fills each segment in order in one locked call.
+     *
+     *  @param file     File handle as returned by file_open.
+     *  @param iov      Array of segments to read into.
+     *  @param iovcnt   Number of segments, -EINVAL if negative.
+     *  @return         Number of bytes read, short only at the end of the
+     *                  file, negative error code on failure
+     */
+    ssize_t file_readv(mbed::fs_file_t file, const struct lfs2_iovec *iov, int iovcnt);
+
+    /** Write to a file from many buffers.
+     *
+     *  Writes each segment in order in one locked call, the same as a
+     *  single write of their concatenation without building it first.
+     *
+     *  @param file     File handle as returned by file_open.
+     *  @param iov      Array of segments to write.
+     *  @param iovcnt   Number of segments, -EINVAL if negative.
+     *  @return         Number of bytes written, negative error code on failure
+     */
+    ssize_t file_writev(mbed::fs_file_t file, const struct lfs2_iovec *iov, int iovcnt);
+
+    /** Reserve blocks for a file to grow into.
+     *
+     *  The blocks are allocated and erased up front and held until the
+     *  file is closed, so writes up to the reserved size never wait on the
+     *  allocator or an erase, and can't run out of space part way through.
+     *
+     *  @param file     File handle as returned by file_open.
+     *  @param size     Size the file can grow to using the reserved blocks.
+     *  @return         0 on success, negative error code on failure
+     */
+    int file_reserve(mbed::fs_file_t file, off_t size);
+
+    /** Read many directory entries at once.
+     *
+     *  Fills out the name, type and size of up to count entries, and any
+     *  custom attributes asked for, in one locked pass that decodes each
+     *  directory block once. This saves a stat per entry when listing.
+     *
+     *  @param dir          Dir handle as returned by dir_open.
+     *  @param infos        Array of count entries to fill out.
+     *  @param count        Number of entries to read.
+     *  @param attrs        Array of attr_count attributes for each entry, or
+     *                      NULL. Entry i reads into attrs[i*attr_count] on.
+     *  @param attr_count   Number of attributes to read for each entry.
+     *  @return             Number of entries read, 0 at the end of the
+     *                      directory, negative error code on failure
+     */
+    ssize_t dir_readplus(mbed::fs_dir_t dir, struct lfs2_info *infos,
+                         lfs2_size_t count, const struct lfs2_attr *attrs = NULL,
+                         lfs2_size_t attr_count = 0);
+
     /** Reformat a file system. Results in an empty and mounted file system.
      *
      *  @param bd
@@ -290,10 +499,41 @@ protected:
 private:
     lfs2_t _lfs; // The actual file system
     struct lfs2_config _config;
+    struct lfs2_file_config _file_config;
     mbed::BlockDevice *_bd; // The block device
 
     // thread-safe locking
     PlatformMutex _mutex;
+    uint32_t _lock_depth;
+    void lock();
+    void unlock();
+
+    // statistics, timed only if MBED_LFS2_STATS is enabled
+    uint32_t _lock_count;
+    uint64_t _lock_wait_us;
+    uint32_t _latency[STATS_OPS][STATS_BUCKETS];
+    void stats_record(stats_op op, uint32_t start);
+
+    // block device trace, restarted on every mount if MBED_LFS2_TRACE_SIZE
+    // is set
+    lfs2_trace_t _trace;
+    struct lfs2_trace_rec *_trace_buffer;
+
+    // file handles, taken from a preallocated pool if max_open_files is set
+    lfs2_size_t _max_open_files;
+    struct lfs2_pooledfile *_pool;
+    struct lfs2_pooledfile *_pool_free;
+    uint8_t *_pool_buffer;
+    lfs2_size_t _pool_open;
+    int pool_create();
+    void pool_destroy();
+    lfs2_file_t *file_alloc(const struct lfs2_file_config **config);
+    void file_free(lfs2_file_t *file);
+
+    // per-file locking, falls back to the filesystem lock unless
+    // MBED_LFS2_FINE_GRAINED_LOCKING is enabled
+    void file_lock(mbed::fs_file_t file);
+    void file_unlock(mbed::fs_file_t file);
 };
 
 } // namespace mbed
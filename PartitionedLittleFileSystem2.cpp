@@ -0,0 +1,420 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "PartitionedLittleFileSystem2.h"
+#include "errno.h"
+#include <new>
+#include "platform/mbed_assert.h"
+#include "lfs2_util.h"
+
+namespace mbed {
+
+////// Partition view of the block device //////
+
+// Like SlicingBlockDevice, but every operation holds the lock shared by
+// all partitions. The block device itself is initialized once for all
+// partitions, so init and deinit do nothing here.
+class PartitionBlockDevice2 : public BlockDevice {
+public:
+    PartitionBlockDevice2(BlockDevice *bd, PlatformMutex *mutex)
+        : _bd(bd), _mutex(mutex), _start(0), _size(0)
+    {
+    }
+
+    void slice(bd_addr_t start, bd_size_t size)
+    {
+        _start = start;
+        _size = size;
+    }
+
+    virtual int init()
+    {
+        return 0;
+    }
+
+    virtual int deinit()
+    {
+        return 0;
+    }
+
+    virtual int sync()
+    {
+        _mutex->lock();
+        int err = _bd->sync();
+        _mutex->unlock();
+        return err;
+    }
+
+    virtual int read(void *buffer, bd_addr_t addr, bd_size_t size)
+    {
+        MBED_ASSERT(is_valid_read(addr, size));
+        _mutex->lock();
+        int err = _bd->read(buffer, _start + addr, size);
+        _mutex->unlock();
+        return err;
+    }
+
+    virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size)
+    {
+        MBED_ASSERT(is_valid_program(addr, size));
+        _mutex->lock();
+        int err = _bd->program(buffer, _start + addr, size);
+        _mutex->unlock();
+        return err;
+    }
+
+    virtual int erase(bd_addr_t addr, bd_size_t size)
+    {
+        MBED_ASSERT(is_valid_erase(addr, size));
+        _mutex->lock();
+        int err = _bd->erase(_start + addr, size);
+        _mutex->unlock();
+        return err;
+    }
+
+    virtual int trim(bd_addr_t addr, bd_size_t size)
+    {
+        _mutex->lock();
+        int err = _bd->trim(_start + addr, size);
+        _mutex->unlock();
+        return err;
+    }
+
+    virtual bd_size_t get_read_size() const
+    {
+        return _bd->get_read_size();
+    }
+
+    virtual bd_size_t get_program_size() const
+    {
+        return _bd->get_program_size();
+    }
+
+    virtual bd_size_t get_erase_size() const
+    {
+        return _bd->get_erase_size();
+    }
+
+    virtual bd_size_t get_erase_size(bd_addr_t addr) const
+    {
+        return _bd->get_erase_size(_start + addr);
+    }
+
+    virtual int get_erase_value() const
+    {
+        return _bd->get_erase_value();
+    }
+
+    virtual bd_size_t size() const
+    {
+        return _size;
+    }
+
+    virtual const char *get_type() const
+    {
+        return _bd->get_type();
+    }
+
+private:
+    BlockDevice *_bd;
+    PlatformMutex *_mutex;
+    bd_addr_t _start;
+    bd_size_t _size;
+};
+
+
+////// Partitions //////
+PartitionedLittleFileSystem2::PartitionedLittleFileSystem2(BlockDevice *bd,
+                                                         const partition_t *table, int count)
+    : _bd(bd), _table(table), _count(count), _mounted(false),
+      _slices(NULL), _fs(NULL)
+{
+    // mount points are registered by name here, so a failed allocation
+    // is only reported by format and mount
+    create();
+}
+
+PartitionedLittleFileSystem2::~PartitionedLittleFileSystem2()
+{
+    // nop if unmounted
+    unmount();
+    destroy();
+}
+
+int PartitionedLittleFileSystem2::create()
+{
+    _slices = new (std::nothrow) PartitionBlockDevice2*[_count]();
+    _fs = new (std::nothrow) LittleFileSystem2*[_count]();
+    if (!_slices || !_fs) {
+        destroy();
+        return -ENOMEM;
+    }
+
+    for (int i = 0; i < _count; i++) {
+        const partition_t *p = &_table[i];
+        _slices[i] = new (std::nothrow) PartitionBlockDevice2(_bd, &_bd_mutex);
+        _fs[i] = new (std::nothrow) LittleFileSystem2(p->name, NULL,
+                MBED_LFS2_BLOCK_SIZE, MBED_LFS2_BLOCK_CYCLES,
+                p->cache_size ? p->cache_size : MBED_LFS2_CACHE_SIZE,
+                p->lookahead_size ? p->lookahead_size : MBED_LFS2_LOOKAHEAD_SIZE,
+                MBED_LFS2_FREEMAP, MBED_LFS2_RCACHE_COUNT,
+                MBED_LFS2_DCACHE_COUNT, p->max_open_files);
+        if (!_slices[i] || !_fs[i]) {
+            destroy();
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+void PartitionedLittleFileSystem2::destroy()
+{
+    for (int i = 0; i < _count && _fs && _slices; i++) {
+        delete _fs[i];
+        delete _slices[i];
+    }
+
+    delete[] _fs;
+    delete[] _slices;
+    _fs = NULL;
+    _slices = NULL;
+}
+
+// Find where a partition lives on the block device, which must be
+// initialized
+static int lfs2_partition_layout(BlockDevice *bd,
+                                const PartitionedLittleFileSystem2::partition_t *table,
+                                int count, int index, bd_addr_t *start, bd_size_t *size)
+{
+    bd_size_t erase_size = bd->get_erase_size();
+    *start = 0;
+    for (int i = 0; i <= index; i++) {
+        if (i > 0) {
+            *start += *size;
+        }
+
+        *size = table[i].size;
+        if (*size == 0 && i == count-1 && *start < bd->size()) {
+            *size = bd->size() - *start;
+        }
+
+        if (*size == 0 || *size % erase_size != 0 ||
+                *size > bd->size() - *start) {
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+int PartitionedLittleFileSystem2::format()
+{
+    LFS2_INFO("partitions format(%p, %d)", _bd, _count);
+    if (!_fs) {
+        LFS2_INFO("partitions format -> %d", -ENOMEM);
+        return -ENOMEM;
+    } else if (_mounted) {
+        LFS2_INFO("partitions format -> %d", -EBUSY);
+        return -EBUSY;
+    }
+
+    int err = _bd->init();
+    if (err) {
+        LFS2_INFO("partitions format -> %d", err);
+        return err;
+    }
+
+    for (int i = 0; i < _count && !err; i++) {
+        bd_addr_t start;
+        bd_size_t size;
+        err = lfs2_partition_layout(_bd, _table, _count, i, &start, &size);
+        if (err) {
+            break;
+        }
+
+        _slices[i]->slice(start, size);
+        const partition_t *p = &_table[i];
+        err = LittleFileSystem2::format(_slices[i],
+                MBED_LFS2_BLOCK_SIZE, MBED_LFS2_BLOCK_CYCLES,
+                p->cache_size ? p->cache_size : MBED_LFS2_CACHE_SIZE,
+                p->lookahead_size ? p->lookahead_size : MBED_LFS2_LOOKAHEAD_SIZE);
+    }
+
+    int res = _bd->deinit();
+    if (err) {
+        res = err;
+    }
+
+    LFS2_INFO("partitions format -> %d", res);
+    return res;
+}
+
+int PartitionedLittleFileSystem2::mount()
+{
+    LFS2_INFO("partitions mount(%p, %d)", _bd, _count);
+    if (!_fs) {
+        LFS2_INFO("partitions mount -> %d", -ENOMEM);
+        return -ENOMEM;
+    } else if (_mounted) {
+        LFS2_INFO("partitions mount -> %d", -EBUSY);
+        return -EBUSY;
+    }
+
+    int err = _bd->init();
+    if (err) {
+        LFS2_INFO("partitions mount -> %d", err);
+        return err;
+    }
+
+    int i = 0;
+    for (; i < _count; i++) {
+        bd_addr_t start;
+        bd_size_t size;
+        err = lfs2_partition_layout(_bd, _table, _count, i, &start, &size);
+        if (err) {
+            break;
+        }
+
+        _slices[i]->slice(start, size);
+        err = _fs[i]->mount(_slices[i]);
+        if (err) {
+            break;
+        }
+    }
+
+    if (err) {
+        // leave nothing half mounted
+        while (i > 0) {
+            i -= 1;
+            _fs[i]->unmount();
+        }
+        _bd->deinit();
+        LFS2_INFO("partitions mount -> %d", err);
+        return err;
+    }
+
+    _mounted = true;
+    LFS2_INFO("partitions mount -> %d", 0);
+    return err;
+}
+
+int PartitionedLittleFileSystem2::unmount()
+{
+    LFS2_INFO("partitions unmount(%d)", _count);
+    if (!_mounted) {
+        LFS2_INFO("partitions unmount -> %d", 0);
+        return 0;
+    }
+
+    int res = 0;
+    for (int i = 0; i < _count; i++) {
+        int err = _fs[i]->unmount();
+        if (err && !res) {
+            res = err;
+        }
+    }
+
+    if (res == -EBUSY) {
+        // a partition still has open files, partitions that did unmount
+        // are skipped when this is tried again
+        LFS2_INFO("partitions unmount -> %d", res);
+        return res;
+    }
+
+    int err = _bd->deinit();
+    if (err && !res) {
+        res = err;
+    }
+
+    _mounted = false;
+
+    LFS2_INFO("partitions unmount -> %d", res);
+    return res;
+}
+
+int PartitionedLittleFileSystem2::count() const
+{
+    return _count;
+}
+
+LittleFileSystem2 *PartitionedLittleFileSystem2::partition(int index)
+{
+    if (!_fs || index < 0 || index >= _count) {
+        return NULL;
+    }
+
+    return _fs[index];
+}
+
+LittleFileSystem2 *PartitionedLittleFileSystem2::partition(const char *name)
+{
+    for (int i = 0; _fs && i < _count; i++) {
+        if (strcmp(_table[i].name, name) == 0) {
+            return _fs[i];
+        }
+    }
+
+    return NULL;
+}
+
+////// Statistics //////
+int PartitionedLittleFileSystem2::get_stats(LittleFileSystem2::stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (!_fs) {
+        return -ENOMEM;
+    }
+
+    // every littlefs counter is a uint32_t, so they can be summed as words
+    MBED_STATIC_ASSERT(sizeof(struct lfs2_fsstats) % sizeof(uint32_t) == 0,
+                       "lfs2_fsstats must only hold uint32_t counters");
+    const int words = sizeof(struct lfs2_fsstats) / sizeof(uint32_t);
+
+    int res = 0;
+    for (int i = 0; i < _count; i++) {
+        LittleFileSystem2::stats_t part;
+        int err = _fs[i]->get_stats(&part);
+        if (err) {
+            res = res ? res : err;
+            continue;
+        }
+
+        uint32_t *sum = (uint32_t *)&stats->fs;
+        const uint32_t *counters = (const uint32_t *)&part.fs;
+        for (int j = 0; j < words; j++) {
+            sum[j] += counters[j];
+        }
+
+        stats->lock_count += part.lock_count;
+        stats->lock_wait_us += part.lock_wait_us;
+        for (int op = 0; op < LittleFileSystem2::STATS_OPS; op++) {
+            for (int bucket = 0; bucket < LittleFileSystem2::STATS_BUCKETS; bucket++) {
+                stats->latency[op][bucket] += part.latency[op][bucket];
+            }
+        }
+    }
+
+    return res;
+}
+
+void PartitionedLittleFileSystem2::reset_stats()
+{
+    for (int i = 0; _fs && i < _count; i++) {
+        _fs[i]->reset_stats();
+    }
+}
+
+} // namespace mbed
@@ -0,0 +1,168 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \addtogroup storage */
+/** @{*/
+
+#ifndef MBED_PARTITIONEDLFS2FILESYSTEM_H
+#define MBED_PARTITIONEDLFS2FILESYSTEM_H
+
+#include "BlockDevice.h"
+#include "PlatformMutex.h"
+#include "LittleFileSystem2.h"
+
+namespace mbed {
+
+class PartitionBlockDevice2;
+
+/**
+ * Several LittleFileSystem2 partitions on one block device
+ *
+ * Synchronization level: Thread safe
+ *
+ * Each partition is a separate filesystem with its own mount point, lock,
+ * caches and allocator, and only ever sees its own range of the block
+ * device. A long write in one partition only holds the other partitions
+ * back for the duration of each block device operation, which are
+ * serialized with a lock shared by all partitions.
+ */
+class PartitionedLittleFileSystem2 : private mbed::NonCopyable<PartitionedLittleFileSystem2> {
+public:
+    /** Entry in the partition table */
+    struct partition_t {
+        /** Name of the partition's mount point */
+        const char *name;
+
+        /** Size of the partition in bytes, a multiple of the erase size.
+         *  0 takes the rest of the block device, only allowed for the last
+         *  partition.
+         */
+        bd_size_t size;
+
+        /** Cache size of the partition, 0 uses MBED_LFS2_CACHE_SIZE */
+        lfs2_size_t cache_size;
+
+        /** Lookahead size of the partition, 0 uses
+         *  MBED_LFS2_LOOKAHEAD_SIZE
+         */
+        lfs2_size_t lookahead_size;
+
+        /** Preallocated file handles of the partition, see
+         *  LittleFileSystem2
+         */
+        lfs2_size_t max_open_files;
+    };
+
+    /** Lifetime of the partitions
+     *
+     *  Partitions are laid out in table order from the start of the block
+     *  device. Nothing is mounted until mount is called.
+     *
+     *  @param bd       Block device holding every partition.
+     *  @param table    Partition table, must outlive this object.
+     *  @param count    Number of partitions in the table.
+     */
+    PartitionedLittleFileSystem2(mbed::BlockDevice *bd,
+                                 const partition_t *table, int count);
+
+    virtual ~PartitionedLittleFileSystem2();
+
+    /** Format every partition.
+     *
+     *  The partitions must not be mounted.
+     *
+     *  @return         0 on success, negative error code on failure
+     */
+    int format();
+
+    /** Mount every partition.
+     *
+     *  Fails with -EBUSY if the partitions are already mounted. Partitions
+     *  that mounted are unmounted again if a later partition fails to
+     *  mount.
+     *
+     *  @return         0 on success, negative error code on failure
+     */
+    int mount();
+
+    /** Unmount every partition.
+     *
+     *  Fails with -EBUSY, leaving the partitions with open files mounted,
+     *  if a partition can't be unmounted yet. See
+     *  LittleFileSystem2::unmount.
+     *
+     *  @return         0 on success, negative error code on failure
+     */
+    int unmount();
+
+    /** Number of partitions in the table */
+    int count() const;
+
+    /** Get a partition by its index in the table.
+     *
+     *  @param index    Index of the partition.
+     *  @return         The partition's filesystem, or NULL if out of range
+     */
+    LittleFileSystem2 *partition(int index);
+
+    /** Get a partition by name.
+     *
+     *  @param name     Name of the partition's mount point.
+     *  @return         The partition's filesystem, or NULL if not found
+     */
+    LittleFileSystem2 *partition(const char *name);
+
+    /** Get statistics summed over every partition.
+     *
+     *  Each partition is sampled under its own lock, so the sum is not a
+     *  snapshot of one instant.
+     *
+     *  @param stats    The stats structure to fill out.
+     *  @return         0 on success, negative error code on failure
+     */
+    int get_stats(LittleFileSystem2::stats_t *stats);
+
+    /** Reset the statistics of every partition.
+     */
+    void reset_stats();
+
+private:
+    mbed::BlockDevice *_bd;
+    const partition_t *_table;
+    int _count;
+    bool _mounted;
+
+    // one view of the block device and one filesystem per partition
+    PartitionBlockDevice2 **_slices;
+    LittleFileSystem2 **_fs;
+
+    // serializes block device operations across partitions
+    PlatformMutex _bd_mutex;
+
+    int create();
+    void destroy();
+};
+
+} // namespace mbed
+
+// Added "using" for backwards compatibility
+#ifndef MBED_NO_GLOBAL_USING_DIRECTIVE
+using mbed::PartitionedLittleFileSystem2;
+#endif
+
+#endif
+
+/** @}*/
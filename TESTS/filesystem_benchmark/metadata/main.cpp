@@ -0,0 +1,252 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include <stdlib.h>
+#include <errno.h>
+
+#include "LittleFileSystem2.h"
+
+using namespace utest::v1;
+
+// test configuration
+#ifndef MBED_TEST_SIM_BLOCKDEVICE
+#error [NOT_SUPPORTED] Simulation block device required for benchmarks
+#endif
+
+#ifndef MBED_TEST_SIM_BLOCKDEVICE_DECL
+#define MBED_TEST_SIM_BLOCKDEVICE_DECL MBED_TEST_SIM_BLOCKDEVICE bd(MBED_TEST_BLOCK_COUNT*512, 1, 1, 512)
+#endif
+
+#ifndef MBED_TEST_BLOCK_COUNT
+#define MBED_TEST_BLOCK_COUNT 256
+#endif
+
+#ifndef MBED_TEST_BENCH_FILES
+#define MBED_TEST_BENCH_FILES 64
+#endif
+
+#ifndef MBED_TEST_BENCH_OPS
+#define MBED_TEST_BENCH_OPS 16
+#endif
+
+#ifndef MBED_TEST_TIMEOUT
+#define MBED_TEST_TIMEOUT 480
+#endif
+
+
+// declarations
+#define STRINGIZE(x) STRINGIZE2(x)
+#define STRINGIZE2(x) #x
+#define INCLUDE(x) STRINGIZE(x.h)
+
+#include INCLUDE(MBED_TEST_SIM_BLOCKDEVICE)
+
+MBED_TEST_SIM_BLOCKDEVICE_DECL;
+
+File file;
+char path[32];
+
+// file counts to measure mount time at
+static const int mount_counts[] = {0, 8, 16, 32, 64};
+
+
+// results are printed as one JSON object per line
+static void bench_print(const char *name, const struct lfs2_fsstats &stats,
+                        int files, int ops, int us)
+{
+    printf("{\"benchmark\": \"%s\", \"files\": %d, \"ops\": %d, "
+           "\"us\": %d, \"ops_per_s\": %llu, \"reads\": %lu, "
+           "\"progs\": %lu, \"erases\": %lu, \"compacts\": %lu}\n",
+           name, files, ops, us,
+           us ? (unsigned long long)ops * 1000000 / us : 0,
+           (unsigned long)stats.read_count,
+           (unsigned long)stats.prog_count,
+           (unsigned long)stats.erase_count,
+           (unsigned long)stats.compact_count);
+}
+
+static void bench_report(const char *name, LittleFileSystem2 &fs,
+                         int files, int ops, int us)
+{
+    LittleFileSystem2::stats_t stats;
+    fs.get_stats(&stats);
+    bench_print(name, stats.fs, files, ops, us);
+    fs.reset_stats();
+}
+
+void test_small_files()
+{
+    int res = bd.init();
+    TEST_ASSERT_EQUAL(0, res);
+
+    {
+        res = LittleFileSystem2::format(&bd);
+        TEST_ASSERT_EQUAL(0, res);
+
+        LittleFileSystem2 fs("fs");
+        res = fs.mount(&bd);
+        TEST_ASSERT_EQUAL(0, res);
+        Timer timer;
+
+        // create
+        fs.reset_stats();
+        timer.reset();
+        timer.start();
+        for (int i = 0; i < MBED_TEST_BENCH_FILES; i++) {
+            sprintf(path, "file%03d", i);
+            res = file.open(&fs, path, O_WRONLY | O_CREAT);
+            TEST_ASSERT_EQUAL(0, res);
+            res = file.write(path, strlen(path));
+            TEST_ASSERT_EQUAL(strlen(path), res);
+            res = file.close();
+            TEST_ASSERT_EQUAL(0, res);
+        }
+        timer.stop();
+        bench_report("create", fs, MBED_TEST_BENCH_FILES,
+                     MBED_TEST_BENCH_FILES, timer.read_us());
+
+        // stat
+        timer.reset();
+        timer.start();
+        for (int i = 0; i < MBED_TEST_BENCH_FILES; i++) {
+            struct stat st;
+            sprintf(path, "file%03d", i);
+            res = fs.stat(path, &st);
+            TEST_ASSERT_EQUAL(0, res);
+            TEST_ASSERT_EQUAL(strlen(path), st.st_size);
+        }
+        timer.stop();
+        bench_report("stat", fs, MBED_TEST_BENCH_FILES,
+                     MBED_TEST_BENCH_FILES, timer.read_us());
+
+        // statvfs, this uses the allocator's count of blocks in use, so
+        // only a call that finds the count out of date traverses
+        timer.reset();
+        timer.start();
+        for (int i = 0; i < MBED_TEST_BENCH_OPS; i++) {
+            struct statvfs st;
+            res = fs.statvfs("", &st);
+            TEST_ASSERT_EQUAL(0, res);
+        }
+        timer.stop();
+        bench_report("statvfs", fs, MBED_TEST_BENCH_FILES,
+                     MBED_TEST_BENCH_OPS, timer.read_us());
+
+        // remove
+        timer.reset();
+        timer.start();
+        for (int i = 0; i < MBED_TEST_BENCH_FILES; i++) {
+            sprintf(path, "file%03d", i);
+            res = fs.remove(path);
+            TEST_ASSERT_EQUAL(0, res);
+        }
+        timer.stop();
+        bench_report("remove", fs, MBED_TEST_BENCH_FILES,
+                     MBED_TEST_BENCH_FILES, timer.read_us());
+
+        res = fs.unmount();
+        TEST_ASSERT_EQUAL(0, res);
+    }
+
+    res = bd.deinit();
+    TEST_ASSERT_EQUAL(0, res);
+}
+
+void test_mount_time()
+{
+    int res = bd.init();
+    TEST_ASSERT_EQUAL(0, res);
+
+    {
+        res = LittleFileSystem2::format(&bd);
+        TEST_ASSERT_EQUAL(0, res);
+
+        LittleFileSystem2 fs("fs");
+        Timer timer;
+        int files = 0;
+        for (size_t c = 0; c < sizeof(mount_counts)/sizeof(mount_counts[0]); c++) {
+            // grow the filesystem to the next file count, spread the files
+            // over directories so there are many metadata pairs to scan
+            res = fs.mount(&bd);
+            TEST_ASSERT_EQUAL(0, res);
+            for (; files < mount_counts[c]; files++) {
+                if (files % 8 == 0) {
+                    sprintf(path, "dir%03d", files / 8);
+                    res = fs.mkdir(path, 0777);
+                    TEST_ASSERT_EQUAL(0, res);
+                }
+
+                sprintf(path, "dir%03d/file%03d", files / 8, files);
+                res = file.open(&fs, path, O_WRONLY | O_CREAT);
+                TEST_ASSERT_EQUAL(0, res);
+                res = file.close();
+                TEST_ASSERT_EQUAL(0, res);
+            }
+            res = fs.unmount();
+            TEST_ASSERT_EQUAL(0, res);
+
+            // only time the mounts, the timer adds up each start to stop,
+            // every mount restarts the filesystem's counters so we add
+            // them up here
+            struct lfs2_fsstats total;
+            memset(&total, 0, sizeof(total));
+            timer.reset();
+            for (int i = 0; i < MBED_TEST_BENCH_OPS; i++) {
+                timer.start();
+                res = fs.mount(&bd);
+                timer.stop();
+                TEST_ASSERT_EQUAL(0, res);
+                LittleFileSystem2::stats_t stats;
+                fs.get_stats(&stats);
+                total.read_count += stats.fs.read_count;
+                total.prog_count += stats.fs.prog_count;
+                total.erase_count += stats.fs.erase_count;
+                total.compact_count += stats.fs.compact_count;
+                res = fs.unmount();
+                TEST_ASSERT_EQUAL(0, res);
+            }
+            bench_print("mount", total, files,
+                        MBED_TEST_BENCH_OPS, timer.read_us());
+        }
+    }
+
+    res = bd.deinit();
+    TEST_ASSERT_EQUAL(0, res);
+}
+
+
+
+// test setup
+utest::v1::status_t test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(MBED_TEST_TIMEOUT, "default_auto");
+    return verbose_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("Small file benchmark", test_small_files),
+    Case("Mount time benchmark", test_mount_time),
+};
+
+Specification specification(test_setup, cases);
+
+int main()
+{
+    return !Harness::run(specification);
+}
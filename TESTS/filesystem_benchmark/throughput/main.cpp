@@ -0,0 +1,220 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include <stdlib.h>
+#include <errno.h>
+
+#include "LittleFileSystem2.h"
+
+using namespace utest::v1;
+
+// test configuration
+#ifndef MBED_TEST_SIM_BLOCKDEVICE
+#error [NOT_SUPPORTED] Simulation block device required for benchmarks
+#endif
+
+#ifndef MBED_TEST_SIM_BLOCKDEVICE_DECL
+#define MBED_TEST_SIM_BLOCKDEVICE_DECL MBED_TEST_SIM_BLOCKDEVICE bd(MBED_TEST_BLOCK_COUNT*512, 1, 1, 512)
+#endif
+
+#ifndef MBED_TEST_BLOCK_COUNT
+#define MBED_TEST_BLOCK_COUNT 256
+#endif
+
+#ifndef MBED_TEST_BENCH_SIZE
+#define MBED_TEST_BENCH_SIZE (32*1024)
+#endif
+
+#ifndef MBED_TEST_BENCH_OPS
+#define MBED_TEST_BENCH_OPS 64
+#endif
+
+#ifndef MBED_TEST_BUFFER
+#define MBED_TEST_BUFFER 512
+#endif
+
+#ifndef MBED_TEST_TIMEOUT
+#define MBED_TEST_TIMEOUT 480
+#endif
+
+
+// declarations
+#define STRINGIZE(x) STRINGIZE2(x)
+#define STRINGIZE2(x) #x
+#define INCLUDE(x) STRINGIZE(x.h)
+
+#include INCLUDE(MBED_TEST_SIM_BLOCKDEVICE)
+
+MBED_TEST_SIM_BLOCKDEVICE_DECL;
+
+File file;
+uint8_t buffer[MBED_TEST_BUFFER];
+
+// configurations to compare, every combination is run
+static const lfs2_size_t cache_sizes[] = {64, 128, 512};
+static const lfs2_size_t lookahead_sizes[] = {8, 32};
+
+
+// results are printed as one JSON object per line
+static void bench_report(const char *name, LittleFileSystem2 &fs,
+                         lfs2_size_t cache_size, lfs2_size_t lookahead_size,
+                         uint32_t bytes, int us)
+{
+    LittleFileSystem2::stats_t stats;
+    fs.get_stats(&stats);
+    printf("{\"benchmark\": \"%s\", \"cache_size\": %lu, "
+           "\"lookahead_size\": %lu, \"bytes\": %lu, \"us\": %d, "
+           "\"bytes_per_s\": %llu, \"reads\": %lu, \"progs\": %lu, "
+           "\"erases\": %lu}\n",
+           name, (unsigned long)cache_size, (unsigned long)lookahead_size,
+           (unsigned long)bytes, us,
+           us ? (unsigned long long)bytes * 1000000 / us : 0,
+           (unsigned long)stats.fs.read_count,
+           (unsigned long)stats.fs.prog_count,
+           (unsigned long)stats.fs.erase_count);
+    fs.reset_stats();
+}
+
+static void bench_throughput(lfs2_size_t cache_size, lfs2_size_t lookahead_size)
+{
+    int res = bd.init();
+    TEST_ASSERT_EQUAL(0, res);
+
+    {
+        res = LittleFileSystem2::format(&bd, MBED_LFS2_BLOCK_SIZE,
+                MBED_LFS2_BLOCK_CYCLES, cache_size, lookahead_size);
+        TEST_ASSERT_EQUAL(0, res);
+
+        LittleFileSystem2 fs("fs", NULL, MBED_LFS2_BLOCK_SIZE,
+                MBED_LFS2_BLOCK_CYCLES, cache_size, lookahead_size);
+        res = fs.mount(&bd);
+        TEST_ASSERT_EQUAL(0, res);
+        Timer timer;
+
+        // sequential write
+        fs.reset_stats();
+        srand(1);
+        timer.reset();
+        timer.start();
+        res = file.open(&fs, "bench", O_WRONLY | O_CREAT);
+        TEST_ASSERT_EQUAL(0, res);
+        for (size_t i = 0; i < MBED_TEST_BENCH_SIZE; i += sizeof(buffer)) {
+            for (size_t b = 0; b < sizeof(buffer); b++) {
+                buffer[b] = rand() & 0xff;
+            }
+            res = file.write(buffer, sizeof(buffer));
+            TEST_ASSERT_EQUAL(sizeof(buffer), res);
+        }
+        res = file.close();
+        TEST_ASSERT_EQUAL(0, res);
+        timer.stop();
+        bench_report("sequential_write", fs, cache_size, lookahead_size,
+                     MBED_TEST_BENCH_SIZE, timer.read_us());
+
+        // sequential read
+        timer.reset();
+        timer.start();
+        res = file.open(&fs, "bench", O_RDONLY);
+        TEST_ASSERT_EQUAL(0, res);
+        for (size_t i = 0; i < MBED_TEST_BENCH_SIZE; i += sizeof(buffer)) {
+            res = file.read(buffer, sizeof(buffer));
+            TEST_ASSERT_EQUAL(sizeof(buffer), res);
+        }
+        res = file.close();
+        TEST_ASSERT_EQUAL(0, res);
+        timer.stop();
+        bench_report("sequential_read", fs, cache_size, lookahead_size,
+                     MBED_TEST_BENCH_SIZE, timer.read_us());
+
+        // random read
+        srand(2);
+        timer.reset();
+        timer.start();
+        res = file.open(&fs, "bench", O_RDONLY);
+        TEST_ASSERT_EQUAL(0, res);
+        for (int i = 0; i < MBED_TEST_BENCH_OPS; i++) {
+            off_t off = (rand() % (MBED_TEST_BENCH_SIZE / sizeof(buffer)))
+                    * sizeof(buffer);
+            res = file.seek(off, SEEK_SET);
+            TEST_ASSERT_EQUAL(off, res);
+            res = file.read(buffer, sizeof(buffer));
+            TEST_ASSERT_EQUAL(sizeof(buffer), res);
+        }
+        res = file.close();
+        TEST_ASSERT_EQUAL(0, res);
+        timer.stop();
+        bench_report("random_read", fs, cache_size, lookahead_size,
+                     MBED_TEST_BENCH_OPS * sizeof(buffer), timer.read_us());
+
+        // random write, each write rewrites the tail of the file on sync
+        srand(3);
+        timer.reset();
+        timer.start();
+        res = file.open(&fs, "bench", O_WRONLY);
+        TEST_ASSERT_EQUAL(0, res);
+        for (int i = 0; i < MBED_TEST_BENCH_OPS; i++) {
+            off_t off = (rand() % (MBED_TEST_BENCH_SIZE / sizeof(buffer)))
+                    * sizeof(buffer);
+            res = file.seek(off, SEEK_SET);
+            TEST_ASSERT_EQUAL(off, res);
+            res = file.write(buffer, sizeof(buffer));
+            TEST_ASSERT_EQUAL(sizeof(buffer), res);
+        }
+        res = file.close();
+        TEST_ASSERT_EQUAL(0, res);
+        timer.stop();
+        bench_report("random_write", fs, cache_size, lookahead_size,
+                     MBED_TEST_BENCH_OPS * sizeof(buffer), timer.read_us());
+
+        res = fs.unmount();
+        TEST_ASSERT_EQUAL(0, res);
+    }
+
+    res = bd.deinit();
+    TEST_ASSERT_EQUAL(0, res);
+}
+
+void test_throughput()
+{
+    for (size_t c = 0; c < sizeof(cache_sizes)/sizeof(cache_sizes[0]); c++) {
+        for (size_t l = 0; l < sizeof(lookahead_sizes)/sizeof(lookahead_sizes[0]); l++) {
+            bench_throughput(cache_sizes[c], lookahead_sizes[l]);
+        }
+    }
+}
+
+
+
+// test setup
+utest::v1::status_t test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(MBED_TEST_TIMEOUT, "default_auto");
+    return verbose_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("Throughput benchmark", test_throughput),
+};
+
+Specification specification(test_setup, cases);
+
+int main()
+{
+    return !Harness::run(specification);
+}
@@ -0,0 +1,249 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity.h"
+#include "utest.h"
+#include <stdlib.h>
+#include <errno.h>
+
+#include "PartitionedLittleFileSystem2.h"
+
+using namespace utest::v1;
+
+// test configuration
+#ifndef MBED_TEST_BLOCKDEVICE
+#error [NOT_SUPPORTED] Non-volatile block device required
+#endif
+
+#ifndef MBED_TEST_BLOCKDEVICE_DECL
+#define MBED_TEST_BLOCKDEVICE_DECL MBED_TEST_BLOCKDEVICE bd
+#endif
+
+#ifndef MBED_TEST_BUFFER
+#define MBED_TEST_BUFFER 8192
+#endif
+
+#ifndef MBED_TEST_TIMEOUT
+#define MBED_TEST_TIMEOUT 480
+#endif
+
+
+// declarations
+#define STRINGIZE(x) STRINGIZE2(x)
+#define STRINGIZE2(x) #x
+#define INCLUDE(x) STRINGIZE(x.h)
+
+#include INCLUDE(MBED_TEST_BLOCKDEVICE)
+
+MBED_TEST_BLOCKDEVICE_DECL;
+
+// sizes are filled in from the block device by test_format
+PartitionedLittleFileSystem2::partition_t table[] = {
+    {"logs",   0, 0, 0, 0},
+    {"config", 0, 0, 0, 0},
+    {"ota",    0, 0, 0, 0},
+};
+const int count = sizeof(table) / sizeof(table[0]);
+PartitionedLittleFileSystem2 parts(&bd, table, count);
+
+File file[2];
+size_t size;
+uint8_t wbuffer[MBED_TEST_BUFFER];
+uint8_t rbuffer[MBED_TEST_BUFFER];
+
+
+// tests for partitions sharing one block device
+
+void test_format()
+{
+    int res = bd.init();
+    TEST_ASSERT_EQUAL(0, res);
+
+    // a quarter each for logs and config, the rest for ota, the config
+    // partition with a larger cache
+    bd_size_t erase_size = bd.get_erase_size();
+    bd_size_t quarter = bd.size() / 4 / erase_size * erase_size;
+    table[0].size = quarter;
+    table[1].size = quarter;
+    table[1].cache_size = 2 * MBED_LFS2_CACHE_SIZE;
+
+    res = bd.deinit();
+    TEST_ASSERT_EQUAL(0, res);
+
+    res = parts.format();
+    TEST_ASSERT_EQUAL(0, res);
+}
+
+void test_isolation()
+{
+    int res = parts.mount();
+    TEST_ASSERT_EQUAL(0, res);
+    res = parts.format();
+    TEST_ASSERT_EQUAL(-EBUSY, res);
+    res = parts.mount();
+    TEST_ASSERT_EQUAL(-EBUSY, res);
+
+    for (int i = 0; i < count; i++) {
+        res = file[0].open(parts.partition(i), "hello", O_WRONLY | O_CREAT);
+        TEST_ASSERT_EQUAL(0, res);
+        size = sprintf((char *)wbuffer, "Hello %s!\n", table[i].name);
+        res = file[0].write(wbuffer, size);
+        TEST_ASSERT_EQUAL(size, res);
+        res = file[0].close();
+        TEST_ASSERT_EQUAL(0, res);
+
+        sprintf((char *)wbuffer, "only_%s", table[i].name);
+        res = parts.partition(i)->mkdir((char *)wbuffer, 0777);
+        TEST_ASSERT_EQUAL(0, res);
+    }
+
+    res = parts.unmount();
+    TEST_ASSERT_EQUAL(0, res);
+    res = parts.mount();
+    TEST_ASSERT_EQUAL(0, res);
+
+    for (int i = 0; i < count; i++) {
+        LittleFileSystem2 *fs = parts.partition(table[i].name);
+        TEST_ASSERT_EQUAL(parts.partition(i), fs);
+
+        res = file[0].open(fs, "hello", O_RDONLY);
+        TEST_ASSERT_EQUAL(0, res);
+        size = sprintf((char *)wbuffer, "Hello %s!\n", table[i].name);
+        res = file[0].read(rbuffer, MBED_TEST_BUFFER);
+        TEST_ASSERT_EQUAL(size, res);
+        res = memcmp(rbuffer, wbuffer, size);
+        TEST_ASSERT_EQUAL(0, res);
+        res = file[0].close();
+        TEST_ASSERT_EQUAL(0, res);
+
+        for (int j = 0; j < count; j++) {
+            struct stat st;
+            sprintf((char *)wbuffer, "only_%s", table[j].name);
+            res = fs->stat((char *)wbuffer, &st);
+            TEST_ASSERT_EQUAL(i == j ? 0 : -ENOENT, res);
+        }
+    }
+
+    res = parts.unmount();
+    TEST_ASSERT_EQUAL(0, res);
+}
+
+#if MBED_CONF_RTOS_PRESENT
+static volatile int writer_res;
+
+static void writer()
+{
+    // stream into ota while the main thread reads config
+    File ota;
+    writer_res = ota.open(parts.partition("ota"), "image", O_WRONLY | O_CREAT | O_TRUNC);
+    for (int i = 0; i < 32 && !writer_res; i++) {
+        int res = ota.write(wbuffer, MBED_TEST_BUFFER);
+        writer_res = (res == MBED_TEST_BUFFER) ? 0 : res;
+    }
+
+    int res = ota.close();
+    writer_res = writer_res ? writer_res : res;
+}
+
+void test_concurrent()
+{
+    int res = parts.mount();
+    TEST_ASSERT_EQUAL(0, res);
+    memset(wbuffer, 'o', MBED_TEST_BUFFER);
+
+    Thread thread;
+    res = thread.start(writer);
+    TEST_ASSERT_EQUAL(osOK, res);
+
+    for (int i = 0; i < 64; i++) {
+        res = file[1].open(parts.partition("config"), "hello", O_RDONLY);
+        TEST_ASSERT_EQUAL(0, res);
+        res = file[1].read(rbuffer, MBED_TEST_BUFFER);
+        TEST_ASSERT_EQUAL(strlen("Hello config!\n"), res);
+        res = file[1].close();
+        TEST_ASSERT_EQUAL(0, res);
+    }
+
+    res = thread.join();
+    TEST_ASSERT_EQUAL(osOK, res);
+    TEST_ASSERT_EQUAL(0, writer_res);
+
+    res = parts.unmount();
+    TEST_ASSERT_EQUAL(0, res);
+}
+#endif
+
+void test_stats()
+{
+    int res = parts.mount();
+    TEST_ASSERT_EQUAL(0, res);
+    parts.reset_stats();
+
+    for (int i = 0; i < count; i++) {
+        res = file[0].open(parts.partition(i), "stats", O_WRONLY | O_CREAT);
+        TEST_ASSERT_EQUAL(0, res);
+        res = file[0].write(wbuffer, 64);
+        TEST_ASSERT_EQUAL(64, res);
+        res = file[0].close();
+        TEST_ASSERT_EQUAL(0, res);
+    }
+
+    // the global view is the sum of every partition
+    LittleFileSystem2::stats_t total;
+    res = parts.get_stats(&total);
+    TEST_ASSERT_EQUAL(0, res);
+
+    uint32_t progs = 0;
+    uint32_t locks = 0;
+    for (int i = 0; i < count; i++) {
+        LittleFileSystem2::stats_t stats;
+        res = parts.partition(i)->get_stats(&stats);
+        TEST_ASSERT_EQUAL(0, res);
+        TEST_ASSERT(stats.fs.prog_count > 0);
+        progs += stats.fs.prog_count;
+        locks += stats.lock_count;
+    }
+    TEST_ASSERT_EQUAL(progs, total.fs.prog_count);
+    TEST_ASSERT(total.lock_count <= locks);
+
+    res = parts.unmount();
+    TEST_ASSERT_EQUAL(0, res);
+}
+
+
+// test setup
+utest::v1::status_t test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(MBED_TEST_TIMEOUT, "default_auto");
+    return verbose_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("Partitions format", test_format),
+    Case("Partitions isolation", test_isolation),
+#if MBED_CONF_RTOS_PRESENT
+    Case("Partitions concurrent access", test_concurrent),
+#endif
+    Case("Partitions stats", test_stats),
+};
+
+Specification specification(test_setup, cases);
+
+int main()
+{
+    return !Harness::run(specification);
+}
@@ -4,15 +4,18 @@
  * Copyright (c) 2017, Arm Limited. All rights reserved.
  * SPDX-License-Identifier: BSD-3-Clause
  */
+#define _POSIX_C_SOURCE 200112L
 #include "emubd/lfs2_emubd.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <assert.h>
 #include <stdbool.h>
@@ -53,14 +56,7 @@ static inline void lfs2_emubd_fromle32(lfs2_emubd_t *emu) {
 }
 
 
-// Block device emulated on existing filesystem
-int lfs2_emubd_create(const struct lfs2_config *cfg, const char *path) {
-    lfs2_emubd_t *emu = cfg->context;
-    emu->cfg.read_size   = cfg->read_size;
-    emu->cfg.prog_size   = cfg->prog_size;
-    emu->cfg.block_size  = cfg->block_size;
-    emu->cfg.block_count = cfg->block_count;
-
+static int lfs2_emubd_open(lfs2_emubd_t *emu, const char *path) {
     // Allocate buffer for creating children files
     size_t pathlen = strlen(path);
     emu->path = malloc(pathlen + 1 + LFS2_NAME_MAX + 1);
@@ -74,26 +70,31 @@ int lfs2_emubd_create(const struct lfs2_config *cfg, const char *path) {
     memset(emu->child, '\0', LFS2_NAME_MAX+1);
 
     // Create directory if it doesn't exist
+    FILE *f;
     int err = mkdir(path, 0777);
     if (err && errno != EEXIST) {
-        return -errno;
+        err = -errno;
+        goto cleanup;
     }
 
     // Load stats to continue incrementing
     snprintf(emu->child, LFS2_NAME_MAX, ".stats");
-    FILE *f = fopen(emu->path, "r");
+    f = fopen(emu->path, "r");
     if (!f) {
         memset(&emu->stats, 0, sizeof(emu->stats));
     } else {
         size_t res = fread(&emu->stats, sizeof(emu->stats), 1, f);
         lfs2_emubd_fromle32(emu);
         if (res < 1) {
-            return -errno;
+            err = (errno) ? -errno : -EIO;
+            fclose(f);
+            goto cleanup;
         }
 
         err = fclose(f);
         if (err) {
-            return -errno;
+            err = -errno;
+            goto cleanup;
         }
     }
 
@@ -106,22 +107,131 @@ int lfs2_emubd_create(const struct lfs2_config *cfg, const char *path) {
         size_t res = fread(&emu->history, sizeof(emu->history), 1, f);
         lfs2_emubd_fromle32(emu);
         if (res < 1) {
-            return -errno;
+            err = (errno) ? -errno : -EIO;
+            fclose(f);
+            goto cleanup;
         }
 
         err = fclose(f);
         if (err) {
-            return -errno;
+            err = -errno;
+            goto cleanup;
+        }
+    }
+
+    return 0;
+
+cleanup:
+    free(emu->path);
+    emu->path = NULL;
+    return err;
+}
+
+
+// Block device emulated on existing filesystem
+int lfs2_emubd_create(const struct lfs2_config *cfg, const char *path) {
+    lfs2_emubd_t *emu = cfg->context;
+    emu->cfg.read_size   = cfg->read_size;
+    emu->cfg.prog_size   = cfg->prog_size;
+    emu->cfg.block_size  = cfg->block_size;
+    emu->cfg.block_count = cfg->block_count;
+    emu->image = NULL;
+    emu->fd = -1;
+
+    return lfs2_emubd_open(emu, path);
+}
+
+// Block device emulated on a single disk image
+int lfs2_emubd_createimage(const struct lfs2_config *cfg, const char *path) {
+    lfs2_emubd_t *emu = cfg->context;
+    emu->cfg.read_size   = cfg->read_size;
+    emu->cfg.prog_size   = cfg->prog_size;
+    emu->cfg.block_size  = cfg->block_size;
+    emu->cfg.block_count = cfg->block_count;
+    emu->image = NULL;
+    emu->fd = -1;
+    size_t size = (size_t)cfg->block_size * cfg->block_count;
+
+    if (!path) {
+        // Keep image on the heap
+        emu->path = NULL;
+        emu->child = NULL;
+        memset(&emu->stats, 0, sizeof(emu->stats));
+        memset(&emu->history, 0, sizeof(emu->history));
+
+        emu->image = malloc(size);
+        if (!emu->image) {
+            return -ENOMEM;
+        }
+
+        memset(emu->image, 0xff, size);
+        return 0;
+    }
+
+    int err = lfs2_emubd_open(emu, path);
+    if (err) {
+        return err;
+    }
+
+    // Map image, extending it with erased blocks if it's new or too small
+    struct stat st;
+    void *image;
+    snprintf(emu->child, LFS2_NAME_MAX, "image");
+    emu->fd = open(emu->path, O_RDWR | O_CREAT, 0666);
+    if (emu->fd < 0) {
+        err = -errno;
+        goto cleanup;
+    }
+
+    err = fstat(emu->fd, &st);
+    if (err) {
+        err = -errno;
+        goto cleanup;
+    }
+
+    if ((size_t)st.st_size < size) {
+        err = ftruncate(emu->fd, size);
+        if (err) {
+            err = -errno;
+            goto cleanup;
         }
     }
 
+    image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            emu->fd, 0);
+    if (image == MAP_FAILED) {
+        err = -errno;
+        goto cleanup;
+    }
+
+    emu->image = image;
+    if ((size_t)st.st_size < size) {
+        memset(&emu->image[st.st_size], 0xff, size - st.st_size);
+    }
+
     return 0;
+
+cleanup:
+    if (emu->fd >= 0) {
+        close(emu->fd);
+        emu->fd = -1;
+    }
+    free(emu->path);
+    emu->path = NULL;
+    return err;
 }
 
 void lfs2_emubd_destroy(const struct lfs2_config *cfg) {
     lfs2_emubd_sync(cfg);
 
     lfs2_emubd_t *emu = cfg->context;
+    if (emu->image && emu->fd >= 0) {
+        munmap(emu->image, (size_t)cfg->block_size * cfg->block_count);
+        close(emu->fd);
+    } else {
+        free(emu->image);
+    }
+
     free(emu->path);
 }
 
@@ -135,6 +245,13 @@ int lfs2_emubd_read(const struct lfs2_config *cfg, lfs2_block_t block,
     assert(size % cfg->read_size == 0);
     assert(block < cfg->block_count);
 
+    // Read from image?
+    if (emu->image) {
+        memcpy(data, &emu->image[(size_t)block*cfg->block_size + off], size);
+        emu->stats.read_count += 1;
+        return 0;
+    }
+
     // Zero out buffer for debugging
     memset(data, 0, size);
 
@@ -167,6 +284,17 @@ int lfs2_emubd_read(const struct lfs2_config *cfg, lfs2_block_t block,
     return 0;
 }
 
+static void lfs2_emubd_progged(lfs2_emubd_t *emu, lfs2_block_t block) {
+    // update history and stats
+    if (block != emu->history.blocks[0]) {
+        memmove(&emu->history.blocks[1], &emu->history.blocks[0],
+                sizeof(emu->history) - sizeof(emu->history.blocks[0]));
+        emu->history.blocks[0] = block;
+    }
+
+    emu->stats.prog_count += 1;
+}
+
 int lfs2_emubd_prog(const struct lfs2_config *cfg, lfs2_block_t block,
         lfs2_off_t off, const void *buffer, lfs2_size_t size) {
     lfs2_emubd_t *emu = cfg->context;
@@ -177,6 +305,13 @@ int lfs2_emubd_prog(const struct lfs2_config *cfg, lfs2_block_t block,
     assert(size % cfg->prog_size == 0);
     assert(block < cfg->block_count);
 
+    // Program image?
+    if (emu->image) {
+        memcpy(&emu->image[(size_t)block*cfg->block_size + off], data, size);
+        lfs2_emubd_progged(emu, block);
+        return 0;
+    }
+
     // Program data
     snprintf(emu->child, LFS2_NAME_MAX, "%" PRIx32, block);
 
@@ -214,14 +349,7 @@ int lfs2_emubd_prog(const struct lfs2_config *cfg, lfs2_block_t block,
         return -errno;
     }
 
-    // update history and stats
-    if (block != emu->history.blocks[0]) {
-        memcpy(&emu->history.blocks[1], &emu->history.blocks[0],
-                sizeof(emu->history) - sizeof(emu->history.blocks[0]));
-        emu->history.blocks[0] = block;
-    }
-
-    emu->stats.prog_count += 1;
+    lfs2_emubd_progged(emu, block);
     return 0;
 }
 
@@ -231,6 +359,14 @@ int lfs2_emubd_erase(const struct lfs2_config *cfg, lfs2_block_t block) {
     // Check if erase is valid
     assert(block < cfg->block_count);
 
+    // Erase image?
+    if (emu->image) {
+        memset(&emu->image[(size_t)block*cfg->block_size],
+                0xff, cfg->block_size);
+        emu->stats.erase_count += 1;
+        return 0;
+    }
+
     // Erase the block
     snprintf(emu->child, LFS2_NAME_MAX, "%" PRIx32, block);
     struct stat st;
@@ -265,6 +401,11 @@ int lfs2_emubd_erase(const struct lfs2_config *cfg, lfs2_block_t block) {
 int lfs2_emubd_sync(const struct lfs2_config *cfg) {
     lfs2_emubd_t *emu = cfg->context;
 
+    // Nothing to write out if the image is only on the heap
+    if (!emu->path) {
+        return 0;
+    }
+
     // Just write out info/stats for later lookup
     snprintf(emu->child, LFS2_NAME_MAX, ".config");
     FILE *f = fopen(emu->path, "w");
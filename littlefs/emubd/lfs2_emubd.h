@@ -39,6 +39,10 @@ typedef struct lfs2_emubd {
     char *path;
     char *child;
 
+    // blocks stored in a single image, NULL when each block is a file
+    uint8_t *image;
+    int fd;
+
     struct {
         uint64_t read_count;
         uint64_t prog_count;
@@ -61,6 +65,15 @@ typedef struct lfs2_emubd {
 // Create a block device using path for the directory to store blocks
 int lfs2_emubd_create(const struct lfs2_config *cfg, const char *path);
 
+// Create a block device stored in a single disk image
+//
+// The image of block_size*block_count bytes is kept in path/image and
+// mapped into memory, with the stats and history kept next to it as in
+// lfs2_emubd_create. If path is NULL, the image is kept on the heap and
+// is lost on destroy. Erased blocks read as 0xff, so the image can be
+// written directly to flash. Bad blocks can't be emulated in this mode.
+int lfs2_emubd_createimage(const struct lfs2_config *cfg, const char *path);
+
 // Clean up memory associated with emu block device
 void lfs2_emubd_destroy(const struct lfs2_config *cfg);
 
@@ -19,6 +19,53 @@
 #include "lfs2_util.h"
 
 
+/// Geometry, may be fixed at compile time ///
+static inline lfs2_size_t lfs2_read_size(const lfs2_t *lfs2) {
+#ifdef LFS2_STATIC_READ_SIZE
+    (void)lfs2;
+    return LFS2_STATIC_READ_SIZE;
+#else
+    return lfs2->cfg->read_size;
+#endif
+}
+
+static inline lfs2_size_t lfs2_prog_size(const lfs2_t *lfs2) {
+#ifdef LFS2_STATIC_PROG_SIZE
+    (void)lfs2;
+    return LFS2_STATIC_PROG_SIZE;
+#else
+    return lfs2->cfg->prog_size;
+#endif
+}
+
+static inline lfs2_size_t lfs2_block_size(const lfs2_t *lfs2) {
+#ifdef LFS2_STATIC_BLOCK_SIZE
+    (void)lfs2;
+    return LFS2_STATIC_BLOCK_SIZE;
+#else
+    return lfs2->cfg->block_size;
+#endif
+}
+
+static inline lfs2_size_t lfs2_block_count(const lfs2_t *lfs2) {
+#ifdef LFS2_STATIC_BLOCK_COUNT
+    (void)lfs2;
+    return LFS2_STATIC_BLOCK_COUNT;
+#else
+    return lfs2->cfg->block_count;
+#endif
+}
+
+static inline lfs2_size_t lfs2_cache_size(const lfs2_t *lfs2) {
+#ifdef LFS2_STATIC_CACHE_SIZE
+    (void)lfs2;
+    return LFS2_STATIC_CACHE_SIZE;
+#else
+    return lfs2->cfg->cache_size;
+#endif
+}
+
+
 /// Caching block device operations ///
 static inline void lfs2_cache_drop(lfs2_t *lfs2, lfs2_cache_t *rcache) {
     // do not zero, cheaper if cache is readonly or only going to be
@@ -29,20 +76,58 @@ static inline void lfs2_cache_drop(lfs2_t *lfs2, lfs2_cache_t *rcache) {
 
 static inline void lfs2_cache_zero(lfs2_t *lfs2, lfs2_cache_t *pcache) {
     // zero to avoid information leak
-    memset(pcache->buffer, 0xff, lfs2->cfg->prog_size);
+    memset(pcache->buffer, 0xff, lfs2_prog_size(lfs2));
     pcache->block = 0xffffffff;
 }
 
+static inline lfs2_cache_t *lfs2_cache_line(lfs2_t *lfs2,
+        lfs2_cache_t *rcache, lfs2_size_t i) {
+    // the first line is always the rcache we were given, only our own
+    // rcache has any other lines
+    return (i == 0) ? rcache : &lfs2->rlines.lines[i-1];
+}
+
+static lfs2_cache_t *lfs2_cache_evict(lfs2_t *lfs2,
+        lfs2_cache_t *rcache, lfs2_size_t count) {
+    // clock replacement, lines that have been used since the hand last
+    // passed get a second chance
+    while (true) {
+        lfs2_size_t i = lfs2->rlines.hand % count;
+        lfs2->rlines.hand = (i + 1) % count;
+
+        lfs2_cache_t *line = lfs2_cache_line(lfs2, rcache, i);
+        if (line->block == 0xffffffff || !(lfs2->rlines.ref & (1U << i))) {
+            lfs2->rlines.ref |= 1U << i;
+            return line;
+        }
+
+        lfs2->rlines.ref &= ~(1U << i);
+    }
+}
+
+static void lfs2_cache_dropblock(lfs2_t *lfs2, lfs2_block_t block) {
+    // drop any lines of a block that has changed on disk
+    for (lfs2_size_t i = 0; i < lfs2->rlines.count; i++) {
+        lfs2_cache_t *line = lfs2_cache_line(lfs2, &lfs2->rcache, i);
+        if (line->block == block) {
+            lfs2_cache_drop(lfs2, line);
+        }
+    }
+}
+
 static int lfs2_bd_read(lfs2_t *lfs2,
         const lfs2_cache_t *pcache, lfs2_cache_t *rcache, lfs2_size_t hint,
         lfs2_block_t block, lfs2_off_t off,
         void *buffer, lfs2_size_t size) {
     uint8_t *data = buffer;
     LFS2_ASSERT(block != 0xffffffff);
-    if (off+size > lfs2->cfg->block_size) {
+    if (off+size > lfs2_block_size(lfs2)) {
         return LFS2_ERR_CORRUPT;
     }
 
+    bool shared = (rcache == &lfs2->rcache);
+    lfs2_size_t count = shared ? lfs2->rlines.count : 1;
+
     while (size > 0) {
         lfs2_size_t diff = size;
 
@@ -63,27 +148,40 @@ static int lfs2_bd_read(lfs2_t *lfs2,
             diff = lfs2_min(diff, pcache->off-off);
         }
 
-        if (block == rcache->block &&
-                off < rcache->off + rcache->size) {
-            if (off >= rcache->off) {
-                // is already in rcache?
-                diff = lfs2_min(diff, rcache->size - (off-rcache->off));
-                memcpy(data, &rcache->buffer[off-rcache->off], diff);
+        lfs2_cache_t *hit = NULL;
+        for (lfs2_size_t i = 0; i < count; i++) {
+            lfs2_cache_t *line = lfs2_cache_line(lfs2, rcache, i);
+            if (block == line->block &&
+                    off < line->off + line->size) {
+                if (off >= line->off) {
+                    hit = line;
+                    lfs2->rlines.ref |= (shared) ? 1U << i : 0;
+                    break;
+                }
 
-                data += diff;
-                off += diff;
-                size -= diff;
-                continue;
+                // rcache takes priority
+                diff = lfs2_min(diff, line->off-off);
             }
+        }
 
-            // rcache takes priority
-            diff = lfs2_min(diff, rcache->off-off);
+        if (hit) {
+            // is already in rcache?
+            diff = lfs2_min(diff, hit->size - (off-hit->off));
+            memcpy(data, &hit->buffer[off-hit->off], diff);
+            lfs2->stats.rcache_hits += (shared) ? 1 : 0;
+
+            data += diff;
+            off += diff;
+            size -= diff;
+            continue;
         }
 
-        if (size >= hint && off % lfs2->cfg->read_size == 0 &&
-                size >= lfs2->cfg->read_size) {
+        if (size >= hint && off % lfs2_read_size(lfs2) == 0 &&
+                size >= lfs2_read_size(lfs2)) {
             // bypass cache?
-            diff = lfs2_aligndown(diff, lfs2->cfg->read_size);
+            diff = lfs2_aligndown(diff, lfs2_read_size(lfs2));
+            lfs2->stats.read_count += 1;
+            lfs2->stats.read_bytes += diff;
             int err = lfs2->cfg->read(lfs2->cfg, block, off, data, diff);
             if (err) {
                 return err;
@@ -96,15 +194,23 @@ static int lfs2_bd_read(lfs2_t *lfs2,
         }
 
         // load to cache, first condition can no longer fail
-        LFS2_ASSERT(block < lfs2->cfg->block_count);
-        rcache->block = block;
-        rcache->off = lfs2_aligndown(off, lfs2->cfg->read_size);
-        rcache->size = lfs2_min(lfs2_alignup(off+hint, lfs2->cfg->read_size),
-                lfs2_min(lfs2->cfg->block_size - rcache->off,
-                    lfs2->cfg->cache_size));
-        int err = lfs2->cfg->read(lfs2->cfg, rcache->block,
-                rcache->off, rcache->buffer, rcache->size);
+        LFS2_ASSERT(block < lfs2_block_count(lfs2));
+        lfs2_cache_t *line = (count > 1)
+                ? lfs2_cache_evict(lfs2, rcache, count)
+                : rcache;
+        line->block = block;
+        line->off = lfs2_aligndown(off, lfs2_read_size(lfs2));
+        line->size = lfs2_min(lfs2_alignup(off+hint, lfs2_read_size(lfs2)),
+                lfs2_min(lfs2_block_size(lfs2) - line->off,
+                    lfs2_cache_size(lfs2)));
+        lfs2->stats.rcache_misses += (shared) ? 1 : 0;
+        lfs2->rlines.loads += (shared) ? 1 : 0;
+        lfs2->stats.read_count += 1;
+        lfs2->stats.read_bytes += line->size;
+        int err = lfs2->cfg->read(lfs2->cfg, line->block,
+                line->off, line->buffer, line->size);
         if (err) {
+            lfs2_cache_drop(lfs2, line);
             return err;
         }
     }
@@ -124,35 +230,64 @@ static int lfs2_bd_cmp(lfs2_t *lfs2,
         const void *buffer, lfs2_size_t size) {
     const uint8_t *data = buffer;
 
-    for (lfs2_off_t i = 0; i < size; i++) {
-        uint8_t dat;
+    // compare a chunk at a time, these are usually served from the cache
+    uint8_t dat[16];
+    for (lfs2_off_t i = 0; i < size; i += sizeof(dat)) {
+        lfs2_size_t diff = lfs2_min(size-i, sizeof(dat));
         int err = lfs2_bd_read(lfs2,
                 pcache, rcache, hint-i,
-                block, off+i, &dat, 1);
+                block, off+i, dat, diff);
         if (err) {
             return err;
         }
 
-        if (dat != data[i]) {
-            return (dat < data[i]) ? LFS2_CMP_LT : LFS2_CMP_GT;
+        int res = memcmp(dat, data + i, diff);
+        if (res) {
+            return (res < 0) ? LFS2_CMP_LT : LFS2_CMP_GT;
         }
     }
 
     return LFS2_CMP_EQ;
 }
 
+static int lfs2_bd_crc(lfs2_t *lfs2,
+        const lfs2_cache_t *pcache, lfs2_cache_t *rcache, lfs2_size_t hint,
+        lfs2_block_t block, lfs2_off_t off, lfs2_size_t size, uint32_t *crc) {
+    // crc a chunk at a time, these are usually served from the cache
+    uint8_t dat[16];
+    for (lfs2_off_t i = 0; i < size; i += sizeof(dat)) {
+        lfs2_size_t diff = lfs2_min(size-i, sizeof(dat));
+        int err = lfs2_bd_read(lfs2,
+                pcache, rcache, hint-i,
+                block, off+i, dat, diff);
+        if (err) {
+            return err;
+        }
+
+        *crc = lfs2_crc(*crc, dat, diff);
+    }
+
+    return 0;
+}
+
 static int lfs2_bd_flush(lfs2_t *lfs2,
         lfs2_cache_t *pcache, lfs2_cache_t *rcache, bool validate) {
     if (pcache->block != 0xffffffff && pcache->block != 0xfffffffe) {
-        LFS2_ASSERT(pcache->block < lfs2->cfg->block_count);
-        lfs2_size_t diff = lfs2_alignup(pcache->size, lfs2->cfg->prog_size);
+        LFS2_ASSERT(pcache->block < lfs2_block_count(lfs2));
+        lfs2_size_t diff = lfs2_alignup(pcache->size, lfs2_prog_size(lfs2));
+        lfs2->stats.prog_count += 1;
+        lfs2->stats.prog_bytes += diff;
         int err = lfs2->cfg->prog(lfs2->cfg, pcache->block,
                 pcache->off, pcache->buffer, diff);
+        lfs2_cache_dropblock(lfs2, pcache->block);
+        if (pcache->block == lfs2->epool.erased) {
+            lfs2->epool.erased = 0xffffffff;
+        }
         if (err) {
             return err;
         }
 
-        if (validate) {
+        if (validate && lfs2->cfg->validate == LFS2_VALIDATE_ALL) {
             // check data on disk
             lfs2_cache_drop(lfs2, rcache);
             int res = lfs2_bd_cmp(lfs2,
@@ -182,6 +317,7 @@ static int lfs2_bd_sync(lfs2_t *lfs2,
         return err;
     }
 
+    lfs2->stats.sync_count += 1;
     return lfs2->cfg->sync(lfs2->cfg);
 }
 
@@ -191,23 +327,31 @@ static int lfs2_bd_prog(lfs2_t *lfs2,
         const void *buffer, lfs2_size_t size) {
     const uint8_t *data = buffer;
     LFS2_ASSERT(block != 0xffffffff);
-    LFS2_ASSERT(off + size <= lfs2->cfg->block_size);
+    LFS2_ASSERT(off + size <= lfs2_block_size(lfs2));
 
+    bool miss = false;
     while (size > 0) {
         if (block == pcache->block &&
                 off >= pcache->off &&
-                off < pcache->off + lfs2->cfg->cache_size) {
+                off < pcache->off + lfs2_cache_size(lfs2)) {
             // already fits in pcache?
+            lfs2->stats.pcache_hits += (miss) ? 0 : 1;
+            miss = false;
             lfs2_size_t diff = lfs2_min(size,
-                    lfs2->cfg->cache_size - (off-pcache->off));
-            memcpy(&pcache->buffer[off-pcache->off], data, diff);
+                    lfs2_cache_size(lfs2) - (off-pcache->off));
+            if (data) {
+                memcpy(&pcache->buffer[off-pcache->off], data, diff);
+                data += diff;
+            } else {
+                // no buffer programs zeros
+                memset(&pcache->buffer[off-pcache->off], 0, diff);
+            }
 
-            data += diff;
             off += diff;
             size -= diff;
 
             pcache->size = off - pcache->off;
-            if (pcache->size == lfs2->cfg->cache_size) {
+            if (pcache->size == lfs2_cache_size(lfs2)) {
                 // eagerly flush out pcache if we fill up
                 int err = lfs2_bd_flush(lfs2, pcache, rcache, validate);
                 if (err) {
@@ -224,15 +368,19 @@ static int lfs2_bd_prog(lfs2_t *lfs2,
 
         // prepare pcache, first condition can no longer fail
         pcache->block = block;
-        pcache->off = lfs2_aligndown(off, lfs2->cfg->prog_size);
+        pcache->off = lfs2_aligndown(off, lfs2_prog_size(lfs2));
         pcache->size = 0;
+        lfs2->stats.pcache_misses += 1;
+        miss = true;
     }
 
     return 0;
 }
 
 static int lfs2_bd_erase(lfs2_t *lfs2, lfs2_block_t block) {
-    LFS2_ASSERT(block < lfs2->cfg->block_count);
+    LFS2_ASSERT(block < lfs2_block_count(lfs2));
+    lfs2_cache_dropblock(lfs2, block);
+    lfs2->stats.erase_count += 1;
     return lfs2->cfg->erase(lfs2->cfg, block);
 }
 
@@ -408,6 +556,7 @@ static inline void lfs2_superblock_fromle32(lfs2_superblock_t *superblock) {
     superblock->name_max    = lfs2_fromle32(superblock->name_max);
     superblock->file_max    = lfs2_fromle32(superblock->file_max);
     superblock->attr_max    = lfs2_fromle32(superblock->attr_max);
+    superblock->inline_max  = lfs2_fromle32(superblock->inline_max);
 }
 
 static inline void lfs2_superblock_tole32(lfs2_superblock_t *superblock) {
@@ -417,6 +566,30 @@ static inline void lfs2_superblock_tole32(lfs2_superblock_t *superblock) {
     superblock->name_max    = lfs2_tole32(superblock->name_max);
     superblock->file_max    = lfs2_tole32(superblock->file_max);
     superblock->attr_max    = lfs2_tole32(superblock->attr_max);
+    superblock->inline_max  = lfs2_tole32(superblock->inline_max);
+}
+
+// mount checkpoint, stored after the superblock in the same entry so other
+// drivers still read a normal superblock
+typedef struct lfs2_checkpoint {
+    lfs2_block_t root[2];
+    struct lfs2_gstate gstate;
+    lfs2_block_t used;
+    uint32_t crc;
+} lfs2_checkpoint_t;
+
+static inline void lfs2_checkpoint_fromle32(lfs2_checkpoint_t *checkpoint) {
+    lfs2_pair_fromle32(checkpoint->root);
+    lfs2_gstate_fromle32(&checkpoint->gstate);
+    checkpoint->used = lfs2_fromle32(checkpoint->used);
+    checkpoint->crc  = lfs2_fromle32(checkpoint->crc);
+}
+
+static inline void lfs2_checkpoint_tole32(lfs2_checkpoint_t *checkpoint) {
+    lfs2_pair_tole32(checkpoint->root);
+    lfs2_gstate_tole32(&checkpoint->gstate);
+    checkpoint->used = lfs2_tole32(checkpoint->used);
+    checkpoint->crc  = lfs2_tole32(checkpoint->crc);
 }
 
 
@@ -428,6 +601,8 @@ static int lfs2_dir_compact(lfs2_t *lfs2,
         lfs2_mdir_t *source, uint16_t begin, uint16_t end);
 static int lfs2_file_relocate(lfs2_t *lfs2, lfs2_file_t *file);
 static int lfs2_file_flush(lfs2_t *lfs2, lfs2_file_t *file);
+static bool lfs2_file_isshared(lfs2_t *lfs2, const lfs2_file_t *file);
+static void lfs2_file_putcache(lfs2_t *lfs2, lfs2_file_t *file);
 static void lfs2_fs_preporphans(lfs2_t *lfs2, int8_t orphans);
 static void lfs2_fs_prepmove(lfs2_t *lfs2,
         uint16_t id, const lfs2_block_t pair[2]);
@@ -437,6 +612,7 @@ static lfs2_stag_t lfs2_fs_parent(lfs2_t *lfs2, const lfs2_block_t dir[2],
         lfs2_mdir_t *parent);
 static int lfs2_fs_relocate(lfs2_t *lfs2,
         const lfs2_block_t oldpair[2], lfs2_block_t newpair[2]);
+static int lfs2_fs_uncheckpoint(lfs2_t *lfs2);
 static int lfs2_fs_forceconsistency(lfs2_t *lfs2);
 static int lfs2_deinit(lfs2_t *lfs2);
 
@@ -444,7 +620,10 @@ static int lfs2_deinit(lfs2_t *lfs2);
 static int lfs2_alloc_lookahead(void *p, lfs2_block_t block) {
     lfs2_t *lfs2 = (lfs2_t*)p;
     lfs2_block_t off = ((block - lfs2->free.off)
-            + lfs2->cfg->block_count) % lfs2->cfg->block_count;
+            + lfs2_block_count(lfs2)) % lfs2_block_count(lfs2);
+
+    // count blocks in use while we're here
+    lfs2->free.used += 1;
 
     if (off < lfs2->free.size) {
         lfs2->free.buffer[off / 32] |= 1U << (off % 32);
@@ -453,7 +632,170 @@ static int lfs2_alloc_lookahead(void *p, lfs2_block_t block) {
     return 0;
 }
 
-static int lfs2_alloc(lfs2_t *lfs2, lfs2_block_t *block) {
+static int lfs2_alloc_mark(void *p, lfs2_block_t block) {
+    lfs2_t *lfs2 = (lfs2_t*)p;
+    if (block < lfs2_block_count(lfs2)) {
+        lfs2->free.buffer[block / 32] |= 1U << (block % 32);
+    }
+
+    return 0;
+}
+
+static int lfs2_alloc_rebuild(lfs2_t *lfs2) {
+    // find mask of free blocks from tree
+    lfs2->stats.alloc_scans += 1;
+    lfs2->free.size = 0;
+    memset(lfs2->free.buffer, 0, lfs2->cfg->freemap_size);
+    int err = lfs2_fs_traverse(lfs2, lfs2_alloc_mark, lfs2);
+    if (err) {
+        return err;
+    }
+
+    // blocks allocated since the last ack may not be in the tree yet, these
+    // are the blocks our cursor has passed over since the ack
+    for (lfs2_block_t n = lfs2->free.ack; n < lfs2_block_count(lfs2); n++) {
+        lfs2_alloc_mark(lfs2, (lfs2->free.i + n) % lfs2_block_count(lfs2));
+    }
+
+    // the map is an exact picture of the blocks in use
+    lfs2->free.used = 0;
+    for (lfs2_block_t i = 0; i < (lfs2_block_count(lfs2)+31)/32; i++) {
+        lfs2->free.used += lfs2_popc(lfs2->free.buffer[i]);
+    }
+
+    lfs2->free.size = lfs2_block_count(lfs2);
+    return 0;
+}
+
+static int lfs2_alloc_map(lfs2_t *lfs2, lfs2_block_t *block) {
+    bool rebuilt = false;
+    while (true) {
+        if (lfs2->free.size == lfs2_block_count(lfs2)) {
+            // scan the map starting at our cursor, this rotates allocations
+            // around the device for wear-leveling
+            lfs2_block_t n = 0;
+            while (n < lfs2_block_count(lfs2)) {
+                lfs2_block_t off = (lfs2->free.i + n) % lfs2_block_count(lfs2);
+                if (off % 32 == 0 && n + 32 <= lfs2_block_count(lfs2) &&
+                        lfs2->free.buffer[off / 32] == 0xffffffff) {
+                    // skip full words
+                    n += 32;
+                    continue;
+                }
+
+                n += 1;
+                if (!(lfs2->free.buffer[off / 32] & (1U << (off % 32)))) {
+                    // found a free block
+                    lfs2->free.buffer[off / 32] |= 1U << (off % 32);
+                    lfs2->free.ack -= lfs2_min(n, lfs2->free.ack);
+                    lfs2->free.i = (off + 1) % lfs2_block_count(lfs2);
+                    if (lfs2->free.used != 0xffffffff) {
+                        lfs2->free.used += 1;
+                    }
+                    lfs2->free.pending += 1;
+                    *block = off;
+                    return 0;
+                }
+            }
+
+            // blocks may have leaked from the map, the tree is the only
+            // source of truth, but if we just checked it we're out of space
+            if (rebuilt) {
+                LFS2_WARN("No more free space %"PRIu32, lfs2->free.i);
+                return LFS2_ERR_NOSPC;
+            }
+        }
+
+        int err = lfs2_alloc_rebuild(lfs2);
+        if (err) {
+            return err;
+        }
+
+        rebuilt = true;
+    }
+}
+
+static void lfs2_alloc_free(lfs2_t *lfs2, lfs2_block_t block) {
+    if (block >= lfs2_block_count(lfs2)) {
+        return;
+    }
+
+    if (lfs2->cfg->freemap_size) {
+        // the free map only counts blocks it has marked
+        if (lfs2->free.size == lfs2_block_count(lfs2) &&
+                (lfs2->free.buffer[block / 32] & (1U << (block % 32)))) {
+            lfs2->free.buffer[block / 32] &= ~(1U << (block % 32));
+            if (lfs2->free.used != 0xffffffff) {
+                lfs2->free.used -= 1;
+            }
+        }
+    } else if (lfs2->free.used != 0xffffffff && lfs2->free.used > 0) {
+        // the lookahead buffer finds freed blocks on its next pass over
+        // the tree, but we can keep our count up to date
+        lfs2->free.used -= 1;
+    }
+}
+
+static void lfs2_alloc_drop(lfs2_t *lfs2) {
+    // we've left blocks behind that we can't free, either we don't know
+    // which they are or something else may still use them, either way our
+    // count is off until we count the tree again
+    lfs2->free.used = 0xffffffff;
+}
+
+static bool lfs2_alloc_isopen(lfs2_t *lfs2, const struct lfs2_mlist *skip,
+        const lfs2_block_t pair[2], uint16_t id) {
+    // check if an open file or dir still refers to a metadata pair, or to
+    // a specific entry in the pair, in which case we can't free its blocks
+    for (struct lfs2_mlist *d = lfs2->mlist; d; d = d->next) {
+        if (d == skip) {
+            continue;
+        }
+
+        if (lfs2_pair_cmp(d->m.pair, pair) == 0 &&
+                (id == 0x3ff || (d->type == LFS2_TYPE_REG && d->id == id))) {
+            return true;
+        }
+
+        if (id == 0x3ff && d->type == LFS2_TYPE_DIR &&
+                lfs2_pair_cmp(((struct lfs2_dir*)d)->head, pair) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool lfs2_alloc_inflight(lfs2_t *lfs2) {
+    // check if an open file has blocks that aren't committed yet, these
+    // share blocks with the tree so traversals count them twice
+    for (struct lfs2_mlist *p = lfs2->mlist; p; p = p->next) {
+        if (p->type == LFS2_TYPE_REG &&
+                (((lfs2_file_t*)p)->flags & (LFS2_F_DIRTY | LFS2_F_WRITING)) &&
+                !(((lfs2_file_t*)p)->flags & LFS2_F_INLINE)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool lfs2_alloc_erased(lfs2_t *lfs2, lfs2_block_t *block) {
+    // take a block from the erase pool if there is one
+    if (lfs2->epool.count == 0) {
+        return false;
+    }
+
+    lfs2->epool.count -= 1;
+    *block = lfs2->epool.blocks[lfs2->epool.count];
+    return true;
+}
+
+static int lfs2_alloc_scan(lfs2_t *lfs2, lfs2_block_t *block) {
+    if (lfs2->cfg->freemap_size) {
+        return lfs2_alloc_map(lfs2, block);
+    }
+
     while (true) {
         while (lfs2->free.i != lfs2->free.size) {
             lfs2_block_t off = lfs2->free.i;
@@ -462,7 +804,11 @@ static int lfs2_alloc(lfs2_t *lfs2, lfs2_block_t *block) {
 
             if (!(lfs2->free.buffer[off / 32] & (1U << (off % 32)))) {
                 // found a free block
-                *block = (lfs2->free.off + off) % lfs2->cfg->block_count;
+                *block = (lfs2->free.off + off) % lfs2_block_count(lfs2);
+                if (lfs2->free.used != 0xffffffff) {
+                    lfs2->free.used += 1;
+                }
+                lfs2->free.pending += 1;
 
                 // eagerly find next off so an alloc ack can
                 // discredit old lookahead blocks
@@ -485,21 +831,47 @@ static int lfs2_alloc(lfs2_t *lfs2, lfs2_block_t *block) {
         }
 
         lfs2->free.off = (lfs2->free.off + lfs2->free.size)
-                % lfs2->cfg->block_count;
+                % lfs2_block_count(lfs2);
         lfs2->free.size = lfs2_min(8*lfs2->cfg->lookahead_size, lfs2->free.ack);
         lfs2->free.i = 0;
 
-        // find mask of free blocks from tree
+        // find mask of free blocks from tree, this also recounts the
+        // blocks in use
         memset(lfs2->free.buffer, 0, lfs2->cfg->lookahead_size);
+        lfs2_block_t used = lfs2->free.used;
+        lfs2->free.used = 0;
+        lfs2->stats.alloc_scans += 1;
         int err = lfs2_fs_traverse(lfs2, lfs2_alloc_lookahead, lfs2);
         if (err) {
+            lfs2->free.used = 0xffffffff;
             return err;
         }
+
+        if (lfs2->free.pending || lfs2_alloc_inflight(lfs2)) {
+            // the recount is only exact if nothing is in flight, blocks
+            // allocated since the last ack may not be in the tree yet, so
+            // keep our running count
+            lfs2->free.used = used;
+        }
+    }
+}
+
+static int lfs2_alloc(lfs2_t *lfs2, lfs2_block_t *block) {
+    int err = lfs2_alloc_scan(lfs2, block);
+    if (err == LFS2_ERR_NOSPC && lfs2_alloc_erased(lfs2, block)) {
+        // the erase pool still holds free blocks
+        return 0;
     }
+
+    return err;
 }
 
 static void lfs2_alloc_ack(lfs2_t *lfs2) {
-    lfs2->free.ack = lfs2->cfg->block_count;
+    lfs2->free.ack = lfs2_block_count(lfs2);
+    lfs2->free.pending = 0;
+    // a pair from the erase pool is compacted by the operation that
+    // allocated it, if that operation failed first forget about it
+    lfs2->epool.erased = 0xffffffff;
 }
 
 
@@ -577,7 +949,7 @@ static int lfs2_dir_getread(lfs2_t *lfs2, const lfs2_mdir_t *dir,
         lfs2_tag_t gmask, lfs2_tag_t gtag,
         lfs2_off_t off, void *buffer, lfs2_size_t size) {
     uint8_t *data = buffer;
-    if (off+size > lfs2->cfg->block_size) {
+    if (off+size > lfs2_block_size(lfs2)) {
         return LFS2_ERR_CORRUPT;
     }
 
@@ -620,12 +992,12 @@ static int lfs2_dir_getread(lfs2_t *lfs2, const lfs2_mdir_t *dir,
 
         // load to cache, first condition can no longer fail
         rcache->block = 0xfffffffe;
-        rcache->off = lfs2_aligndown(off, lfs2->cfg->read_size);
-        rcache->size = lfs2_min(lfs2_alignup(off+hint, lfs2->cfg->read_size),
-                lfs2->cfg->cache_size);
+        rcache->off = lfs2_aligndown(off, lfs2_read_size(lfs2));
+        rcache->size = lfs2_min(lfs2_alignup(off+hint, lfs2_read_size(lfs2)),
+                lfs2_cache_size(lfs2));
         int err = lfs2_dir_getslice(lfs2, dir, gmask, gtag,
                 rcache->off, rcache->buffer, rcache->size);
-        if (err) {
+        if (err < 0) {
             return err;
         }
     }
@@ -805,7 +1177,7 @@ static lfs2_stag_t lfs2_dir_fetchmatch(lfs2_t *lfs2,
             lfs2_tag_t tag;
             off += lfs2_tag_dsize(ptag);
             int err = lfs2_bd_read(lfs2,
-                    NULL, &lfs2->rcache, lfs2->cfg->block_size,
+                    NULL, &lfs2->rcache, lfs2_block_size(lfs2),
                     dir->pair[0], off, &tag, sizeof(tag));
             if (err) {
                 if (err == LFS2_ERR_CORRUPT) {
@@ -821,7 +1193,7 @@ static lfs2_stag_t lfs2_dir_fetchmatch(lfs2_t *lfs2,
 
             // next commit not yet programmed or we're not in valid range
             if (!lfs2_tag_isvalid(tag) ||
-                    off + lfs2_tag_dsize(tag) > lfs2->cfg->block_size) {
+                    off + lfs2_tag_dsize(tag) > lfs2_block_size(lfs2)) {
                 dir->erased = (lfs2_tag_type1(ptag) == LFS2_TYPE_CRC);
                 break;
             }
@@ -832,7 +1204,7 @@ static lfs2_stag_t lfs2_dir_fetchmatch(lfs2_t *lfs2,
                 // check the crc attr
                 uint32_t dcrc;
                 err = lfs2_bd_read(lfs2,
-                        NULL, &lfs2->rcache, lfs2->cfg->block_size,
+                        NULL, &lfs2->rcache, lfs2_block_size(lfs2),
                         dir->pair[0], off+sizeof(tag), &dcrc, sizeof(dcrc));
                 if (err) {
                     if (err == LFS2_ERR_CORRUPT) {
@@ -870,20 +1242,16 @@ static lfs2_stag_t lfs2_dir_fetchmatch(lfs2_t *lfs2,
             }
 
             // crc the entry first, hopefully leaving it in the cache
-            for (lfs2_off_t j = sizeof(tag); j < lfs2_tag_dsize(tag); j++) {
-                uint8_t dat;
-                err = lfs2_bd_read(lfs2,
-                        NULL, &lfs2->rcache, lfs2->cfg->block_size,
-                        dir->pair[0], off+j, &dat, 1);
-                if (err) {
-                    if (err == LFS2_ERR_CORRUPT) {
-                        dir->erased = false;
-                        break;
-                    }
+            err = lfs2_bd_crc(lfs2,
+                    NULL, &lfs2->rcache, lfs2_block_size(lfs2),
+                    dir->pair[0], off+sizeof(tag),
+                    lfs2_tag_dsize(tag)-sizeof(tag), &crc);
+            if (err) {
+                if (err != LFS2_ERR_CORRUPT) {
                     return err;
                 }
 
-                crc = lfs2_crc(crc, &dat, 1);
+                dir->erased = false;
             }
 
             // directory modification tags?
@@ -906,7 +1274,7 @@ static lfs2_stag_t lfs2_dir_fetchmatch(lfs2_t *lfs2,
                 tempsplit = (lfs2_tag_chunk(tag) & 1);
 
                 err = lfs2_bd_read(lfs2,
-                        NULL, &lfs2->rcache, lfs2->cfg->block_size,
+                        NULL, &lfs2->rcache, lfs2_block_size(lfs2),
                         dir->pair[0], off+sizeof(tag), &temptail, 8);
                 if (err) {
                     if (err == LFS2_ERR_CORRUPT) {
@@ -1001,6 +1369,25 @@ static int lfs2_dir_getgstate(lfs2_t *lfs2, const lfs2_mdir_t *dir,
     return 0;
 }
 
+static int lfs2_dir_getctz(lfs2_t *lfs2, const lfs2_mdir_t *dir,
+        uint16_t id, struct lfs2_ctz *ctz) {
+    lfs2_stag_t tag = lfs2_dir_get(lfs2, dir, LFS2_MKTAG(0x700, 0x3ff, 0),
+            LFS2_MKTAG(LFS2_TYPE_STRUCT, id, sizeof(*ctz)), ctz);
+    if (tag < 0 && tag != LFS2_ERR_NOENT) {
+        return tag;
+    }
+
+    if (tag == LFS2_ERR_NOENT || lfs2_tag_type3(tag) != LFS2_TYPE_CTZSTRUCT) {
+        // no skip-list, inline or missing entries don't own any blocks
+        ctz->head = 0xffffffff;
+        ctz->size = 0;
+        return 0;
+    }
+
+    lfs2_ctz_fromle32(ctz);
+    return 0;
+}
+
 static int lfs2_dir_getinfo(lfs2_t *lfs2, lfs2_mdir_t *dir,
         uint16_t id, struct lfs2_info *info) {
     if (id == 0x3ff) {
@@ -1035,6 +1422,146 @@ static int lfs2_dir_getinfo(lfs2_t *lfs2, lfs2_mdir_t *dir,
     return 0;
 }
 
+/// Path cache operations ///
+struct lfs2_dentry {
+    lfs2_block_t parent[2];
+    lfs2_block_t pair[2];
+    lfs2_size_t size;
+    char name[LFS2_DCACHE_NAME_MAX];
+};
+
+static void lfs2_dcache_drop(lfs2_t *lfs2) {
+    for (lfs2_size_t i = 0; i < lfs2->dcache.count; i++) {
+        lfs2->dcache.entries[i].size = 0;
+    }
+}
+
+static const struct lfs2_dentry *lfs2_dcache_find(lfs2_t *lfs2,
+        const lfs2_block_t parent[2], const char *name, lfs2_size_t size) {
+    for (lfs2_size_t i = 0; i < lfs2->dcache.count; i++) {
+        const struct lfs2_dentry *d = &lfs2->dcache.entries[i];
+        if (d->size == size && lfs2_pair_cmp(d->parent, parent) == 0 &&
+                memcmp(d->name, name, size) == 0) {
+            lfs2->stats.dcache_hits += 1;
+            return d;
+        }
+    }
+
+    lfs2->stats.dcache_misses += 1;
+    return NULL;
+}
+
+static void lfs2_dcache_insert(lfs2_t *lfs2, const lfs2_block_t parent[2],
+        const char *name, lfs2_size_t size, const lfs2_block_t pair[2]) {
+    // replace entries round-robin
+    struct lfs2_dentry *d = &lfs2->dcache.entries[lfs2->dcache.hand];
+    lfs2->dcache.hand = (lfs2->dcache.hand + 1) % lfs2->dcache.count;
+
+    d->parent[0] = parent[0];
+    d->parent[1] = parent[1];
+    d->pair[0] = pair[0];
+    d->pair[1] = pair[1];
+    d->size = size;
+    memcpy(d->name, name, size);
+}
+
+/// Metadata index operations ///
+struct lfs2_mentry {
+    lfs2_block_t pair[2];
+    lfs2_block_t pred[2];
+    lfs2_block_t parent[2];
+};
+
+static void lfs2_mindex_drop(lfs2_t *lfs2) {
+    for (lfs2_size_t i = 0; i < lfs2->mindex.count; i++) {
+        memset(&lfs2->mindex.entries[i], 0xff, sizeof(struct lfs2_mentry));
+    }
+}
+
+static struct lfs2_mentry *lfs2_mindex_find(lfs2_t *lfs2,
+        const lfs2_block_t pair[2]) {
+    for (lfs2_size_t i = 0; i < lfs2->mindex.count; i++) {
+        struct lfs2_mentry *e = &lfs2->mindex.entries[i];
+        if (!lfs2_pair_isnull(e->pair) && lfs2_pair_cmp(e->pair, pair) == 0) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static struct lfs2_mentry *lfs2_mindex_get(lfs2_t *lfs2,
+        const lfs2_block_t pair[2]) {
+    struct lfs2_mentry *e = lfs2_mindex_find(lfs2, pair);
+    if (!e) {
+        // replace entries round-robin
+        e = &lfs2->mindex.entries[lfs2->mindex.hand];
+        lfs2->mindex.hand = (lfs2->mindex.hand + 1) % lfs2->mindex.count;
+        memset(e, 0xff, sizeof(struct lfs2_mentry));
+    }
+
+    e->pair[0] = pair[0];
+    e->pair[1] = pair[1];
+    return e;
+}
+
+static void lfs2_mindex_setpred(lfs2_t *lfs2,
+        const lfs2_block_t pair[2], const lfs2_block_t pred[2]) {
+    if (!lfs2->mindex.count || lfs2_pair_isnull(pair)) {
+        return;
+    }
+
+    struct lfs2_mentry *e = lfs2_mindex_get(lfs2, pair);
+    e->pred[0] = pred[0];
+    e->pred[1] = pred[1];
+}
+
+static void lfs2_mindex_setparent(lfs2_t *lfs2,
+        const lfs2_block_t pair[2], const lfs2_block_t parent[2]) {
+    if (!lfs2->mindex.count) {
+        return;
+    }
+
+    struct lfs2_mentry *e = lfs2_mindex_get(lfs2, pair);
+    e->parent[0] = parent[0];
+    e->parent[1] = parent[1];
+}
+
+static void lfs2_mindex_relocate(lfs2_t *lfs2,
+        const lfs2_block_t oldpair[2], const lfs2_block_t newpair[2]) {
+    for (lfs2_size_t i = 0; i < lfs2->mindex.count; i++) {
+        struct lfs2_mentry *e = &lfs2->mindex.entries[i];
+        lfs2_block_t *pairs[3] = {e->pair, e->pred, e->parent};
+        for (int j = 0; j < 3; j++) {
+            if (!lfs2_pair_isnull(pairs[j]) &&
+                    lfs2_pair_cmp(pairs[j], oldpair) == 0) {
+                pairs[j][0] = newpair[0];
+                pairs[j][1] = newpair[1];
+            }
+        }
+    }
+}
+
+static int lfs2_mindex_pred(lfs2_t *lfs2,
+        const lfs2_block_t pair[2], lfs2_mdir_t *pdir) {
+    // only a hint, check that the predecessor still points to us
+    const struct lfs2_mentry *e = lfs2_mindex_find(lfs2, pair);
+    if (!e || lfs2_pair_isnull(e->pred)) {
+        return LFS2_ERR_NOENT;
+    }
+
+    int err = lfs2_dir_fetch(lfs2, pdir, e->pred);
+    if (err && err != LFS2_ERR_CORRUPT) {
+        return err;
+    }
+
+    if (err || lfs2_pair_cmp(pdir->tail, pair) != 0) {
+        return LFS2_ERR_NOENT;
+    }
+
+    return 0;
+}
+
 struct lfs2_dir_find_match {
     lfs2_t *lfs2;
     const void *name;
@@ -1065,6 +1592,48 @@ static int lfs2_dir_find_match(void *data,
     return LFS2_CMP_EQ;
 }
 
+// skip slashes, '.', and any names undone by a later '..', leaving the next
+// name that needs to be looked up
+static const char *lfs2_path_next(const char *name) {
+nextname:
+    // skip slashes
+    name += strspn(name, "/");
+    lfs2_size_t namelen = strcspn(name, "/");
+
+    // skip '.' and root '..'
+    if ((namelen == 1 && memcmp(name, ".", 1) == 0) ||
+        (namelen == 2 && memcmp(name, "..", 2) == 0)) {
+        name += namelen;
+        goto nextname;
+    }
+
+    // skip if matched by '..' in name
+    const char *suffix = name + namelen;
+    lfs2_size_t sufflen;
+    int depth = 1;
+    while (true) {
+        suffix += strspn(suffix, "/");
+        sufflen = strcspn(suffix, "/");
+        if (sufflen == 0) {
+            break;
+        }
+
+        if (sufflen == 2 && memcmp(suffix, "..", 2) == 0) {
+            depth -= 1;
+            if (depth == 0) {
+                name = suffix + sufflen;
+                goto nextname;
+            }
+        } else {
+            depth += 1;
+        }
+
+        suffix += sufflen;
+    }
+
+    return name;
+}
+
 static int lfs2_dir_find(lfs2_t *lfs2, lfs2_mdir_t *dir,
         const char **path, uint16_t *id) {
     // we reduce path to a single name if we can find it
@@ -1078,50 +1647,22 @@ static int lfs2_dir_find(lfs2_t *lfs2, lfs2_mdir_t *dir,
     dir->tail[0] = lfs2->root[0];
     dir->tail[1] = lfs2->root[1];
 
+    // directory we looked up last, so we can add it to the path cache
+    lfs2_block_t parent[2] = {0xffffffff, 0xffffffff};
+    const char *parentname = NULL;
+    lfs2_size_t parentlen = 0;
+
     while (true) {
-nextname:
-        // skip slashes
-        name += strspn(name, "/");
+        name = lfs2_path_next(name);
         lfs2_size_t namelen = strcspn(name, "/");
 
-        // skip '.' and root '..'
-        if ((namelen == 1 && memcmp(name, ".", 1) == 0) ||
-            (namelen == 2 && memcmp(name, "..", 2) == 0)) {
-            name += namelen;
-            goto nextname;
+        // found path
+        if (name[0] == '\0') {
+            return tag;
         }
 
-        // skip if matched by '..' in name
-        const char *suffix = name + namelen;
-        lfs2_size_t sufflen;
-        int depth = 1;
-        while (true) {
-            suffix += strspn(suffix, "/");
-            sufflen = strcspn(suffix, "/");
-            if (sufflen == 0) {
-                break;
-            }
-
-            if (sufflen == 2 && memcmp(suffix, "..", 2) == 0) {
-                depth -= 1;
-                if (depth == 0) {
-                    name = suffix + sufflen;
-                    goto nextname;
-                }
-            } else {
-                depth += 1;
-            }
-
-            suffix += sufflen;
-        }
-
-        // found path
-        if (name[0] == '\0') {
-            return tag;
-        }
-
-        // update what we've found so far
-        *path = name;
+        // update what we've found so far
+        *path = name;
 
         // only continue if we hit a directory
         if (lfs2_tag_type3(tag) != LFS2_TYPE_DIR) {
@@ -1136,6 +1677,32 @@ nextname:
                 return res;
             }
             lfs2_pair_fromle32(dir->tail);
+
+            if (parentname) {
+                lfs2_dcache_insert(lfs2, parent, parentname, parentlen,
+                        dir->tail);
+                parentname = NULL;
+            }
+        }
+
+        // is this a directory we've found before? only usable if we
+        // don't need the entry itself
+        if (lfs2->dcache.count && namelen <= LFS2_DCACHE_NAME_MAX &&
+                lfs2_path_next(name + namelen)[0] != '\0') {
+            const struct lfs2_dentry *d = lfs2_dcache_find(lfs2,
+                    dir->tail, name, namelen);
+            if (d) {
+                dir->tail[0] = d->pair[0];
+                dir->tail[1] = d->pair[1];
+                tag = LFS2_MKTAG(LFS2_TYPE_DIR, 0x3ff, 0);
+                name += namelen;
+                continue;
+            }
+
+            parent[0] = dir->tail[0];
+            parent[1] = dir->tail[1];
+            parentname = name;
+            parentlen = namelen;
         }
 
         // find entry matching name
@@ -1239,7 +1806,7 @@ static int lfs2_dir_commitattr(lfs2_t *lfs2, struct lfs2_commit *commit,
 static int lfs2_dir_commitcrc(lfs2_t *lfs2, struct lfs2_commit *commit) {
     // align to program units
     lfs2_off_t off = lfs2_alignup(commit->off + 2*sizeof(uint32_t),
-            lfs2->cfg->prog_size);
+            lfs2_prog_size(lfs2));
 
     // read erased state from next program unit
     lfs2_tag_t tag;
@@ -1275,22 +1842,16 @@ static int lfs2_dir_commitcrc(lfs2_t *lfs2, struct lfs2_commit *commit) {
         return err;
     }
 
+    if (lfs2->cfg->validate == LFS2_VALIDATE_NONE) {
+        return 0;
+    }
+
     // successful commit, check checksum to make sure
     uint32_t crc = 0xffffffff;
     lfs2_size_t size = commit->off - lfs2_tag_size(tag) - commit->begin;
-    for (lfs2_off_t i = 0; i < size; i++) {
-        // leave it up to caching to make this efficient
-        uint8_t dat;
-        err = lfs2_bd_read(lfs2,
-                NULL, &lfs2->rcache, size-i,
-                commit->block, commit->begin+i, &dat, 1);
-        if (err) {
-            return err;
-        }
-
-        crc = lfs2_crc(crc, &dat, 1);
-    }
-
+    err = lfs2_bd_crc(lfs2,
+            NULL, &lfs2->rcache, size,
+            commit->block, commit->begin, size, &crc);
     if (err) {
         return err;
     }
@@ -1303,17 +1864,26 @@ static int lfs2_dir_commitcrc(lfs2_t *lfs2, struct lfs2_commit *commit) {
 }
 
 static int lfs2_dir_alloc(lfs2_t *lfs2, lfs2_mdir_t *dir) {
-    // allocate pair of dir blocks (backwards, so we write block 1 first)
-    for (int i = 0; i < 2; i++) {
-        int err = lfs2_alloc(lfs2, &dir->pair[(i+1)%2]);
+    // allocate pair of dir blocks (backwards, so we write block 1 first),
+    // the first compaction can skip erasing block 1 if it's already erased
+    lfs2->epool.erased = 0xffffffff;
+    if (lfs2_alloc_erased(lfs2, &dir->pair[1])) {
+        lfs2->epool.erased = dir->pair[1];
+    } else {
+        int err = lfs2_alloc(lfs2, &dir->pair[1]);
         if (err) {
             return err;
         }
     }
 
+    int err = lfs2_alloc(lfs2, &dir->pair[0]);
+    if (err) {
+        return err;
+    }
+
     // rather than clobbering one of the blocks we just pretend
     // the revision may be valid
-    int err = lfs2_bd_read(lfs2,
+    err = lfs2_bd_read(lfs2,
             NULL, &lfs2->rcache, sizeof(dir->rev),
             dir->pair[0], 0, &dir->rev, sizeof(dir->rev));
     if (err) {
@@ -1325,6 +1895,14 @@ static int lfs2_dir_alloc(lfs2_t *lfs2, lfs2_mdir_t *dir) {
         return err;
     }
 
+    // erased blocks often read as revision 0xffffffff, make sure our first
+    // compaction doesn't land on a block_cycles boundary and evict the
+    // pair we just allocated
+    if (lfs2->cfg->block_cycles &&
+            (dir->rev + 1) % lfs2->cfg->block_cycles == 0) {
+        dir->rev += 1;
+    }
+
     // set defaults
     dir->off = sizeof(dir->rev);
     dir->etag = 0xffffffff;
@@ -1338,6 +1916,15 @@ static int lfs2_dir_alloc(lfs2_t *lfs2, lfs2_mdir_t *dir) {
     return 0;
 }
 
+static void lfs2_dir_forgetcursors(lfs2_t *lfs2, const lfs2_block_t pair[2]) {
+    for (struct lfs2_mlist *d = lfs2->mlist; d; d = d->next) {
+        if (d->type == LFS2_TYPE_DIR &&
+                lfs2_pair_cmp(((lfs2_dir_t*)d)->cursor.pair, pair) == 0) {
+            ((lfs2_dir_t*)d)->cursor.pos = 0;
+        }
+    }
+}
+
 static int lfs2_dir_drop(lfs2_t *lfs2, lfs2_mdir_t *dir, lfs2_mdir_t *tail) {
     // steal state
     int err = lfs2_dir_getgstate(lfs2, tail, &lfs2->gdelta);
@@ -1354,6 +1941,22 @@ static int lfs2_dir_drop(lfs2_t *lfs2, lfs2_mdir_t *dir, lfs2_mdir_t *tail) {
         return err;
     }
 
+    // dropped pair is no longer in the tree
+    lfs2_dir_forgetcursors(lfs2, tail->pair);
+
+    lfs2_mindex_setpred(lfs2, tail->tail, dir->pair);
+    struct lfs2_mentry *e = lfs2_mindex_find(lfs2, tail->pair);
+    if (e) {
+        memset(e, 0xff, sizeof(struct lfs2_mentry));
+    }
+
+    if (!lfs2_alloc_isopen(lfs2, NULL, tail->pair, 0x3ff)) {
+        lfs2_alloc_free(lfs2, tail->pair[0]);
+        lfs2_alloc_free(lfs2, tail->pair[1]);
+    } else {
+        lfs2_alloc_drop(lfs2);
+    }
+
     return 0;
 }
 
@@ -1379,6 +1982,8 @@ static int lfs2_dir_split(lfs2_t *lfs2,
     dir->tail[0] = tail.pair[0];
     dir->tail[1] = tail.pair[1];
     dir->split = true;
+    lfs2_mindex_setpred(lfs2, tail.pair, dir->pair);
+    lfs2_mindex_setpred(lfs2, tail.tail, tail.pair);
 
     // update root if needed
     if (lfs2_pair_cmp(dir->pair, lfs2->root) == 0 && split == 0) {
@@ -1414,6 +2019,10 @@ static int lfs2_dir_compact(lfs2_t *lfs2,
     const lfs2_block_t oldpair[2] = {dir->pair[1], dir->pair[0]};
     bool relocated = false;
     bool exhausted = false;
+    lfs2->stats.compact_count += 1;
+
+    // compaction may move ids or the pair itself, forget any dir cursor
+    lfs2_dir_forgetcursors(lfs2, dir->pair);
 
     while (true) {
         // find size
@@ -1431,8 +2040,8 @@ static int lfs2_dir_compact(lfs2_t *lfs2,
         // space is complicated, we need room for tail, crc, gstate,
         // cleanup delete, and we cap at half a block to give room
         // for metadata updates
-        if (size <= lfs2_min(lfs2->cfg->block_size - 36,
-                lfs2_alignup(lfs2->cfg->block_size/2, lfs2->cfg->prog_size))) {
+        if (size <= lfs2_min(lfs2_block_size(lfs2) - 36,
+                lfs2_alignup(lfs2_block_size(lfs2)/2, lfs2_prog_size(lfs2)))) {
             break;
         }
 
@@ -1446,7 +2055,7 @@ static int lfs2_dir_compact(lfs2_t *lfs2,
             // if we fail to split, we may be able to overcompact, unless
             // we're too big for even the full block, in which case our
             // only option is to error
-            if (err == LFS2_ERR_NOSPC && size <= lfs2->cfg->block_size - 36) {
+            if (err == LFS2_ERR_NOSPC && size <= lfs2_block_size(lfs2) - 36) {
                 break;
             }
             return err;
@@ -1468,7 +2077,7 @@ static int lfs2_dir_compact(lfs2_t *lfs2,
 
             // do we have extra space? littlefs can't reclaim this space
             // by itself, so expand cautiously
-            if ((lfs2_size_t)res < lfs2->cfg->block_count/2) {
+            if ((lfs2_size_t)res < lfs2_block_count(lfs2)/2) {
                 LFS2_DEBUG("Expanding superblock at rev %"PRIu32, dir->rev);
                 int err = lfs2_dir_split(lfs2, dir, attrs, attrcount,
                         source, begin, end);
@@ -1507,17 +2116,20 @@ static int lfs2_dir_compact(lfs2_t *lfs2,
                 .crc = 0xffffffff,
 
                 .begin = 0,
-                .end = lfs2->cfg->block_size - 8,
+                .end = lfs2_block_size(lfs2) - 8,
             };
 
-            // erase block to write to
-            err = lfs2_bd_erase(lfs2, dir->pair[1]);
-            if (err) {
-                if (err == LFS2_ERR_CORRUPT) {
-                    goto relocate;
+            // erase block to write to, unless we know it's erased
+            if (dir->pair[1] != lfs2->epool.erased) {
+                err = lfs2_bd_erase(lfs2, dir->pair[1]);
+                if (err) {
+                    if (err == LFS2_ERR_CORRUPT) {
+                        goto relocate;
+                    }
+                    return err;
                 }
-                return err;
             }
+            lfs2->epool.erased = 0xffffffff;
 
             // write out header
             dir->rev = lfs2_tole32(dir->rev);
@@ -1603,7 +2215,9 @@ static int lfs2_dir_compact(lfs2_t *lfs2,
 relocate:
         // commit was corrupted, drop caches and prepare to relocate block
         relocated = true;
+        lfs2->stats.relocate_count += 1;
         lfs2_cache_drop(lfs2, &lfs2->pcache);
+        lfs2_alloc_drop(lfs2);
         if (!exhausted) {
             LFS2_DEBUG("Bad block at %"PRIu32, dir->pair[1]);
         }
@@ -1646,7 +2260,7 @@ static int lfs2_dir_commit(lfs2_t *lfs2, lfs2_mdir_t *dir,
     for (lfs2_file_t *f = (lfs2_file_t*)lfs2->mlist; f; f = f->next) {
         if (dir != &f->m && lfs2_pair_cmp(f->m.pair, dir->pair) == 0 &&
                 f->type == LFS2_TYPE_REG && (f->flags & LFS2_F_INLINE) &&
-                f->ctz.size > lfs2->cfg->cache_size) {
+                f->ctz.size > lfs2_cache_size(lfs2)) {
             f->flags &= ~LFS2_F_READING;
             f->off = 0;
 
@@ -1666,8 +2280,11 @@ static int lfs2_dir_commit(lfs2_t *lfs2, lfs2_mdir_t *dir,
     // calculate changes to the directory
     lfs2_tag_t deletetag = 0xffffffff;
     lfs2_tag_t createtag = 0xffffffff;
+    bool redirected = false;
     for (int i = 0; i < attrcount; i++) {
-        if (lfs2_tag_type3(attrs[i].tag) == LFS2_TYPE_CREATE) {
+        if (lfs2_tag_type3(attrs[i].tag) == LFS2_TYPE_DIRSTRUCT) {
+            redirected = true;
+        } else if (lfs2_tag_type3(attrs[i].tag) == LFS2_TYPE_CREATE) {
             createtag = attrs[i].tag;
             dir->count += 1;
         } else if (lfs2_tag_type3(attrs[i].tag) == LFS2_TYPE_DELETE) {
@@ -1692,6 +2309,13 @@ static int lfs2_dir_commit(lfs2_t *lfs2, lfs2_mdir_t *dir,
         lfs2_gstate_xormove(&lfs2->gdelta, &lfs2->gpending, 0x3ff, NULL);
     }
 
+    // removed entries and existing directories that now live somewhere
+    // else may still be in the path cache
+    if (lfs2_tag_isvalid(deletetag) ||
+            (redirected && !lfs2_tag_isvalid(createtag))) {
+        lfs2_dcache_drop(lfs2);
+    }
+
     // should we actually drop the directory block?
     if (lfs2_tag_isvalid(deletetag) && dir->count == 0) {
         lfs2_mdir_t pdir;
@@ -1714,7 +2338,7 @@ static int lfs2_dir_commit(lfs2_t *lfs2, lfs2_mdir_t *dir,
             .crc = 0xffffffff,
 
             .begin = dir->off,
-            .end = lfs2->cfg->block_size - 8,
+            .end = lfs2_block_size(lfs2) - 8,
         };
 
         // traverse attrs that need to be written out
@@ -1792,7 +2416,8 @@ compact:
     // for things that are
     for (struct lfs2_mlist *d = lfs2->mlist; d; d = d->next) {
         if (lfs2_pair_cmp(d->m.pair, copy.pair) == 0) {
-            d->m = *dir;
+            // dir may have already moved on to the tail of a split
+            d->m = copy;
             if (d->id == lfs2_tag_id(deletetag)) {
                 d->m.pair[0] = 0xffffffff;
                 d->m.pair[1] = 0xffffffff;
@@ -1898,6 +2523,9 @@ int lfs2_mkdir(lfs2_t *lfs2, const char *path) {
         return err;
     }
 
+    lfs2_mindex_setpred(lfs2, dir.pair, (cwd.split) ? pred.pair : cwd.pair);
+    lfs2_mindex_setpred(lfs2, dir.tail, dir.pair);
+    lfs2_mindex_setparent(lfs2, dir.pair, cwd.pair);
     return 0;
 }
 
@@ -1937,6 +2565,7 @@ int lfs2_dir_open(lfs2_t *lfs2, lfs2_dir_t *dir, const char *path) {
     dir->head[1] = dir->m.pair[1];
     dir->id = 0;
     dir->pos = 0;
+    dir->cursor.pos = 0;
 
     // add to list of mdirs
     dir->type = LFS2_TYPE_DIR;
@@ -2003,7 +2632,211 @@ int lfs2_dir_read(lfs2_t *lfs2, lfs2_dir_t *dir, struct lfs2_info *info) {
     return true;
 }
 
+static int lfs2_dir_getinfos(lfs2_t *lfs2, const lfs2_mdir_t *dir,
+        uint16_t id, uint16_t count, struct lfs2_info *infos,
+        const struct lfs2_attr *attrs, lfs2_size_t attr_count) {
+    // this is lfs2_dir_getslice for many ids at once, we track the id each
+    // entry had at the current point in the log and what we still need,
+    // bit 0 is the name, bit 1 the struct, and the rest are user attrs
+    uint16_t hids[LFS2_READPLUS_MAX];
+    uint32_t needs[LFS2_READPLUS_MAX];
+    bool hasmove = lfs2_gstate_hasmovehere(&lfs2->gstate, dir->pair);
+    uint16_t moveid = lfs2_tag_id(lfs2->gstate.tag);
+
+    for (uint16_t i = 0; i < count; i++) {
+        // synthetic moves
+        hids[i] = id+i + (hasmove && id+i <= moveid);
+        needs[i] = 0xffffffff >> (32 - (2+attr_count));
+        memset(&infos[i], 0, sizeof(infos[i]));
+        for (lfs2_size_t j = 0; j < attr_count; j++) {
+            memset(attrs[i*attr_count+j].buffer, 0,
+                    attrs[i*attr_count+j].size);
+        }
+    }
+
+    // iterate over dir block backwards, once for all ids
+    lfs2_off_t off = dir->off;
+    lfs2_tag_t ntag = dir->etag;
+    bool busy = (count > 0);
+    while (busy && off >= sizeof(lfs2_tag_t) + lfs2_tag_dsize(ntag)) {
+        off -= lfs2_tag_dsize(ntag);
+        lfs2_tag_t tag = ntag;
+        int err = lfs2_bd_read(lfs2,
+                NULL, &lfs2->rcache, sizeof(ntag),
+                dir->pair[0], off, &ntag, sizeof(ntag));
+        if (err) {
+            return err;
+        }
+
+        ntag = (lfs2_frombe32(ntag) ^ tag) & 0x7fffffff;
+
+        busy = false;
+        for (uint16_t i = 0; i < count; i++) {
+            if (!needs[i]) {
+                continue;
+            }
+
+            if (lfs2_tag_type1(tag) == LFS2_TYPE_SPLICE &&
+                    lfs2_tag_id(tag) <= hids[i]) {
+                if (tag == LFS2_MKTAG(LFS2_TYPE_CREATE, hids[i], 0)) {
+                    // found where we were created
+                    needs[i] = 0;
+                    continue;
+                }
+
+                // move around splices
+                hids[i] -= lfs2_tag_splice(tag);
+                busy = true;
+                continue;
+            }
+
+            busy = true;
+            if (lfs2_tag_id(tag) != hids[i]) {
+                continue;
+            }
+
+            for (lfs2_size_t j = 0; j < 2+attr_count; j++) {
+                void *buffer;
+                lfs2_size_t size;
+                struct lfs2_ctz ctz;
+                if (j == 0) {
+                    if ((lfs2_tag_type3(tag) & 0x780) != LFS2_TYPE_NAME) {
+                        continue;
+                    }
+                    buffer = infos[i].name;
+                    size = lfs2->name_max+1;
+                } else if (j == 1) {
+                    if (lfs2_tag_type1(tag) != LFS2_TYPE_STRUCT) {
+                        continue;
+                    }
+                    buffer = &ctz;
+                    size = sizeof(ctz);
+                } else {
+                    const struct lfs2_attr *a = &attrs[i*attr_count+j-2];
+                    if (lfs2_tag_type3(tag) != LFS2_TYPE_USERATTR + a->type) {
+                        continue;
+                    }
+                    buffer = a->buffer;
+                    size = a->size;
+                }
+
+                if (!(needs[i] & ((uint32_t)1 << j))) {
+                    continue;
+                }
+                needs[i] &= ~((uint32_t)1 << j);
+
+                if (lfs2_tag_isdelete(tag)) {
+                    continue;
+                }
+
+                lfs2_size_t diff = lfs2_min(lfs2_tag_size(tag), size);
+                err = lfs2_bd_read(lfs2,
+                        NULL, &lfs2->rcache, diff,
+                        dir->pair[0], off+sizeof(tag), buffer, diff);
+                if (err) {
+                    return err;
+                }
+
+                if (j == 0) {
+                    infos[i].type = lfs2_tag_type3(tag);
+                } else if (j == 1) {
+                    lfs2_ctz_fromle32(&ctz);
+                    if (lfs2_tag_type3(tag) == LFS2_TYPE_CTZSTRUCT) {
+                        infos[i].size = ctz.size;
+                    } else if (lfs2_tag_type3(tag) == LFS2_TYPE_INLINESTRUCT) {
+                        infos[i].size = lfs2_tag_size(tag);
+                    }
+                }
+            }
+        }
+    }
+
+    // entries without a name or struct don't exist, stop at the first one
+    for (uint16_t i = 0; i < count; i++) {
+        if (needs[i] & 0x3) {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+lfs2_ssize_t lfs2_dir_readplus(lfs2_t *lfs2, lfs2_dir_t *dir,
+        struct lfs2_info *infos, lfs2_size_t count,
+        const struct lfs2_attr *attrs, lfs2_size_t attr_count) {
+    LFS2_ASSERT(attr_count <= 30);
+    lfs2_size_t n = 0;
+
+    // special offsets for '.' and '..'
+    while (n < count && dir->pos < 2) {
+        memset(&infos[n], 0, sizeof(infos[n]));
+        infos[n].type = LFS2_TYPE_DIR;
+        strcpy(infos[n].name, (dir->pos == 0) ? "." : "..");
+        for (lfs2_size_t j = 0; j < attr_count; j++) {
+            memset(attrs[n*attr_count+j].buffer, 0,
+                    attrs[n*attr_count+j].size);
+        }
+        dir->pos += 1;
+        n += 1;
+    }
+
+    while (n < count) {
+        if (dir->id == dir->m.count) {
+            if (!dir->m.split) {
+                break;
+            }
+
+            int err = lfs2_dir_fetch(lfs2, &dir->m, dir->m.tail);
+            if (err) {
+                return err;
+            }
+
+            dir->id = 0;
+            continue;
+        }
+
+        uint16_t chunk = lfs2_min(lfs2_min(count - n,
+                dir->m.count - dir->id), LFS2_READPLUS_MAX);
+        int res = lfs2_dir_getinfos(lfs2, &dir->m, dir->id, chunk,
+                &infos[n], (attr_count) ? &attrs[n*attr_count] : NULL,
+                attr_count);
+        if (res < 0) {
+            return res;
+        }
+
+        dir->id += res;
+        dir->pos += res;
+        n += res;
+        if (res < chunk) {
+            // skip ids without an entry, same as read
+            dir->id += 1;
+        }
+    }
+
+    return n;
+}
+
 int lfs2_dir_seek(lfs2_t *lfs2, lfs2_dir_t *dir, lfs2_off_t off) {
+    // seeking to our last tell? jump straight to its pair, compacting or
+    // dropping the pair forgets the cursor, and any commit since the tell
+    // changes the pair's revision, commit offset or tag
+    struct lfs2_dcursor *c = &dir->cursor;
+    if (off >= 2 && off == c->pos) {
+        lfs2_mdir_t m;
+        int err = lfs2_dir_fetch(lfs2, &m, c->pair);
+        if (err && err != LFS2_ERR_CORRUPT) {
+            return err;
+        }
+
+        if (!err && m.rev == c->rev && m.off == c->off &&
+                m.etag == c->etag && c->id <= m.count) {
+            dir->m = m;
+            dir->id = c->id;
+            dir->pos = c->pos;
+            return 0;
+        }
+    }
+
     // simply walk from head dir
     int err = lfs2_dir_rewind(lfs2, dir);
     if (err) {
@@ -2028,6 +2861,8 @@ int lfs2_dir_seek(lfs2_t *lfs2, lfs2_dir_t *dir, lfs2_off_t off) {
             if (err) {
                 return err;
             }
+
+            dir->id = 0;
         }
     }
 
@@ -2036,6 +2871,15 @@ int lfs2_dir_seek(lfs2_t *lfs2, lfs2_dir_t *dir, lfs2_off_t off) {
 
 lfs2_soff_t lfs2_dir_tell(lfs2_t *lfs2, lfs2_dir_t *dir) {
     (void)lfs2;
+    // remember where this offset lives for a later seek
+    struct lfs2_dcursor *c = &dir->cursor;
+    c->pair[0] = dir->m.pair[0];
+    c->pair[1] = dir->m.pair[1];
+    c->rev = dir->m.rev;
+    c->off = dir->m.off;
+    c->etag = dir->m.etag;
+    c->pos = dir->pos;
+    c->id = dir->id;
     return dir->pos;
 }
 
@@ -2057,7 +2901,7 @@ int lfs2_dir_rewind(lfs2_t *lfs2, lfs2_dir_t *dir) {
 /// File index list operations ///
 static int lfs2_ctz_index(lfs2_t *lfs2, lfs2_off_t *off) {
     lfs2_off_t size = *off;
-    lfs2_off_t b = lfs2->cfg->block_size - 2*4;
+    lfs2_off_t b = lfs2_block_size(lfs2) - 2*4;
     lfs2_off_t i = size / b;
     if (i == 0) {
         return 0;
@@ -2068,18 +2912,34 @@ static int lfs2_ctz_index(lfs2_t *lfs2, lfs2_off_t *off) {
     return i;
 }
 
-static int lfs2_ctz_find(lfs2_t *lfs2,
+static int lfs2_ctz_findindex(lfs2_t *lfs2,
         const lfs2_cache_t *pcache, lfs2_cache_t *rcache,
+        struct lfs2_ctzindex *index,
         lfs2_block_t head, lfs2_size_t size,
-        lfs2_size_t pos, lfs2_block_t *block, lfs2_off_t *off) {
-    if (size == 0) {
-        *block = 0xffffffff;
-        *off = 0;
-        return 0;
-    }
-
+        lfs2_off_t target, lfs2_block_t *block) {
     lfs2_off_t current = lfs2_ctz_index(lfs2, &(lfs2_off_t){size-1});
-    lfs2_off_t target = lfs2_ctz_index(lfs2, &pos);
+
+    if (index && index->count > 0) {
+        // index tracks every stride blocks, stride is a power of two so
+        // that walks from an indexed block can take large skips
+        lfs2_off_t stride = 1U << lfs2_npw2(current/index->count + 1);
+        if (index->head != head || index->stride != stride) {
+            // different skip-list, old index is useless
+            memset(index->blocks, 0xff, 4*index->count);
+            index->head = head;
+            index->stride = stride;
+        }
+
+        // start from the nearest indexed block at or after our target
+        for (lfs2_off_t i = (target + stride-1) / stride;
+                i*stride < current; i++) {
+            if (index->blocks[i] != 0xffffffff) {
+                current = i*stride;
+                head = index->blocks[i];
+                break;
+            }
+        }
+    }
 
     while (current > target) {
         lfs2_size_t skip = lfs2_min(
@@ -2094,36 +2954,81 @@ static int lfs2_ctz_find(lfs2_t *lfs2,
             return err;
         }
 
-        LFS2_ASSERT(head >= 2 && head <= lfs2->cfg->block_count);
+        LFS2_ASSERT(head >= 2 && head <= lfs2_block_count(lfs2));
         current -= 1 << skip;
+
+        // remember any blocks we pass that land on our index
+        if (index && index->count > 0 && current % index->stride == 0) {
+            index->blocks[current / index->stride] = head;
+        }
     }
 
     *block = head;
+    return 0;
+}
+
+static int lfs2_ctz_find(lfs2_t *lfs2,
+        const lfs2_cache_t *pcache, lfs2_cache_t *rcache,
+        struct lfs2_ctzindex *index,
+        lfs2_block_t head, lfs2_size_t size,
+        lfs2_size_t pos, lfs2_block_t *block, lfs2_off_t *off) {
+    if (size == 0) {
+        *block = 0xffffffff;
+        *off = 0;
+        return 0;
+    }
+
+    lfs2_off_t target = lfs2_ctz_index(lfs2, &pos);
+    int err = lfs2_ctz_findindex(lfs2, pcache, rcache, index,
+            head, size, target, block);
+    if (err) {
+        return err;
+    }
+
     *off = pos;
     return 0;
 }
 
+static int lfs2_reserve_alloc(lfs2_t *lfs2, struct lfs2_reserve *reserve,
+        lfs2_block_t *block) {
+    if (reserve && reserve->count > 0) {
+        // reserved blocks are already erased
+        *block = reserve->blocks[reserve->off];
+        reserve->off += 1;
+        reserve->count -= 1;
+        return 0;
+    }
+
+    if (lfs2_alloc_erased(lfs2, block)) {
+        return 0;
+    }
+
+    int err = lfs2_alloc(lfs2, block);
+    if (err) {
+        return err;
+    }
+
+    return lfs2_bd_erase(lfs2, *block);
+}
+
 static int lfs2_ctz_extend(lfs2_t *lfs2,
         lfs2_cache_t *pcache, lfs2_cache_t *rcache,
+        struct lfs2_reserve *reserve,
         lfs2_block_t head, lfs2_size_t size,
         lfs2_block_t *block, lfs2_off_t *off) {
     while (true) {
         // go ahead and grab a block
         lfs2_block_t nblock;
-        int err = lfs2_alloc(lfs2, &nblock);
+        int err = lfs2_reserve_alloc(lfs2, reserve, &nblock);
         if (err) {
+            if (err == LFS2_ERR_CORRUPT) {
+                goto relocate;
+            }
             return err;
         }
-        LFS2_ASSERT(nblock >= 2 && nblock <= lfs2->cfg->block_count);
+        LFS2_ASSERT(nblock >= 2 && nblock <= lfs2_block_count(lfs2));
 
         if (true) {
-            err = lfs2_bd_erase(lfs2, nblock);
-            if (err) {
-                if (err == LFS2_ERR_CORRUPT) {
-                    goto relocate;
-                }
-                return err;
-            }
 
             if (size == 0) {
                 *block = nblock;
@@ -2136,7 +3041,7 @@ static int lfs2_ctz_extend(lfs2_t *lfs2,
             size += 1;
 
             // just copy out the last block if it is incomplete
-            if (size != lfs2->cfg->block_size) {
+            if (size != lfs2_block_size(lfs2)) {
                 for (lfs2_off_t i = 0; i < size; i++) {
                     uint8_t data;
                     err = lfs2_bd_read(lfs2,
@@ -2188,7 +3093,7 @@ static int lfs2_ctz_extend(lfs2_t *lfs2,
                     }
                 }
 
-                LFS2_ASSERT(head >= 2 && head <= lfs2->cfg->block_count);
+                LFS2_ASSERT(head >= 2 && head <= lfs2_block_count(lfs2));
             }
 
             *block = nblock;
@@ -2198,6 +3103,8 @@ static int lfs2_ctz_extend(lfs2_t *lfs2,
 
 relocate:
         LFS2_DEBUG("Bad block at %"PRIu32, nblock);
+        lfs2->stats.relocate_count += 1;
+        lfs2_alloc_drop(lfs2);
 
         // just clear cache and try a new block
         lfs2_cache_drop(lfs2, pcache);
@@ -2248,6 +3155,71 @@ static int lfs2_ctz_traverse(lfs2_t *lfs2,
 }
 
 
+static int lfs2_ctz_free(lfs2_t *lfs2,
+        lfs2_block_t head, lfs2_size_t size,
+        lfs2_block_t nhead, lfs2_size_t nsize) {
+    if (size == 0) {
+        return 0;
+    }
+
+    // free any blocks in the old skip-list that aren't shared with the new
+    // skip-list, since blocks are immutable once both lists reach the same
+    // block at the same index everything below is shared
+    lfs2_off_t index = lfs2_ctz_index(lfs2, &(lfs2_off_t){size-1});
+    lfs2_off_t nindex = 0;
+    if (nsize > 0) {
+        nindex = lfs2_ctz_index(lfs2, &(lfs2_off_t){nsize-1});
+
+        while (nindex > index) {
+            lfs2_size_t skip = lfs2_min(
+                    lfs2_npw2(nindex-index+1) - 1,
+                    lfs2_ctz(nindex));
+
+            int err = lfs2_bd_read(lfs2,
+                    NULL, &lfs2->rcache, sizeof(nhead),
+                    nhead, 4*skip, &nhead, sizeof(nhead));
+            nhead = lfs2_fromle32(nhead);
+            if (err) {
+                return err;
+            }
+
+            nindex -= 1 << skip;
+        }
+    }
+
+    while (true) {
+        if (nsize > 0 && nindex == index && nhead == head) {
+            return 0;
+        }
+
+        lfs2_alloc_free(lfs2, head);
+        if (index == 0) {
+            return 0;
+        }
+
+        int err = lfs2_bd_read(lfs2,
+                NULL, &lfs2->rcache, sizeof(head),
+                head, 0, &head, sizeof(head));
+        head = lfs2_fromle32(head);
+        if (err) {
+            return err;
+        }
+        index -= 1;
+
+        if (nsize > 0 && nindex > index) {
+            err = lfs2_bd_read(lfs2,
+                    NULL, &lfs2->rcache, sizeof(nhead),
+                    nhead, 0, &nhead, sizeof(nhead));
+            nhead = lfs2_fromle32(nhead);
+            if (err) {
+                return err;
+            }
+            nindex -= 1;
+        }
+    }
+}
+
+
 /// Top level file operations ///
 int lfs2_file_opencfg(lfs2_t *lfs2, lfs2_file_t *file,
         const char *path, int flags,
@@ -2266,6 +3238,11 @@ int lfs2_file_opencfg(lfs2_t *lfs2, lfs2_file_t *file,
     file->flags = flags;
     file->pos = 0;
     file->cache.buffer = NULL;
+    file->index.blocks = NULL;
+    file->readahead.blocks = NULL;
+    file->reserve.off = 0;
+    file->reserve.count = 0;
+    file->reserve.blocks = NULL;
 
     // allocate entry for file if it doesn't exist
     lfs2_stag_t tag = lfs2_dir_find(lfs2, &file->m, &path, &file->id);
@@ -2348,11 +3325,11 @@ int lfs2_file_opencfg(lfs2_t *lfs2, lfs2_file_t *file,
         }
     }
 
-    // allocate buffer if needed
+    // allocate buffer if needed, shared caches are only taken when used
     if (file->cfg->buffer) {
         file->cache.buffer = file->cfg->buffer;
-    } else {
-        file->cache.buffer = lfs2_malloc(lfs2->cfg->cache_size);
+    } else if (!lfs2->fcache.count) {
+        file->cache.buffer = lfs2_malloc(lfs2_cache_size(lfs2));
         if (!file->cache.buffer) {
             err = LFS2_ERR_NOMEM;
             goto cleanup;
@@ -2360,22 +3337,59 @@ int lfs2_file_opencfg(lfs2_t *lfs2, lfs2_file_t *file,
     }
 
     // zero to avoid information leak
-    lfs2_cache_zero(lfs2, &file->cache);
-
-    if (lfs2_tag_type3(tag) == LFS2_TYPE_INLINESTRUCT) {
-        // load inline files
+    if (file->cache.buffer) {
+        lfs2_cache_zero(lfs2, &file->cache);
+    } else {
+        lfs2_cache_drop(lfs2, &file->cache);
+    }
+
+    // allocate ctz index if requested
+    LFS2_ASSERT(file->cfg->index_size % 4 == 0);
+    file->index.head = 0xffffffff;
+    file->index.stride = 0;
+    file->index.count = file->cfg->index_size / 4;
+    if (file->cfg->index_buffer) {
+        file->index.blocks = file->cfg->index_buffer;
+    } else if (file->index.count > 0) {
+        file->index.blocks = lfs2_malloc(file->cfg->index_size);
+        if (!file->index.blocks) {
+            err = LFS2_ERR_NOMEM;
+            goto cleanup;
+        }
+    }
+
+    // allocate read-ahead window if requested
+    LFS2_ASSERT(file->cfg->readahead_size % 4 == 0);
+    file->readahead.head = 0xffffffff;
+    file->readahead.start = 0;
+    file->readahead.fill = 0;
+    file->readahead.count = file->cfg->readahead_size / 4;
+    if (file->cfg->readahead_buffer) {
+        file->readahead.blocks = file->cfg->readahead_buffer;
+    } else if (file->readahead.count > 0) {
+        file->readahead.blocks = lfs2_malloc(file->cfg->readahead_size);
+        if (!file->readahead.blocks) {
+            err = LFS2_ERR_NOMEM;
+            goto cleanup;
+        }
+    }
+
+    if (lfs2_tag_type3(tag) == LFS2_TYPE_INLINESTRUCT) {
+        // load inline files
         file->ctz.head = 0xfffffffe;
         file->ctz.size = lfs2_tag_size(tag);
         file->flags |= LFS2_F_INLINE;
         file->cache.block = file->ctz.head;
         file->cache.off = 0;
-        file->cache.size = lfs2->cfg->cache_size;
+        file->cache.size = lfs2_cache_size(lfs2);
 
-        // don't always read (may be new/trunc file)
-        if (file->ctz.size > 0) {
+        // don't always read (may be new/trunc file), files without a cache
+        // load this when they take one
+        if (file->ctz.size > 0 && file->cache.buffer) {
             lfs2_stag_t res = lfs2_dir_get(lfs2, &file->m,
                     LFS2_MKTAG(0x700, 0x3ff, 0),
-                    LFS2_MKTAG(LFS2_TYPE_STRUCT, file->id, file->cache.size),
+                    LFS2_MKTAG(LFS2_TYPE_STRUCT, file->id,
+                        lfs2_min(file->cache.size, LFS2_ATTR_MAX)),
                     file->cache.buffer);
             if (res < 0) {
                 err = res;
@@ -2399,8 +3413,19 @@ int lfs2_file_open(lfs2_t *lfs2, lfs2_file_t *file,
     return lfs2_file_opencfg(lfs2, file, path, flags, &defaults);
 }
 
+static void lfs2_file_unreserve(lfs2_t *lfs2, lfs2_file_t *file,
+        lfs2_size_t count) {
+    // give back reserved blocks from the end of the table
+    while (file->reserve.count > count) {
+        file->reserve.count -= 1;
+        lfs2_alloc_free(lfs2,
+                file->reserve.blocks[file->reserve.off+file->reserve.count]);
+    }
+}
+
 int lfs2_file_close(lfs2_t *lfs2, lfs2_file_t *file) {
     int err = lfs2_file_sync(lfs2, file);
+    lfs2_file_unreserve(lfs2, file, 0);
 
     // remove from list of mdirs
     for (struct lfs2_mlist **p = &lfs2->mlist; *p; p = &(*p)->next) {
@@ -2411,23 +3436,46 @@ int lfs2_file_close(lfs2_t *lfs2, lfs2_file_t *file) {
     }
 
     // clean up memory
-    if (!file->cfg->buffer) {
+    if (lfs2_file_isshared(lfs2, file)) {
+        lfs2_file_putcache(lfs2, file);
+    } else if (!file->cfg->buffer) {
         lfs2_free(file->cache.buffer);
     }
 
+    if (!file->cfg->index_buffer && file->index.blocks) {
+        lfs2_free(file->index.blocks);
+    }
+
+    if (!file->cfg->readahead_buffer && file->readahead.blocks) {
+        lfs2_free(file->readahead.blocks);
+    }
+
+    if (!file->cfg->reserve_buffer && file->reserve.blocks) {
+        lfs2_free(file->reserve.blocks);
+    }
+
     return err;
 }
 
+// Forget what we remember about the file's skip-list, its old blocks may
+// be freed and come back in a different skip-list with the same head
+static void lfs2_file_ctzchanged(lfs2_file_t *file) {
+    file->index.head = 0xffffffff;
+    file->readahead.head = 0xffffffff;
+    file->readahead.start = 0;
+    file->readahead.fill = 0;
+}
+
 static int lfs2_file_relocate(lfs2_t *lfs2, lfs2_file_t *file) {
+    if (!(file->flags & LFS2_F_INLINE)) {
+        // we're leaving a bad block behind
+        lfs2_alloc_drop(lfs2);
+    }
+
     while (true) {
         // just relocate what exists into new block
         lfs2_block_t nblock;
-        int err = lfs2_alloc(lfs2, &nblock);
-        if (err) {
-            return err;
-        }
-
-        err = lfs2_bd_erase(lfs2, nblock);
+        int err = lfs2_reserve_alloc(lfs2, &file->reserve, &nblock);
         if (err) {
             if (err == LFS2_ERR_CORRUPT) {
                 goto relocate;
@@ -2469,7 +3517,7 @@ static int lfs2_file_relocate(lfs2_t *lfs2, lfs2_file_t *file) {
         }
 
         // copy over new state of file
-        memcpy(file->cache.buffer, lfs2->pcache.buffer, lfs2->cfg->cache_size);
+        memcpy(file->cache.buffer, lfs2->pcache.buffer, lfs2_cache_size(lfs2));
         file->cache.block = lfs2->pcache.block;
         file->cache.off = lfs2->pcache.off;
         file->cache.size = lfs2->pcache.size;
@@ -2482,6 +3530,8 @@ static int lfs2_file_relocate(lfs2_t *lfs2, lfs2_file_t *file) {
 
 relocate:
         LFS2_DEBUG("Bad block at %"PRIu32, nblock);
+        lfs2->stats.relocate_count += 1;
+        lfs2_alloc_drop(lfs2);
 
         // just clear cache and try a new block
         lfs2_cache_drop(lfs2, &lfs2->pcache);
@@ -2514,6 +3564,7 @@ static int lfs2_file_flush(lfs2_t *lfs2, lfs2_file_t *file) {
                 // copy over a byte at a time, leave it up to caching
                 // to make this efficient
                 uint8_t data;
+                uint32_t loads = lfs2->rlines.loads;
                 lfs2_ssize_t res = lfs2_file_read(lfs2, &orig, &data, 1);
                 if (res < 0) {
                     return res;
@@ -2524,8 +3575,10 @@ static int lfs2_file_flush(lfs2_t *lfs2, lfs2_file_t *file) {
                     return res;
                 }
 
-                // keep our reference to the rcache in sync
-                if (lfs2->rcache.block != 0xffffffff) {
+                // keep our reference to the rcache in sync, validation may
+                // have reloaded and dropped the rcache behind our back
+                if (lfs2->rcache.block != 0xffffffff ||
+                        lfs2->rlines.loads != loads) {
                     lfs2_cache_drop(lfs2, &orig.cache);
                     lfs2_cache_drop(lfs2, &lfs2->rcache);
                 }
@@ -2545,6 +3598,7 @@ static int lfs2_file_flush(lfs2_t *lfs2, lfs2_file_t *file) {
 
 relocate:
                 LFS2_DEBUG("Bad block at %"PRIu32, file->block);
+                lfs2->stats.relocate_count += 1;
                 err = lfs2_file_relocate(lfs2, file);
                 if (err) {
                     return err;
@@ -2555,8 +3609,14 @@ relocate:
         }
 
         // actual file updates
+        if ((file->flags & LFS2_F_DIRTY) && file->ctz.head != 0xfffffffe) {
+            // the old head was never committed, any of its blocks the new
+            // head doesn't share are lost
+            lfs2_alloc_drop(lfs2);
+        }
         file->ctz.head = file->block;
         file->ctz.size = file->pos;
+        lfs2_file_ctzchanged(file);
         file->flags &= ~LFS2_F_WRITING;
         file->flags |= LFS2_F_DIRTY;
 
@@ -2566,7 +3626,128 @@ relocate:
     return 0;
 }
 
+static bool lfs2_file_isshared(lfs2_t *lfs2, const lfs2_file_t *file) {
+    return lfs2->fcache.count && !file->cfg->buffer;
+}
+
+static void lfs2_file_putcache(lfs2_t *lfs2, lfs2_file_t *file) {
+    if (file->cache.buffer) {
+        lfs2_size_t i = (file->cache.buffer - lfs2->fcache.buffer)
+                / lfs2_cache_size(lfs2);
+        lfs2->fcache.free |= 1U << i;
+        file->cache.buffer = NULL;
+        lfs2_cache_drop(lfs2, &file->cache);
+    }
+}
+
+static int lfs2_file_outline(lfs2_t *lfs2, lfs2_file_t *file) {
+    lfs2_off_t pos = file->pos;
+    file->pos = file->ctz.size;
+    file->off = file->ctz.size;
+    lfs2_alloc_ack(lfs2);
+    int err = lfs2_file_relocate(lfs2, file);
+    if (err) {
+        file->pos = pos;
+        return err;
+    }
+
+    err = lfs2_file_flush(lfs2, file);
+    file->pos = pos;
+    if (err) {
+        file->flags |= LFS2_F_ERRED;
+        return err;
+    }
+
+    return 0;
+}
+
+static int lfs2_file_getcache(lfs2_t *lfs2, lfs2_file_t *file) {
+    if (file->cache.buffer) {
+        return 0;
+    }
+
+    if (!lfs2->fcache.free) {
+        // take the cache from the file that has held one the longest, files
+        // take their cache at the front of the mlist so this is the last
+        // file we find
+        lfs2_file_t *victim = NULL;
+        for (struct lfs2_mlist *m = lfs2->mlist; m; m = m->next) {
+            lfs2_file_t *f = (lfs2_file_t*)m;
+            if (m->type == LFS2_TYPE_REG && f != file && f->cache.buffer &&
+                    lfs2_file_isshared(lfs2, f)) {
+                victim = f;
+            }
+        }
+
+        if (!victim) {
+            return LFS2_ERR_NOMEM;
+        }
+
+        // write out anything pending, leaves the file dirty until synced
+        int err = lfs2_file_flush(lfs2, victim);
+        if (err) {
+            return err;
+        }
+
+        if ((victim->flags & LFS2_F_INLINE) &&
+                (victim->flags & LFS2_F_DIRTY) && victim->ctz.size > 0) {
+            // dirty inline data only lives in the cache, move it out to
+            // a block so it doesn't need to be committed early
+            err = lfs2_file_outline(lfs2, victim);
+            if (err) {
+                return err;
+            }
+        }
+
+        lfs2_file_putcache(lfs2, victim);
+    }
+
+    lfs2_size_t i = lfs2_ctz(lfs2->fcache.free);
+    lfs2->fcache.free &= ~(1U << i);
+    file->cache.buffer = &lfs2->fcache.buffer[i*lfs2_cache_size(lfs2)];
+    lfs2_cache_zero(lfs2, &file->cache);
+
+    // move to the front of the mlist
+    for (struct lfs2_mlist **p = &lfs2->mlist; *p; p = &(*p)->next) {
+        if (*p == (struct lfs2_mlist*)file) {
+            *p = (*p)->next;
+            break;
+        }
+    }
+    file->next = (lfs2_file_t*)lfs2->mlist;
+    lfs2->mlist = (struct lfs2_mlist*)file;
+
+    if (file->flags & LFS2_F_INLINE) {
+        // reload inline file
+        file->cache.block = 0xfffffffe;
+        file->cache.off = 0;
+        file->cache.size = lfs2_cache_size(lfs2);
+
+        if (file->ctz.size > 0) {
+            lfs2_stag_t res = lfs2_dir_get(lfs2, &file->m,
+                    LFS2_MKTAG(0x700, 0x3ff, 0),
+                    LFS2_MKTAG(LFS2_TYPE_STRUCT, file->id,
+                        lfs2_min(file->cache.size, LFS2_ATTR_MAX)),
+                    file->cache.buffer);
+            if (res < 0) {
+                lfs2_file_putcache(lfs2, file);
+                return res;
+            }
+        }
+    }
+
+    return 0;
+}
+
 int lfs2_file_sync(lfs2_t *lfs2, lfs2_file_t *file) {
+    if ((file->flags & LFS2_F_INLINE) && (file->flags & LFS2_F_DIRTY)) {
+        // inline files are committed from their cache
+        int err = lfs2_file_getcache(lfs2, file);
+        if (err) {
+            return err;
+        }
+    }
+
     while (true) {
         int err = lfs2_file_flush(lfs2, file);
         if (err) {
@@ -2576,6 +3757,11 @@ int lfs2_file_sync(lfs2_t *lfs2, lfs2_file_t *file) {
         if ((file->flags & LFS2_F_DIRTY) &&
                 !(file->flags & LFS2_F_ERRED) &&
                 !lfs2_pair_isnull(file->m.pair)) {
+            err = lfs2_fs_uncheckpoint(lfs2);
+            if (err) {
+                return err;
+            }
+
             // update dir entry
             uint16_t type;
             const void *buffer;
@@ -2596,6 +3782,13 @@ int lfs2_file_sync(lfs2_t *lfs2, lfs2_file_t *file) {
                 size = sizeof(ctz);
             }
 
+            // find what we're replacing on disk so we can free it
+            struct lfs2_ctz octz;
+            err = lfs2_dir_getctz(lfs2, &file->m, file->id, &octz);
+            if (err) {
+                return err;
+            }
+
             // commit file data and attributes
             err = lfs2_dir_commit(lfs2, &file->m, LFS2_MKATTRS(
                     {LFS2_MKTAG(type, file->id, size), buffer},
@@ -2608,7 +3801,20 @@ int lfs2_file_sync(lfs2_t *lfs2, lfs2_file_t *file) {
                 return err;
             }
 
-            file->flags &= ~LFS2_F_DIRTY;
+            file->flags &= ~(LFS2_F_DIRTY | LFS2_F_QUEUED);
+
+            // free any old blocks, unless another open file may use them
+            if (octz.size > 0 && !lfs2_alloc_isopen(lfs2,
+                    (struct lfs2_mlist*)file, file->m.pair, file->id)) {
+                err = lfs2_ctz_free(lfs2, octz.head, octz.size,
+                        file->ctz.head,
+                        (file->flags & LFS2_F_INLINE) ? 0 : file->ctz.size);
+                if (err) {
+                    return err;
+                }
+            } else if (octz.size > 0) {
+                lfs2_alloc_drop(lfs2);
+            }
         }
 
         return 0;
@@ -2623,15 +3829,89 @@ relocate:
     }
 }
 
-lfs2_ssize_t lfs2_file_read(lfs2_t *lfs2, lfs2_file_t *file,
-        void *buffer, lfs2_size_t size) {
-    uint8_t *data = buffer;
-    lfs2_size_t nsize = size;
+int lfs2_file_queue(lfs2_t *lfs2, lfs2_file_t *file) {
+    int err = lfs2_file_flush(lfs2, file);
+    if (err) {
+        return err;
+    }
+
+    // only the metadata is left to write out
+    if ((file->flags & LFS2_F_DIRTY) &&
+            !(file->flags & LFS2_F_ERRED) &&
+            !lfs2_pair_isnull(file->m.pair)) {
+        file->flags |= LFS2_F_QUEUED;
+    }
+
+    return 0;
+}
+
+static int lfs2_file_readahead(lfs2_t *lfs2, lfs2_file_t *file) {
+    struct lfs2_readahead *ra = &file->readahead;
+    lfs2_off_t off = file->pos;
+    lfs2_off_t target = lfs2_ctz_index(lfs2, &off);
+
+    if (ra->head != file->ctz.head) {
+        // different skip-list, old window is useless
+        ra->head = file->ctz.head;
+        ra->start = 0;
+        ra->fill = 0;
+    }
+
+    if (target < ra->start || target >= ra->start + ra->fill) {
+        // only look ahead if we're streaming past the end of the window,
+        // anything else is probably a seek
+        lfs2_off_t last = target;
+        if (target == ra->start + ra->fill) {
+            lfs2_off_t current = lfs2_ctz_index(lfs2,
+                    &(lfs2_off_t){file->ctz.size-1});
+            last = lfs2_min(target + ra->count-1, current);
+        }
+
+        lfs2_block_t head;
+        int err = lfs2_ctz_findindex(lfs2, NULL, &file->cache, &file->index,
+                file->ctz.head, file->ctz.size, last, &head);
+        if (err) {
+            return err;
+        }
+
+        // every block points to the one before it, so walking back to our
+        // target costs one read per block
+        ra->start = target;
+        ra->fill = 0;
+        ra->blocks[last - target] = head;
+        for (lfs2_off_t i = last; i > target; i--) {
+            err = lfs2_bd_read(lfs2,
+                    NULL, &file->cache, sizeof(head),
+                    head, 0, &head, sizeof(head));
+            head = lfs2_fromle32(head);
+            if (err) {
+                return err;
+            }
+
+            LFS2_ASSERT(head >= 2 && head <= lfs2_block_count(lfs2));
+            ra->blocks[i-1 - target] = head;
+        }
+        ra->fill = last - target + 1;
+    }
 
+    file->block = ra->blocks[target - ra->start];
+    file->off = off;
+    return 0;
+}
+
+static int lfs2_file_prepread(lfs2_t *lfs2, lfs2_file_t *file) {
     if ((file->flags & 3) == LFS2_O_WRONLY) {
         return LFS2_ERR_BADF;
     }
 
+    if (!file->cache.buffer) {
+        // take a shared cache if we don't hold one
+        int err = lfs2_file_getcache(lfs2, file);
+        if (err) {
+            return err;
+        }
+    }
+
     if (file->flags & LFS2_F_WRITING) {
         // flush out any writes
         int err = lfs2_file_flush(lfs2, file);
@@ -2640,21 +3920,33 @@ lfs2_ssize_t lfs2_file_read(lfs2_t *lfs2, lfs2_file_t *file,
         }
     }
 
+    return 0;
+}
+
+static lfs2_ssize_t lfs2_file_readdata(lfs2_t *lfs2, lfs2_file_t *file,
+        void *buffer, lfs2_size_t size) {
+    uint8_t *data = buffer;
+
     if (file->pos >= file->ctz.size) {
         // eof if past end
         return 0;
     }
 
     size = lfs2_min(size, file->ctz.size - file->pos);
-    nsize = size;
+    lfs2_size_t nsize = size;
 
     while (nsize > 0) {
         // check if we need a new block
         if (!(file->flags & LFS2_F_READING) ||
-                file->off == lfs2->cfg->block_size) {
-            if (!(file->flags & LFS2_F_INLINE)) {
+                file->off == lfs2_block_size(lfs2)) {
+            if (!(file->flags & LFS2_F_INLINE) && file->readahead.count > 0) {
+                int err = lfs2_file_readahead(lfs2, file);
+                if (err) {
+                    return err;
+                }
+            } else if (!(file->flags & LFS2_F_INLINE)) {
                 int err = lfs2_ctz_find(lfs2, NULL, &file->cache,
-                        file->ctz.head, file->ctz.size,
+                        &file->index, file->ctz.head, file->ctz.size,
                         file->pos, &file->block, &file->off);
                 if (err) {
                     return err;
@@ -2668,10 +3960,10 @@ lfs2_ssize_t lfs2_file_read(lfs2_t *lfs2, lfs2_file_t *file,
         }
 
         // read as much as we can in current block
-        lfs2_size_t diff = lfs2_min(nsize, lfs2->cfg->block_size - file->off);
+        lfs2_size_t diff = lfs2_min(nsize, lfs2_block_size(lfs2) - file->off);
         if (file->flags & LFS2_F_INLINE) {
             int err = lfs2_dir_getread(lfs2, &file->m,
-                    NULL, &file->cache, lfs2->cfg->block_size,
+                    NULL, &file->cache, lfs2_block_size(lfs2),
                     LFS2_MKTAG(0xfff, 0x1ff, 0),
                     LFS2_MKTAG(LFS2_TYPE_INLINESTRUCT, file->id, 0),
                     file->off, data, diff);
@@ -2679,8 +3971,12 @@ lfs2_ssize_t lfs2_file_read(lfs2_t *lfs2, lfs2_file_t *file,
                 return err;
             }
         } else {
+            // when streaming, anything larger than our cache is better
+            // read directly
             int err = lfs2_bd_read(lfs2,
-                    NULL, &file->cache, lfs2->cfg->block_size,
+                    NULL, &file->cache,
+                    (file->readahead.count > 0)
+                        ? lfs2_cache_size(lfs2) : lfs2_block_size(lfs2),
                     file->block, file->off, data, diff);
             if (err) {
                 return err;
@@ -2696,15 +3992,58 @@ lfs2_ssize_t lfs2_file_read(lfs2_t *lfs2, lfs2_file_t *file,
     return size;
 }
 
-lfs2_ssize_t lfs2_file_write(lfs2_t *lfs2, lfs2_file_t *file,
-        const void *buffer, lfs2_size_t size) {
-    const uint8_t *data = buffer;
-    lfs2_size_t nsize = size;
+lfs2_ssize_t lfs2_file_read(lfs2_t *lfs2, lfs2_file_t *file,
+        void *buffer, lfs2_size_t size) {
+    int err = lfs2_file_prepread(lfs2, file);
+    if (err) {
+        return err;
+    }
+
+    return lfs2_file_readdata(lfs2, file, buffer, size);
+}
+
+lfs2_ssize_t lfs2_file_readv(lfs2_t *lfs2, lfs2_file_t *file,
+        const struct lfs2_iovec *iov, lfs2_size_t iovcnt) {
+    int err = lfs2_file_prepread(lfs2, file);
+    if (err) {
+        return err;
+    }
+
+    // fill each segment in turn, stopping early at eof
+    lfs2_size_t size = 0;
+    for (lfs2_size_t i = 0; i < iovcnt; i++) {
+        lfs2_ssize_t res = lfs2_file_readdata(lfs2, file,
+                iov[i].buffer, iov[i].size);
+        if (res < 0) {
+            return res;
+        }
 
+        size += res;
+        if ((lfs2_size_t)res < iov[i].size) {
+            break;
+        }
+    }
+
+    return size;
+}
+
+static lfs2_ssize_t lfs2_file_rawwrite(lfs2_t *lfs2, lfs2_file_t *file,
+        const void *buffer, lfs2_size_t size);
+
+static int lfs2_file_prepwrite(lfs2_t *lfs2, lfs2_file_t *file,
+        lfs2_size_t size) {
     if ((file->flags & 3) == LFS2_O_RDONLY) {
         return LFS2_ERR_BADF;
     }
 
+    if (!file->cache.buffer) {
+        // take a shared cache if we don't hold one
+        int err = lfs2_file_getcache(lfs2, file);
+        if (err) {
+            return err;
+        }
+    }
+
     if (file->flags & LFS2_F_READING) {
         // drop any reads
         int err = lfs2_file_flush(lfs2, file);
@@ -2727,37 +4066,115 @@ lfs2_ssize_t lfs2_file_write(lfs2_t *lfs2, lfs2_file_t *file,
         lfs2_off_t pos = file->pos;
         file->pos = file->ctz.size;
 
-        while (file->pos < pos) {
-            lfs2_ssize_t res = lfs2_file_write(lfs2, file, &(uint8_t){0}, 1);
-            if (res < 0) {
-                return res;
-            }
+        lfs2_ssize_t res = lfs2_file_rawwrite(lfs2, file,
+                NULL, pos - file->pos);
+        if (res < 0) {
+            return res;
         }
     }
 
     if ((file->flags & LFS2_F_INLINE) &&
-            lfs2_max(file->pos+nsize, file->ctz.size) >
-            lfs2_min(LFS2_ATTR_MAX, lfs2_min(
-                lfs2->cfg->cache_size, lfs2->cfg->block_size/8))) {
+            lfs2_max(file->pos+size, file->ctz.size) > lfs2->inline_max) {
         // inline file doesn't fit anymore
-        file->off = file->pos;
-        lfs2_alloc_ack(lfs2);
-        int err = lfs2_file_relocate(lfs2, file);
+        int err;
+        if (file->pos + size < file->ctz.size) {
+            // an inline file written under a larger inline_max has data
+            // past this write, move all of it out to a block first
+            err = lfs2_file_flush(lfs2, file);
+            if (!err) {
+                err = lfs2_file_outline(lfs2, file);
+            }
+        } else {
+            file->off = file->pos;
+            lfs2_alloc_ack(lfs2);
+            err = lfs2_file_relocate(lfs2, file);
+        }
+
         if (err) {
             file->flags |= LFS2_F_ERRED;
             return err;
         }
     }
 
+    return 0;
+}
+
+static int lfs2_file_inplace(lfs2_t *lfs2, lfs2_file_t *file,
+        lfs2_off_t end) {
+    // end is where the file ends in its last block, only appends to a
+    // partially filled last block can stay in place, and only if no other
+    // open file may be reading or writing that block
+    //
+    // a dirty file may have been truncated since its last commit, which
+    // still holds data past end in this block
+    if (lfs2->cfg->append == LFS2_APPEND_COPY ||
+            (file->flags & LFS2_F_DIRTY) ||
+            file->pos != file->ctz.size ||
+            end == lfs2_block_size(lfs2) ||
+            lfs2_alloc_isopen(lfs2, (struct lfs2_mlist*)file,
+                file->m.pair, file->id)) {
+        return false;
+    }
+
+    lfs2_off_t off = lfs2_aligndown(end, lfs2_prog_size(lfs2));
+    if (lfs2->cfg->append == LFS2_APPEND_ERASED) {
+        // the rest of the last prog was padded, and anything after it may
+        // hold writes that were never committed, so check it's erased
+        if (off != end) {
+            return false;
+        }
+
+        uint8_t dat[16];
+        for (lfs2_off_t i = end; i < lfs2_block_size(lfs2);
+                i += sizeof(dat)) {
+            lfs2_size_t diff = lfs2_min(lfs2_block_size(lfs2)-i, sizeof(dat));
+            int err = lfs2_bd_read(lfs2,
+                    NULL, &lfs2->rcache, lfs2_block_size(lfs2)-i,
+                    file->block, i, dat, diff);
+            if (err) {
+                return err;
+            }
+
+            for (lfs2_size_t j = 0; j < diff; j++) {
+                if (dat[j] != 0xff) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // start the cache with what's already in the last prog, so it's
+    // programmed again unchanged
+    int err = lfs2_bd_read(lfs2,
+            NULL, &lfs2->rcache, end - off,
+            file->block, off, file->cache.buffer, end - off);
+    if (err) {
+        return err;
+    }
+
+    file->cache.block = file->block;
+    file->cache.off = off;
+    file->cache.size = end - off;
+    file->off = end;
+    return true;
+}
+
+static lfs2_ssize_t lfs2_file_progdata(lfs2_t *lfs2, lfs2_file_t *file,
+        const void *buffer, lfs2_size_t size) {
+    // a NULL buffer writes zeros
+    const uint8_t *data = buffer;
+    lfs2_size_t nsize = size;
+
     while (nsize > 0) {
         // check if we need a new block
         if (!(file->flags & LFS2_F_WRITING) ||
-                file->off == lfs2->cfg->block_size) {
+                file->off == lfs2_block_size(lfs2)) {
             if (!(file->flags & LFS2_F_INLINE)) {
+                int res = false;
                 if (!(file->flags & LFS2_F_WRITING) && file->pos > 0) {
                     // find out which block we're extending from
                     int err = lfs2_ctz_find(lfs2, NULL, &file->cache,
-                            file->ctz.head, file->ctz.size,
+                            &file->index, file->ctz.head, file->ctz.size,
                             file->pos-1, &file->block, &file->off);
                     if (err) {
                         file->flags |= LFS2_F_ERRED;
@@ -2766,16 +4183,26 @@ lfs2_ssize_t lfs2_file_write(lfs2_t *lfs2, lfs2_file_t *file,
 
                     // mark cache as dirty since we may have read data into it
                     lfs2_cache_zero(lfs2, &file->cache);
+
+                    // try to append to the last block without copying it
+                    res = lfs2_file_inplace(lfs2, file, file->off+1);
+                    if (res < 0) {
+                        file->flags |= LFS2_F_ERRED;
+                        return res;
+                    }
                 }
 
-                // extend file with new blocks
-                lfs2_alloc_ack(lfs2);
-                int err = lfs2_ctz_extend(lfs2, &file->cache, &lfs2->rcache,
-                        file->block, file->pos,
-                        &file->block, &file->off);
-                if (err) {
-                    file->flags |= LFS2_F_ERRED;
-                    return err;
+                if (!res) {
+                    // extend file with new blocks
+                    lfs2_alloc_ack(lfs2);
+                    int err = lfs2_ctz_extend(lfs2,
+                            &file->cache, &lfs2->rcache,
+                            &file->reserve, file->block, file->pos,
+                            &file->block, &file->off);
+                    if (err) {
+                        file->flags |= LFS2_F_ERRED;
+                        return err;
+                    }
                 }
             } else {
                 file->block = 0xfffffffe;
@@ -2786,7 +4213,7 @@ lfs2_ssize_t lfs2_file_write(lfs2_t *lfs2, lfs2_file_t *file,
         }
 
         // program as much as we can in current block
-        lfs2_size_t diff = lfs2_min(nsize, lfs2->cfg->block_size - file->off);
+        lfs2_size_t diff = lfs2_min(nsize, lfs2_block_size(lfs2) - file->off);
         while (true) {
             int err = lfs2_bd_prog(lfs2, &file->cache, &lfs2->rcache, true,
                     file->block, file->off, data, diff);
@@ -2800,6 +4227,7 @@ lfs2_ssize_t lfs2_file_write(lfs2_t *lfs2, lfs2_file_t *file,
 
             break;
 relocate:
+            lfs2->stats.relocate_count += 1;
             err = lfs2_file_relocate(lfs2, file);
             if (err) {
                 file->flags |= LFS2_F_ERRED;
@@ -2809,7 +4237,9 @@ relocate:
 
         file->pos += diff;
         file->off += diff;
-        data += diff;
+        if (data) {
+            data += diff;
+        }
         nsize -= diff;
 
         lfs2_alloc_ack(lfs2);
@@ -2819,6 +4249,49 @@ relocate:
     return size;
 }
 
+static lfs2_ssize_t lfs2_file_rawwrite(lfs2_t *lfs2, lfs2_file_t *file,
+        const void *buffer, lfs2_size_t size) {
+    int err = lfs2_file_prepwrite(lfs2, file, size);
+    if (err) {
+        return err;
+    }
+
+    return lfs2_file_progdata(lfs2, file, buffer, size);
+}
+
+lfs2_ssize_t lfs2_file_write(lfs2_t *lfs2, lfs2_file_t *file,
+        const void *buffer, lfs2_size_t size) {
+    return lfs2_file_rawwrite(lfs2, file, buffer, size);
+}
+
+lfs2_ssize_t lfs2_file_writev(lfs2_t *lfs2, lfs2_file_t *file,
+        const struct lfs2_iovec *iov, lfs2_size_t iovcnt) {
+    lfs2_size_t size = 0;
+    for (lfs2_size_t i = 0; i < iovcnt; i++) {
+        if (size + iov[i].size < size) {
+            return LFS2_ERR_FBIG;
+        }
+        size += iov[i].size;
+    }
+
+    // checks, appends, and moving out of an inline file happen once for
+    // the whole write, then each segment streams into the file's cache
+    int err = lfs2_file_prepwrite(lfs2, file, size);
+    if (err) {
+        return err;
+    }
+
+    for (lfs2_size_t i = 0; i < iovcnt; i++) {
+        lfs2_ssize_t res = lfs2_file_progdata(lfs2, file,
+                iov[i].buffer, iov[i].size);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    return size;
+}
+
 lfs2_soff_t lfs2_file_seek(lfs2_t *lfs2, lfs2_file_t *file,
         lfs2_soff_t off, int whence) {
     // write out everything beforehand, may be noop if rdonly
@@ -2852,6 +4325,14 @@ int lfs2_file_truncate(lfs2_t *lfs2, lfs2_file_t *file, lfs2_off_t size) {
         return LFS2_ERR_BADF;
     }
 
+    if (!file->cache.buffer) {
+        // take a shared cache if we don't hold one
+        int err = lfs2_file_getcache(lfs2, file);
+        if (err) {
+            return err;
+        }
+    }
+
     lfs2_off_t oldsize = lfs2_file_size(lfs2, file);
     if (size < oldsize) {
         // need to flush since directly changing metadata
@@ -2862,13 +4343,19 @@ int lfs2_file_truncate(lfs2_t *lfs2, lfs2_file_t *file, lfs2_off_t size) {
 
         // lookup new head in ctz skip list
         err = lfs2_ctz_find(lfs2, NULL, &file->cache,
-                file->ctz.head, file->ctz.size,
+                &file->index, file->ctz.head, file->ctz.size,
                 size, &file->ctz.head, &(lfs2_off_t){0});
         if (err) {
             return err;
         }
 
+        if (file->flags & LFS2_F_DIRTY) {
+            // blocks past the new head may never have been committed
+            lfs2_alloc_drop(lfs2);
+        }
+
         file->ctz.size = size;
+        lfs2_file_ctzchanged(file);
         file->flags |= LFS2_F_DIRTY;
     } else if (size > oldsize) {
         lfs2_off_t pos = file->pos;
@@ -2882,11 +4369,10 @@ int lfs2_file_truncate(lfs2_t *lfs2, lfs2_file_t *file, lfs2_off_t size) {
         }
 
         // fill with zeros
-        while (file->pos < size) {
-            lfs2_ssize_t res = lfs2_file_write(lfs2, file, &(uint8_t){0}, 1);
-            if (res < 0) {
-                return res;
-            }
+        lfs2_ssize_t res = lfs2_file_rawwrite(lfs2, file,
+                NULL, size - file->pos);
+        if (res < 0) {
+            return res;
         }
 
         // restore pos
@@ -2899,6 +4385,107 @@ int lfs2_file_truncate(lfs2_t *lfs2, lfs2_file_t *file, lfs2_off_t size) {
     return 0;
 }
 
+int lfs2_file_reserve(lfs2_t *lfs2, lfs2_file_t *file, lfs2_off_t size) {
+    if ((file->flags & 3) == LFS2_O_RDONLY) {
+        return LFS2_ERR_BADF;
+    }
+
+    if (size > lfs2->file_max) {
+        return LFS2_ERR_FBIG;
+    }
+
+    // find how many blocks the file already has to grow into, appending
+    // to an incomplete block we aren't writing copies it to a new block
+    lfs2_off_t end = lfs2_file_size(lfs2, file);
+    lfs2_size_t have = 0;
+    if (!(file->flags & LFS2_F_INLINE) && end > 0) {
+        lfs2_off_t off = end-1;
+        have = lfs2_ctz_index(lfs2, &off) + 1;
+        if (!(file->flags & LFS2_F_WRITING) &&
+                off+1 != lfs2_block_size(lfs2)) {
+            have -= 1;
+        }
+    }
+
+    lfs2_size_t need = 0;
+    if (size > lfs2->inline_max) {
+        lfs2_off_t off = size-1;
+        need = lfs2_ctz_index(lfs2, &off) + 1;
+        need -= lfs2_min(have, need);
+    }
+
+    if (need <= file->reserve.count) {
+        lfs2_file_unreserve(lfs2, file, need);
+        return 0;
+    }
+
+    // make room in the table, keeping any blocks we already have
+    if (file->cfg->reserve_buffer) {
+        if (need > file->cfg->reserve_size/4) {
+            return LFS2_ERR_NOMEM;
+        }
+
+        if (file->reserve.count) {
+            memmove(file->cfg->reserve_buffer,
+                    &file->reserve.blocks[file->reserve.off],
+                    4*file->reserve.count);
+        }
+        file->reserve.blocks = file->cfg->reserve_buffer;
+    } else {
+        lfs2_block_t *blocks = lfs2_malloc(4*need);
+        if (!blocks) {
+            return LFS2_ERR_NOMEM;
+        }
+
+        if (file->reserve.count) {
+            memcpy(blocks, &file->reserve.blocks[file->reserve.off],
+                    4*file->reserve.count);
+        }
+        lfs2_free(file->reserve.blocks);
+        file->reserve.blocks = blocks;
+    }
+    file->reserve.off = 0;
+
+    // allocate and erase the new blocks, blocks in the table are found by
+    // traversals so the allocator won't give them out again and can ack
+    // them right away
+    lfs2_size_t count = file->reserve.count;
+    lfs2_alloc_ack(lfs2);
+    while (file->reserve.count < need) {
+        lfs2_block_t block;
+        if (lfs2_alloc_erased(lfs2, &block)) {
+            file->reserve.blocks[file->reserve.count] = block;
+            file->reserve.count += 1;
+            continue;
+        }
+
+        int err = lfs2_alloc(lfs2, &block);
+        if (err) {
+            lfs2_file_unreserve(lfs2, file, count);
+            return err;
+        }
+
+        err = lfs2_bd_erase(lfs2, block);
+        if (err) {
+            if (err == LFS2_ERR_CORRUPT) {
+                // just try a new block
+                LFS2_DEBUG("Bad block at %"PRIu32, block);
+                lfs2->stats.relocate_count += 1;
+                lfs2_alloc_drop(lfs2);
+                continue;
+            }
+            lfs2_file_unreserve(lfs2, file, count);
+            return err;
+        }
+
+        file->reserve.blocks[file->reserve.count] = block;
+        file->reserve.count += 1;
+        lfs2_alloc_ack(lfs2);
+    }
+
+    return 0;
+}
+
 lfs2_soff_t lfs2_file_tell(lfs2_t *lfs2, lfs2_file_t *file) {
     (void)lfs2;
     return file->pos;
@@ -2971,6 +4558,19 @@ int lfs2_remove(lfs2_t *lfs2, const char *path) {
         lfs2_fs_preporphans(lfs2, +1);
     }
 
+    // find the file's blocks so we can free them after removal
+    struct lfs2_ctz ctz = {0xffffffff, 0};
+    bool isopen = false;
+    if (lfs2_tag_type3(tag) == LFS2_TYPE_REG) {
+        isopen = lfs2_alloc_isopen(lfs2, NULL, cwd.pair, lfs2_tag_id(tag));
+        if (!isopen) {
+            err = lfs2_dir_getctz(lfs2, &cwd, lfs2_tag_id(tag), &ctz);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
     // delete the entry
     err = lfs2_dir_commit(lfs2, &cwd, LFS2_MKATTRS(
             {LFS2_MKTAG(LFS2_TYPE_DELETE, lfs2_tag_id(tag), 0)}));
@@ -2978,6 +4578,16 @@ int lfs2_remove(lfs2_t *lfs2, const char *path) {
         return err;
     }
 
+    err = lfs2_ctz_free(lfs2, ctz.head, ctz.size, 0xffffffff, 0);
+    if (err) {
+        return err;
+    }
+
+    if (isopen) {
+        // the open file still reads its blocks, but they're no longer ours
+        lfs2_alloc_drop(lfs2);
+    }
+
     if (lfs2_tag_type3(tag) == LFS2_TYPE_DIR) {
         // fix orphan
         lfs2_fs_preporphans(lfs2, -1);
@@ -3051,6 +4661,23 @@ int lfs2_rename(lfs2_t *lfs2, const char *oldpath, const char *newpath) {
         lfs2_fs_preporphans(lfs2, +1);
     }
 
+    // find the blocks of any file we replace so we can free them after,
+    // careful, we may be renaming a file onto itself
+    struct lfs2_ctz prevctz = {0xffffffff, 0};
+    bool previsopen = false;
+    if (prevtag != LFS2_ERR_NOENT &&
+            lfs2_tag_type3(prevtag) == LFS2_TYPE_REG &&
+            !(lfs2_pair_cmp(oldcwd.pair, newcwd.pair) == 0 &&
+                lfs2_tag_id(oldtag) == newid)) {
+        previsopen = lfs2_alloc_isopen(lfs2, NULL, newcwd.pair, newid);
+        if (!previsopen) {
+            err = lfs2_dir_getctz(lfs2, &newcwd, newid, &prevctz);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
     // create move to fix later
     uint16_t newoldtagid = lfs2_tag_id(oldtag);
     if (lfs2_pair_cmp(oldcwd.pair, newcwd.pair) == 0 &&
@@ -3100,6 +4727,15 @@ int lfs2_rename(lfs2_t *lfs2, const char *oldpath, const char *newpath) {
         }
     }
 
+    err = lfs2_ctz_free(lfs2, prevctz.head, prevctz.size, 0xffffffff, 0);
+    if (err) {
+        return err;
+    }
+
+    if (previsopen) {
+        lfs2_alloc_drop(lfs2);
+    }
+
     return 0;
 }
 
@@ -3137,6 +4773,11 @@ lfs2_ssize_t lfs2_getattr(lfs2_t *lfs2, const char *path,
 
 static int lfs2_commitattr(lfs2_t *lfs2, const char *path,
         uint8_t type, const void *buffer, lfs2_size_t size) {
+    int err = lfs2_fs_uncheckpoint(lfs2);
+    if (err) {
+        return err;
+    }
+
     lfs2_mdir_t cwd;
     lfs2_stag_t tag = lfs2_dir_find(lfs2, &cwd, &path, NULL);
     if (tag < 0) {
@@ -3147,7 +4788,7 @@ static int lfs2_commitattr(lfs2_t *lfs2, const char *path,
     if (id == 0x3ff) {
         // special case for root
         id = 0;
-        int err = lfs2_dir_fetch(lfs2, &cwd, lfs2->root);
+        err = lfs2_dir_fetch(lfs2, &cwd, lfs2->root);
         if (err) {
             return err;
         }
@@ -3172,36 +4813,101 @@ int lfs2_removeattr(lfs2_t *lfs2, const char *path, uint8_t type) {
 
 
 /// Filesystem operations ///
+static lfs2_size_t lfs2_inline_limit(lfs2_t *lfs2) {
+    // inline files are kept in the file's cache until they're committed,
+    // and compaction splits pairs at block_size/2, so much larger inline
+    // files end up with a pair each and use more blocks than they save
+    return lfs2_min(LFS2_ATTR_MAX, lfs2_min(
+            lfs2_cache_size(lfs2), lfs2_block_size(lfs2)/8));
+}
+
 static int lfs2_init(lfs2_t *lfs2, const struct lfs2_config *cfg) {
     lfs2->cfg = cfg;
     int err = 0;
 
     // check that block size is a multiple of cache size is a multiple
     // of prog and read sizes
-    LFS2_ASSERT(lfs2->cfg->cache_size % lfs2->cfg->read_size == 0);
-    LFS2_ASSERT(lfs2->cfg->cache_size % lfs2->cfg->prog_size == 0);
-    LFS2_ASSERT(lfs2->cfg->block_size % lfs2->cfg->cache_size == 0);
+    LFS2_ASSERT(lfs2_cache_size(lfs2) % lfs2_read_size(lfs2) == 0);
+    LFS2_ASSERT(lfs2_cache_size(lfs2) % lfs2_prog_size(lfs2) == 0);
+    LFS2_ASSERT(lfs2_block_size(lfs2) % lfs2_cache_size(lfs2) == 0);
 
     // check that the block size is large enough to fit ctz pointers
-    LFS2_ASSERT(4*lfs2_npw2(0xffffffff / (lfs2->cfg->block_size-2*4))
-            <= lfs2->cfg->block_size);
-
-    // setup read cache
+    LFS2_ASSERT(4*lfs2_npw2(0xffffffff / (lfs2_block_size(lfs2)-2*4))
+            <= lfs2_block_size(lfs2));
+
+    // check that any geometry fixed at compile time matches
+#ifdef LFS2_STATIC_READ_SIZE
+    LFS2_ASSERT(cfg->read_size == LFS2_STATIC_READ_SIZE);
+#endif
+#ifdef LFS2_STATIC_PROG_SIZE
+    LFS2_ASSERT(cfg->prog_size == LFS2_STATIC_PROG_SIZE);
+#endif
+#ifdef LFS2_STATIC_BLOCK_SIZE
+    LFS2_ASSERT(cfg->block_size == LFS2_STATIC_BLOCK_SIZE);
+#endif
+#ifdef LFS2_STATIC_BLOCK_COUNT
+    LFS2_ASSERT(cfg->block_count == LFS2_STATIC_BLOCK_COUNT);
+#endif
+#ifdef LFS2_STATIC_CACHE_SIZE
+    LFS2_ASSERT(cfg->cache_size == LFS2_STATIC_CACHE_SIZE);
+#endif
+
+    // check that the validation policy is known
+    LFS2_ASSERT(lfs2->cfg->validate <= LFS2_VALIDATE_NONE);
+
+    // check that the append policy is known
+    LFS2_ASSERT(lfs2->cfg->append <= LFS2_APPEND_REWRITE);
+
+    // check that the compaction threshold fits in a block
+    LFS2_ASSERT(lfs2->cfg->compact_thresh <= lfs2_block_size(lfs2));
+
+    // setup read cache, the first line is our rcache, any others are kept
+    // in a table that shares the read buffer
+    lfs2->rlines.count = lfs2->cfg->rcache_count ? lfs2->cfg->rcache_count : 1;
+    LFS2_ASSERT(lfs2->rlines.count <= 32);
+    lfs2->rlines.lines = NULL;
+    lfs2->dcache.entries = NULL;
+    lfs2->mindex.entries = NULL;
+    lfs2->mindex.count = 0;
+    lfs2->fcache.buffer = NULL;
+    lfs2->epool.blocks = NULL;
+    lfs2->epool.count = 0;
+    lfs2->epool.erased = 0xffffffff;
+    lfs2->rlines.hand = 0;
+    lfs2->rlines.ref = 0;
+    lfs2->rlines.loads = 0;
+    memset(&lfs2->stats, 0, sizeof(lfs2->stats));
     if (lfs2->cfg->read_buffer) {
         lfs2->rcache.buffer = lfs2->cfg->read_buffer;
     } else {
-        lfs2->rcache.buffer = lfs2_malloc(lfs2->cfg->cache_size);
+        lfs2->rcache.buffer = lfs2_malloc(
+                lfs2->rlines.count*lfs2_cache_size(lfs2));
         if (!lfs2->rcache.buffer) {
             err = LFS2_ERR_NOMEM;
             goto cleanup;
         }
     }
 
+    if (lfs2->rlines.count > 1) {
+        lfs2->rlines.lines = lfs2_malloc(
+                (lfs2->rlines.count-1)*sizeof(lfs2_cache_t));
+        if (!lfs2->rlines.lines) {
+            err = LFS2_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        for (lfs2_size_t i = 1; i < lfs2->rlines.count; i++) {
+            lfs2->rlines.lines[i-1].buffer =
+                    &lfs2->rcache.buffer[i*lfs2_cache_size(lfs2)];
+            lfs2_cache_zero(lfs2, &lfs2->rlines.lines[i-1]);
+        }
+    }
+
     // setup program cache
     if (lfs2->cfg->prog_buffer) {
         lfs2->pcache.buffer = lfs2->cfg->prog_buffer;
     } else {
-        lfs2->pcache.buffer = lfs2_malloc(lfs2->cfg->cache_size);
+        lfs2->pcache.buffer = lfs2_malloc(lfs2_cache_size(lfs2));
         if (!lfs2->pcache.buffer) {
             err = LFS2_ERR_NOMEM;
             goto cleanup;
@@ -3212,17 +4918,94 @@ static int lfs2_init(lfs2_t *lfs2, const struct lfs2_config *cfg) {
     lfs2_cache_zero(lfs2, &lfs2->rcache);
     lfs2_cache_zero(lfs2, &lfs2->pcache);
 
-    // setup lookahead, must be multiple of 64-bits
-    LFS2_ASSERT(lfs2->cfg->lookahead_size % 8 == 0);
-    LFS2_ASSERT(lfs2->cfg->lookahead_size > 0);
-    if (lfs2->cfg->lookahead_buffer) {
-        lfs2->free.buffer = lfs2->cfg->lookahead_buffer;
+    if (lfs2->cfg->freemap_size) {
+        // setup free map, must hold a bit for every block
+        LFS2_ASSERT(lfs2->cfg->freemap_size % 4 == 0);
+        LFS2_ASSERT(lfs2->cfg->freemap_size >=
+                4*((lfs2_block_count(lfs2)+31)/32));
+        if (lfs2->cfg->freemap_buffer) {
+            lfs2->free.buffer = lfs2->cfg->freemap_buffer;
+        } else {
+            lfs2->free.buffer = lfs2_malloc(lfs2->cfg->freemap_size);
+            if (!lfs2->free.buffer) {
+                err = LFS2_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
     } else {
-        lfs2->free.buffer = lfs2_malloc(lfs2->cfg->lookahead_size);
-        if (!lfs2->free.buffer) {
+        // setup lookahead, must be multiple of 64-bits
+        LFS2_ASSERT(lfs2->cfg->lookahead_size % 8 == 0);
+        LFS2_ASSERT(lfs2->cfg->lookahead_size > 0);
+        if (lfs2->cfg->lookahead_buffer) {
+            lfs2->free.buffer = lfs2->cfg->lookahead_buffer;
+        } else {
+            lfs2->free.buffer = lfs2_malloc(lfs2->cfg->lookahead_size);
+            if (!lfs2->free.buffer) {
+                err = LFS2_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+    }
+
+    // setup metadata index
+    lfs2->mindex.count = lfs2->cfg->mindex_count;
+    lfs2->mindex.hand = 0;
+    if (lfs2->mindex.count) {
+        lfs2->mindex.entries = lfs2_malloc(
+                lfs2->mindex.count*sizeof(struct lfs2_mentry));
+        if (!lfs2->mindex.entries) {
             err = LFS2_ERR_NOMEM;
             goto cleanup;
         }
+
+        lfs2_mindex_drop(lfs2);
+    }
+
+    // setup path cache
+    lfs2->dcache.count = lfs2->cfg->dcache_count;
+    lfs2->dcache.hand = 0;
+    if (lfs2->dcache.count) {
+        lfs2->dcache.entries = lfs2_malloc(
+                lfs2->dcache.count*sizeof(struct lfs2_dentry));
+        if (!lfs2->dcache.entries) {
+            err = LFS2_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        lfs2_dcache_drop(lfs2);
+    }
+
+    // setup shared file caches, one bit per cache in the free mask
+    LFS2_ASSERT(lfs2->cfg->file_cache_count <= 32);
+    lfs2->fcache.count = lfs2->cfg->file_cache_count;
+    lfs2->fcache.free = 0;
+    if (lfs2->fcache.count) {
+        if (lfs2->cfg->file_cache_buffer) {
+            lfs2->fcache.buffer = lfs2->cfg->file_cache_buffer;
+        } else {
+            lfs2->fcache.buffer = lfs2_malloc(
+                    lfs2->fcache.count*lfs2_cache_size(lfs2));
+            if (!lfs2->fcache.buffer) {
+                err = LFS2_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+
+        lfs2->fcache.free = 0xffffffff >> (32 - lfs2->fcache.count);
+    }
+
+    // setup erase pool
+    if (lfs2->cfg->erase_pool_count) {
+        if (lfs2->cfg->erase_pool_buffer) {
+            lfs2->epool.blocks = lfs2->cfg->erase_pool_buffer;
+        } else {
+            lfs2->epool.blocks = lfs2_malloc(
+                    lfs2->cfg->erase_pool_count*sizeof(lfs2_block_t));
+            if (!lfs2->epool.blocks) {
+                err = LFS2_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
     }
 
     // check that the size limits are sane
@@ -3244,6 +5027,12 @@ static int lfs2_init(lfs2_t *lfs2, const struct lfs2_config *cfg) {
         lfs2->attr_max = LFS2_ATTR_MAX;
     }
 
+    LFS2_ASSERT(lfs2->cfg->inline_max <= lfs2_inline_limit(lfs2));
+    lfs2->inline_max = lfs2->cfg->inline_max;
+    if (!lfs2->inline_max) {
+        lfs2->inline_max = lfs2_inline_limit(lfs2);
+    }
+
     // setup default state
     lfs2->root[0] = 0xffffffff;
     lfs2->root[1] = 0xffffffff;
@@ -3252,6 +5041,7 @@ static int lfs2_init(lfs2_t *lfs2, const struct lfs2_config *cfg) {
     lfs2->gstate = (struct lfs2_gstate){0};
     lfs2->gpending = (struct lfs2_gstate){0};
     lfs2->gdelta = (struct lfs2_gstate){0};
+    lfs2->checkpointed = false;
 
     return 0;
 
@@ -3260,17 +5050,41 @@ cleanup:
     return err;
 }
 
-static int lfs2_deinit(lfs2_t *lfs2) {
-    // free allocated memory
-    if (!lfs2->cfg->read_buffer) {
-        lfs2_free(lfs2->rcache.buffer);
+static int lfs2_deinit(lfs2_t *lfs2) {
+    // free allocated memory
+    if (!lfs2->cfg->read_buffer) {
+        lfs2_free(lfs2->rcache.buffer);
+    }
+
+    if (lfs2->rlines.lines) {
+        lfs2_free(lfs2->rlines.lines);
+    }
+
+    if (lfs2->dcache.entries) {
+        lfs2_free(lfs2->dcache.entries);
+    }
+
+    if (lfs2->mindex.entries) {
+        lfs2_free(lfs2->mindex.entries);
+    }
+
+    if (lfs2->fcache.buffer && !lfs2->cfg->file_cache_buffer) {
+        lfs2_free(lfs2->fcache.buffer);
+    }
+
+    if (lfs2->epool.blocks && !lfs2->cfg->erase_pool_buffer) {
+        lfs2_free(lfs2->epool.blocks);
     }
 
     if (!lfs2->cfg->prog_buffer) {
         lfs2_free(lfs2->pcache.buffer);
     }
 
-    if (!lfs2->cfg->lookahead_buffer) {
+    if (lfs2->cfg->freemap_size) {
+        if (!lfs2->cfg->freemap_buffer) {
+            lfs2_free(lfs2->free.buffer);
+        }
+    } else if (!lfs2->cfg->lookahead_buffer) {
         lfs2_free(lfs2->free.buffer);
     }
 
@@ -3285,12 +5099,18 @@ int lfs2_format(lfs2_t *lfs2, const struct lfs2_config *cfg) {
             return err;
         }
 
-        // create free lookahead
-        memset(lfs2->free.buffer, 0, lfs2->cfg->lookahead_size);
+        // create free lookahead, or a free map that covers every block
+        if (lfs2->cfg->freemap_size) {
+            memset(lfs2->free.buffer, 0, lfs2->cfg->freemap_size);
+            lfs2->free.size = lfs2_block_count(lfs2);
+        } else {
+            memset(lfs2->free.buffer, 0, lfs2->cfg->lookahead_size);
+            lfs2->free.size = lfs2_min(8*lfs2->cfg->lookahead_size,
+                    lfs2_block_count(lfs2));
+        }
         lfs2->free.off = 0;
-        lfs2->free.size = lfs2_min(8*lfs2->cfg->lookahead_size,
-                lfs2->cfg->block_count);
         lfs2->free.i = 0;
+        lfs2->free.used = 0;
         lfs2_alloc_ack(lfs2);
 
         // create root dir
@@ -3303,11 +5123,12 @@ int lfs2_format(lfs2_t *lfs2, const struct lfs2_config *cfg) {
         // write one superblock
         lfs2_superblock_t superblock = {
             .version     = LFS2_DISK_VERSION,
-            .block_size  = lfs2->cfg->block_size,
-            .block_count = lfs2->cfg->block_count,
+            .block_size  = lfs2_block_size(lfs2),
+            .block_count = lfs2_block_count(lfs2),
             .name_max    = lfs2->name_max,
             .file_max    = lfs2->file_max,
             .attr_max    = lfs2->attr_max,
+            .inline_max  = lfs2->inline_max,
         };
 
         lfs2_superblock_tole32(&superblock);
@@ -3332,6 +5153,25 @@ cleanup:
     return err;
 }
 
+static lfs2_stag_t lfs2_dir_getsuperblock(lfs2_t *lfs2,
+        const lfs2_mdir_t *dir, lfs2_superblock_t *superblock) {
+    lfs2_stag_t tag = lfs2_dir_get(lfs2, dir, LFS2_MKTAG(0x7ff, 0x3ff, 0),
+            LFS2_MKTAG(LFS2_TYPE_INLINESTRUCT, 0, sizeof(*superblock)),
+            superblock);
+    if (tag < 0) {
+        return tag;
+    }
+
+    // superblocks written before inline_max end where it starts, and may
+    // be followed by a checkpoint we shouldn't mistake for it
+    lfs2_size_t size = sizeof(*superblock) - sizeof(superblock->inline_max);
+    if (lfs2_tag_size(tag) == size + sizeof(lfs2_checkpoint_t)) {
+        superblock->inline_max = 0;
+    }
+
+    return tag;
+}
+
 int lfs2_mount(lfs2_t *lfs2, const struct lfs2_config *cfg) {
     int err = lfs2_init(lfs2, cfg);
     if (err) {
@@ -3339,6 +5179,7 @@ int lfs2_mount(lfs2_t *lfs2, const struct lfs2_config *cfg) {
     }
 
     // scan directory blocks for superblock and any global updates
+    lfs2_block_t used = 0xffffffff;
     lfs2_mdir_t dir = {.tail = {0, 1}};
     while (!lfs2_pair_isnull(dir.tail)) {
         // fetch next block in tail list
@@ -3353,6 +5194,8 @@ int lfs2_mount(lfs2_t *lfs2, const struct lfs2_config *cfg) {
             goto cleanup;
         }
 
+        lfs2_mindex_setpred(lfs2, dir.tail, dir.pair);
+
         // has superblock?
         if (tag && !lfs2_tag_isdelete(tag)) {
             // update root
@@ -3361,9 +5204,7 @@ int lfs2_mount(lfs2_t *lfs2, const struct lfs2_config *cfg) {
 
             // grab superblock
             lfs2_superblock_t superblock;
-            tag = lfs2_dir_get(lfs2, &dir, LFS2_MKTAG(0x7ff, 0x3ff, 0),
-                    LFS2_MKTAG(LFS2_TYPE_INLINESTRUCT, 0, sizeof(superblock)),
-                    &superblock);
+            tag = lfs2_dir_getsuperblock(lfs2, &dir, &superblock);
             if (tag < 0) {
                 err = tag;
                 goto cleanup;
@@ -3414,6 +5255,39 @@ int lfs2_mount(lfs2_t *lfs2, const struct lfs2_config *cfg) {
 
                 lfs2->attr_max = superblock.attr_max;
             }
+
+            if (superblock.inline_max) {
+                // larger inline files are still readable, we just move
+                // them out of their metadata when they're written
+                lfs2->inline_max = lfs2_min(superblock.inline_max,
+                        lfs2_inline_limit(lfs2));
+            }
+
+            // has an intact checkpoint? then it already holds the gstate
+            // of every pair, and we don't need to look at the rest
+            if (lfs2_tag_size(tag) >=
+                    sizeof(superblock) + sizeof(lfs2_checkpoint_t)) {
+                lfs2_checkpoint_t checkpoint;
+                tag = lfs2_dir_getslice(lfs2, &dir,
+                        LFS2_MKTAG(0x7ff, 0x3ff, 0),
+                        LFS2_MKTAG(LFS2_TYPE_INLINESTRUCT, 0, 0),
+                        sizeof(superblock), &checkpoint, sizeof(checkpoint));
+                if (tag < 0) {
+                    err = tag;
+                    goto cleanup;
+                }
+
+                uint32_t crc = lfs2_crc(0xffffffff, &checkpoint,
+                        sizeof(checkpoint) - sizeof(checkpoint.crc));
+                lfs2_checkpoint_fromle32(&checkpoint);
+                if (crc == checkpoint.crc &&
+                        lfs2_pair_cmp(checkpoint.root, dir.pair) == 0) {
+                    lfs2->gpending = checkpoint.gstate;
+                    used = checkpoint.used;
+                    lfs2->checkpointed = true;
+                    break;
+                }
+            }
         }
 
         // has gstate?
@@ -3439,10 +5313,14 @@ int lfs2_mount(lfs2_t *lfs2, const struct lfs2_config *cfg) {
                 lfs2_tag_id(lfs2->gstate.tag));
     }
 
-    // setup free lookahead
-    lfs2->free.off = lfs2->seed % lfs2->cfg->block_size;
+    // setup free lookahead, the free map is built on first allocation
+    lfs2->free.off = lfs2->seed % lfs2_block_size(lfs2);
     lfs2->free.size = 0;
     lfs2->free.i = 0;
+    if (lfs2->cfg->freemap_size) {
+        lfs2->free.i = lfs2->seed % lfs2_block_count(lfs2);
+    }
+    lfs2->free.used = (lfs2->cfg->freemap_size) ? 0xffffffff : used;
     lfs2_alloc_ack(lfs2);
 
     return 0;
@@ -3519,6 +5397,21 @@ int lfs2_fs_traverse(lfs2_t *lfs2,
                 return err;
             }
         }
+
+        for (lfs2_size_t i = 0; i < f->reserve.count; i++) {
+            int err = cb(data, f->reserve.blocks[f->reserve.off+i]);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    // iterate over the erase pool
+    for (lfs2_size_t i = 0; i < lfs2->epool.count; i++) {
+        int err = cb(data, lfs2->epool.blocks[i]);
+        if (err) {
+            return err;
+        }
     }
 
     return 0;
@@ -3526,6 +5419,17 @@ int lfs2_fs_traverse(lfs2_t *lfs2,
 
 static int lfs2_fs_pred(lfs2_t *lfs2,
         const lfs2_block_t pair[2], lfs2_mdir_t *pdir) {
+    // try the metadata index first
+    if (lfs2->mindex.count) {
+        int err = lfs2_mindex_pred(lfs2, pair, pdir);
+        if (err != LFS2_ERR_NOENT) {
+            lfs2->stats.mindex_hits += (err == 0);
+            return err;
+        }
+
+        lfs2->stats.mindex_misses += 1;
+    }
+
     // iterate over all directory directory entries
     pdir->tail[0] = 0;
     pdir->tail[1] = 1;
@@ -3538,6 +5442,8 @@ static int lfs2_fs_pred(lfs2_t *lfs2,
         if (err) {
             return err;
         }
+
+        lfs2_mindex_setpred(lfs2, pdir->tail, pdir->pair);
     }
 
     return LFS2_ERR_NOENT;
@@ -3557,22 +5463,47 @@ static int lfs2_fs_parent_match(void *data,
 
     lfs2_block_t child[2];
     int err = lfs2_bd_read(lfs2,
-            &lfs2->pcache, &lfs2->rcache, lfs2->cfg->block_size,
+            &lfs2->pcache, &lfs2->rcache, lfs2_block_size(lfs2),
             disk->block, disk->off, &child, sizeof(child));
     if (err) {
         return err;
     }
 
     lfs2_pair_fromle32(child);
+
     return (lfs2_pair_cmp(child, find->pair) == 0) ? LFS2_CMP_EQ : LFS2_CMP_LT;
 }
 
 static lfs2_stag_t lfs2_fs_parent(lfs2_t *lfs2, const lfs2_block_t pair[2],
         lfs2_mdir_t *parent) {
+    // try the metadata index first, a hint is checked by the fetch
+    const struct lfs2_mentry *e = lfs2_mindex_find(lfs2, pair);
+    if (e && !lfs2_pair_isnull(e->parent)) {
+        lfs2_stag_t tag = lfs2_dir_fetchmatch(lfs2, parent, e->parent,
+                LFS2_MKTAG(0x7ff, 0, 0x3ff),
+                LFS2_MKTAG(LFS2_TYPE_DIRSTRUCT, 0, 8),
+                NULL,
+                lfs2_fs_parent_match, &(struct lfs2_fs_parent_match){
+                    lfs2, {pair[0], pair[1]}});
+        if (tag < 0 && tag != LFS2_ERR_NOENT && tag != LFS2_ERR_CORRUPT) {
+            return tag;
+        }
+
+        if (tag > 0) {
+            lfs2->stats.mindex_hits += 1;
+            return tag;
+        }
+    }
+
+    if (lfs2->mindex.count) {
+        lfs2->stats.mindex_misses += 1;
+    }
+
     // use fetchmatch with callback to find pairs
     parent->tail[0] = 0;
     parent->tail[1] = 1;
     while (!lfs2_pair_isnull(parent->tail)) {
+        const lfs2_block_t from[2] = {parent->tail[0], parent->tail[1]};
         lfs2_stag_t tag = lfs2_dir_fetchmatch(lfs2, parent, parent->tail,
                 LFS2_MKTAG(0x7ff, 0, 0x3ff),
                 LFS2_MKTAG(LFS2_TYPE_DIRSTRUCT, 0, 8),
@@ -3580,6 +5511,9 @@ static lfs2_stag_t lfs2_fs_parent(lfs2_t *lfs2, const lfs2_block_t pair[2],
                 lfs2_fs_parent_match, &(struct lfs2_fs_parent_match){
                     lfs2, {pair[0], pair[1]}});
         if (tag && tag != LFS2_ERR_NOENT) {
+            if (tag > 0) {
+                lfs2_mindex_setparent(lfs2, pair, from);
+            }
             return tag;
         }
     }
@@ -3589,6 +5523,9 @@ static lfs2_stag_t lfs2_fs_parent(lfs2_t *lfs2, const lfs2_block_t pair[2],
 
 static int lfs2_fs_relocate(lfs2_t *lfs2,
         const lfs2_block_t oldpair[2], lfs2_block_t newpair[2]) {
+    // the old pair may be reused, so forget any paths through it
+    lfs2_dcache_drop(lfs2);
+
     // update internal root
     if (lfs2_pair_cmp(oldpair, lfs2->root) == 0) {
         LFS2_DEBUG("Relocating root %"PRIu32" %"PRIu32,
@@ -3605,11 +5542,26 @@ static int lfs2_fs_relocate(lfs2_t *lfs2,
         }
     }
 
-    // find parent
+    // only the head of a dir has a parent, if the index knows our
+    // predecessor its tail tells us if we can skip looking
     lfs2_mdir_t parent;
-    lfs2_stag_t tag = lfs2_fs_parent(lfs2, oldpair, &parent);
-    if (tag < 0 && tag != LFS2_ERR_NOENT) {
-        return tag;
+    lfs2_stag_t tag = LFS2_ERR_NOENT;
+    if (lfs2->mindex.count) {
+        tag = lfs2_mindex_pred(lfs2, oldpair, &parent);
+        if (tag < 0 && tag != LFS2_ERR_NOENT) {
+            return tag;
+        }
+    }
+
+    // find parent
+    if (tag == LFS2_ERR_NOENT || !parent.split) {
+        tag = lfs2_fs_parent(lfs2, oldpair, &parent);
+        if (tag < 0 && tag != LFS2_ERR_NOENT) {
+            return tag;
+        }
+    } else {
+        lfs2->stats.mindex_hits += 1;
+        tag = LFS2_ERR_NOENT;
     }
 
     if (tag != LFS2_ERR_NOENT) {
@@ -3645,6 +5597,7 @@ static int lfs2_fs_relocate(lfs2_t *lfs2,
         }
     }
 
+    lfs2_mindex_relocate(lfs2, oldpair, newpair);
     return 0;
 }
 
@@ -3706,6 +5659,8 @@ static int lfs2_fs_deorphan(lfs2_t *lfs2) {
             return err;
         }
 
+        lfs2_mindex_setpred(lfs2, dir.tail, dir.pair);
+
         // check head blocks for orphans
         if (!pdir.split) {
             // check if we have a parent
@@ -3759,11 +5714,19 @@ static int lfs2_fs_deorphan(lfs2_t *lfs2) {
     // mark orphans as fixed
     lfs2_fs_preporphans(lfs2, -lfs2_gstate_getorphans(&lfs2->gstate));
     lfs2->gstate = lfs2->gpending;
+
+    // we may have lost track of blocks, recount lazily
+    lfs2_alloc_drop(lfs2);
     return 0;
 }
 
 static int lfs2_fs_forceconsistency(lfs2_t *lfs2) {
-    int err = lfs2_fs_demove(lfs2);
+    int err = lfs2_fs_uncheckpoint(lfs2);
+    if (err) {
+        return err;
+    }
+
+    err = lfs2_fs_demove(lfs2);
     if (err) {
         return err;
     }
@@ -3784,11 +5747,375 @@ static int lfs2_fs_size_count(void *p, lfs2_block_t block) {
 }
 
 lfs2_ssize_t lfs2_fs_size(lfs2_t *lfs2) {
-    lfs2_size_t size = 0;
-    int err = lfs2_fs_traverse(lfs2, lfs2_fs_size_count, &size);
+    // the free map keeps an exact count once built
+    if (lfs2->cfg->freemap_size) {
+        if (lfs2->free.size != lfs2_block_count(lfs2) ||
+                lfs2->free.used == 0xffffffff) {
+            int err = lfs2_alloc_rebuild(lfs2);
+            if (err) {
+                return err;
+            }
+        }
+
+        return lfs2->free.used - lfs2->epool.count;
+    }
+
+    // otherwise we need to count the tree if we've lost track
+    if (lfs2->free.used == 0xffffffff) {
+        lfs2_size_t size = 0;
+        int err = lfs2_fs_traverse(lfs2, lfs2_fs_size_count, &size);
+        if (err) {
+            return err;
+        }
+
+        if (lfs2_alloc_inflight(lfs2)) {
+            // don't keep a count that open files inflated
+            return size - lfs2->epool.count;
+        }
+
+        lfs2->free.used = size;
+    }
+
+    // blocks in the erase pool are still free
+    return lfs2->free.used - lfs2->epool.count;
+}
+
+static int lfs2_fs_writecheckpoint(lfs2_t *lfs2,
+        const lfs2_checkpoint_t *checkpoint) {
+    // update the superblock in place, keeping whatever it already says
+    lfs2_mdir_t root;
+    int err = lfs2_dir_fetch(lfs2, &root, lfs2->root);
+    if (err) {
+        return err;
+    }
+
+    struct {
+        lfs2_superblock_t superblock;
+        lfs2_checkpoint_t checkpoint;
+    } entry;
+    lfs2_stag_t tag = lfs2_dir_getsuperblock(lfs2, &root, &entry.superblock);
+    if (tag < 0) {
+        return tag;
+    }
+
+    lfs2_size_t size = sizeof(entry.superblock);
+    if (checkpoint) {
+        entry.checkpoint = *checkpoint;
+        size += sizeof(entry.checkpoint);
+    }
+
+    return lfs2_dir_commit(lfs2, &root, LFS2_MKATTRS(
+            {LFS2_MKTAG(LFS2_TYPE_INLINESTRUCT, 0, size), &entry}));
+}
+
+static int lfs2_fs_uncheckpoint(lfs2_t *lfs2) {
+    if (!lfs2->checkpointed) {
+        return 0;
+    }
+
+    // drop the checkpoint before it goes stale
+    lfs2->checkpointed = false;
+    return lfs2_fs_writecheckpoint(lfs2, NULL);
+}
+
+int lfs2_fs_checkpoint(lfs2_t *lfs2) {
+    if (lfs2->checkpointed) {
+        // nothing has changed
+        return 0;
+    }
+
+    // count blocks now so the next mount doesn't need to, unless the count
+    // includes blocks of open files that aren't on disk yet, the free map
+    // has to be rebuilt anyways
+    lfs2_block_t used = 0xffffffff;
+    if (!lfs2->cfg->freemap_size) {
+        lfs2_ssize_t res = lfs2_fs_size(lfs2);
+        if (res < 0) {
+            return res;
+        }
+
+        used = res;
+    }
+
+    for (struct lfs2_mlist *p = lfs2->mlist; p; p = p->next) {
+        if (p->type == LFS2_TYPE_REG &&
+                ((((lfs2_file_t*)p)->flags & (LFS2_F_DIRTY | LFS2_F_WRITING)) ||
+                    ((lfs2_file_t*)p)->reserve.count > 0)) {
+            used = 0xffffffff;
+            break;
+        }
+    }
+
+    while (true) {
+        lfs2_checkpoint_t checkpoint;
+        checkpoint.root[0] = lfs2->root[0];
+        checkpoint.root[1] = lfs2->root[1];
+        checkpoint.gstate = lfs2->gstate;
+        checkpoint.used = used;
+        lfs2_checkpoint_tole32(&checkpoint);
+        checkpoint.crc = lfs2_tole32(lfs2_crc(0xffffffff, &checkpoint,
+                sizeof(checkpoint) - sizeof(checkpoint.crc)));
+
+        int err = lfs2_fs_writecheckpoint(lfs2, &checkpoint);
+        if (err) {
+            return err;
+        }
+
+        // writing may relocate the root, in which case what we just wrote
+        // is already out of date
+        lfs2_checkpoint_fromle32(&checkpoint);
+        if (lfs2_pair_cmp(checkpoint.root, lfs2->root) == 0 &&
+                memcmp(&checkpoint.gstate, &lfs2->gstate,
+                    sizeof(lfs2->gstate)) == 0) {
+            lfs2->checkpointed = true;
+            return 0;
+        }
+    }
+}
+
+lfs2_ssize_t lfs2_fs_maintain(lfs2_t *lfs2, lfs2_size_t budget) {
+    // blocks in the pool are found by traversals, so we can ack them as
+    // soon as they're in the pool
+    lfs2_size_t count = 0;
+    while (budget > 0 && lfs2->epool.count < lfs2->cfg->erase_pool_count) {
+        lfs2_block_t block;
+        lfs2_alloc_ack(lfs2);
+        int err = lfs2_alloc_scan(lfs2, &block);
+        if (err) {
+            if (err == LFS2_ERR_NOSPC) {
+                // nothing left to erase
+                break;
+            }
+            return err;
+        }
+
+        budget -= 1;
+        err = lfs2_bd_erase(lfs2, block);
+        if (err) {
+            if (err == LFS2_ERR_CORRUPT) {
+                // just try a new block
+                LFS2_DEBUG("Bad block at %"PRIu32, block);
+                lfs2->stats.relocate_count += 1;
+                lfs2_alloc_drop(lfs2);
+                continue;
+            }
+            return err;
+        }
+
+        lfs2->epool.blocks[lfs2->epool.count] = block;
+        lfs2->epool.count += 1;
+        count += 1;
+    }
+    lfs2_alloc_ack(lfs2);
+
+    return count;
+}
+
+int lfs2_fs_commit(lfs2_t *lfs2) {
+    while (true) {
+        // gather queued files that share a metadata pair with the first
+        // queued file we find
+        lfs2_file_t *files[LFS2_COMMIT_MAX];
+        lfs2_size_t count = 0;
+        for (struct lfs2_mlist *m = lfs2->mlist; m; m = m->next) {
+            lfs2_file_t *f = (lfs2_file_t*)m;
+            if (m->type != LFS2_TYPE_REG || !(f->flags & LFS2_F_QUEUED) ||
+                    (count > 0 &&
+                        lfs2_pair_cmp(f->m.pair, files[0]->m.pair) != 0)) {
+                continue;
+            }
+
+            if (!((f->flags & LFS2_F_DIRTY) &&
+                    !(f->flags & LFS2_F_ERRED) &&
+                    !lfs2_pair_isnull(f->m.pair))) {
+                // nothing to commit anymore
+                f->flags &= ~LFS2_F_QUEUED;
+                continue;
+            }
+
+            int err = lfs2_file_flush(lfs2, f);
+            if (err) {
+                return err;
+            }
+
+            files[count] = f;
+            count += 1;
+            if (count == LFS2_COMMIT_MAX) {
+                break;
+            }
+        }
+
+        if (count == 0) {
+            return 0;
+        }
+
+        // inline files are committed from their cache, taking a cache may
+        // move another inline file out to a block, but that's fine since we
+        // haven't looked at how to commit any of them yet
+        for (lfs2_size_t i = 0; i < count; i++) {
+            if ((files[i]->flags & LFS2_F_INLINE) && !files[i]->cache.buffer) {
+                int err = lfs2_file_getcache(lfs2, files[i]);
+                if (err) {
+                    return err;
+                }
+            }
+        }
+
+        int err = lfs2_fs_uncheckpoint(lfs2);
+        if (err) {
+            return err;
+        }
+
+        // find what we're replacing on disk so we can free it
+        struct lfs2_ctz octz[LFS2_COMMIT_MAX];
+        for (lfs2_size_t i = 0; i < count; i++) {
+            err = lfs2_dir_getctz(lfs2, &files[i]->m, files[i]->id, &octz[i]);
+            if (err) {
+                return err;
+            }
+        }
+
+        while (true) {
+            // build one commit out of every file's update
+            struct lfs2_mattr attrs[2*LFS2_COMMIT_MAX];
+            struct lfs2_ctz ctz[LFS2_COMMIT_MAX];
+            for (lfs2_size_t i = 0; i < count; i++) {
+                lfs2_file_t *f = files[i];
+                if (f->flags & LFS2_F_INLINE) {
+                    attrs[2*i] = (struct lfs2_mattr){
+                        LFS2_MKTAG(LFS2_TYPE_INLINESTRUCT,
+                            f->id, f->ctz.size), f->cache.buffer};
+                } else {
+                    ctz[i] = f->ctz;
+                    lfs2_ctz_tole32(&ctz[i]);
+                    attrs[2*i] = (struct lfs2_mattr){
+                        LFS2_MKTAG(LFS2_TYPE_CTZSTRUCT,
+                            f->id, sizeof(ctz[i])), &ctz[i]};
+                }
+
+                attrs[2*i+1] = (struct lfs2_mattr){
+                    LFS2_MKTAG(LFS2_FROM_USERATTRS, f->id,
+                        f->cfg->attr_count), f->cfg->attrs};
+            }
+
+            err = lfs2_dir_commit(lfs2, &files[0]->m, attrs, 2*count);
+            if (err == LFS2_ERR_NOSPC) {
+                // inline files don't fit anymore, move them out to blocks
+                // and try again
+                bool outlined = false;
+                for (lfs2_size_t i = 0; i < count; i++) {
+                    if ((files[i]->flags & LFS2_F_INLINE) &&
+                            files[i]->ctz.size > 0) {
+                        err = lfs2_file_outline(lfs2, files[i]);
+                        if (err) {
+                            return err;
+                        }
+                        outlined = true;
+                    }
+                }
+
+                if (outlined) {
+                    continue;
+                }
+
+                return LFS2_ERR_NOSPC;
+            } else if (err) {
+                return err;
+            }
+
+            break;
+        }
+
+        for (lfs2_size_t i = 0; i < count; i++) {
+            lfs2_file_t *f = files[i];
+            f->flags &= ~(LFS2_F_DIRTY | LFS2_F_QUEUED);
+
+            // free any old blocks, unless another open file may use them
+            if (octz[i].size > 0 && !lfs2_alloc_isopen(lfs2,
+                    (struct lfs2_mlist*)f, f->m.pair, f->id)) {
+                err = lfs2_ctz_free(lfs2, octz[i].head, octz[i].size,
+                        f->ctz.head,
+                        (f->flags & LFS2_F_INLINE) ? 0 : f->ctz.size);
+                if (err) {
+                    return err;
+                }
+            } else if (octz[i].size > 0) {
+                lfs2_alloc_drop(lfs2);
+            }
+        }
+    }
+}
+
+int lfs2_fs_gc(lfs2_t *lfs2) {
+    // fix any orphans or moves left behind
+    int err = lfs2_fs_forceconsistency(lfs2);
     if (err) {
         return err;
     }
 
-  return size;
+    lfs2_size_t thresh = lfs2->cfg->compact_thresh;
+    if (!thresh) {
+        thresh = lfs2_block_size(lfs2) - lfs2_block_size(lfs2)/8;
+    }
+
+    // compact any metadata pairs over the threshold
+    lfs2_mdir_t mdir = {.tail = {0, 1}};
+    while (!lfs2_pair_isnull(mdir.tail)) {
+        err = lfs2_dir_fetch(lfs2, &mdir, mdir.tail);
+        if (err) {
+            return err;
+        }
+
+        if (mdir.off > thresh) {
+            // skip pairs compaction can't shrink, a commit is padded
+            // to prog_size so with large progs this may not get smaller
+            lfs2_size_t size = 0;
+            err = lfs2_dir_traverse(lfs2,
+                    &mdir, 0, 0xffffffff, NULL, 0, false,
+                    LFS2_MKTAG(0x400, 0x3ff, 0),
+                    LFS2_MKTAG(LFS2_TYPE_NAME, 0, 0),
+                    0, mdir.count, 0,
+                    lfs2_dir_commit_size, &size);
+            if (err) {
+                return err;
+            }
+
+            if (lfs2_alignup(sizeof(uint32_t) + size,
+                    lfs2_prog_size(lfs2)) >= mdir.off) {
+                continue;
+            }
+
+            if (lfs2->checkpointed) {
+                // dropping the checkpoint may have changed the pair
+                err = lfs2_fs_uncheckpoint(lfs2);
+                if (err) {
+                    return err;
+                }
+
+                err = lfs2_dir_fetch(lfs2, &mdir, mdir.pair);
+                if (err) {
+                    return err;
+                }
+            }
+
+            // an empty commit to a pair that isn't erased compacts it
+            mdir.erased = false;
+            err = lfs2_dir_commit(lfs2, &mdir, NULL, 0);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int lfs2_fs_stats(lfs2_t *lfs2, struct lfs2_fsstats *stats) {
+    *stats = lfs2->stats;
+    return 0;
+}
+
+int lfs2_fs_resetstats(lfs2_t *lfs2) {
+    memset(&lfs2->stats, 0, sizeof(lfs2->stats));
+    return 0;
 }
@@ -66,6 +66,31 @@ typedef uint32_t lfs2_block_t;
 #define LFS2_ATTR_MAX 1022
 #endif
 
+// Maximum size of a name kept in the path cache, may be redefined. Longer
+// names are still found, but are looked up on disk every time.
+#ifndef LFS2_DCACHE_NAME_MAX
+#define LFS2_DCACHE_NAME_MAX 28
+#endif
+
+// Maximum number of queued files written in one metadata commit, may be
+// redefined. Each file costs ~36 bytes of stack in lfs2_fs_commit.
+#ifndef LFS2_COMMIT_MAX
+#define LFS2_COMMIT_MAX 8
+#endif
+
+// Maximum number of entries decoded in one scan by lfs2_dir_readplus, may
+// be redefined. Each entry costs 6 bytes of stack.
+#ifndef LFS2_READPLUS_MAX
+#define LFS2_READPLUS_MAX 16
+#endif
+
+// Optional geometry fixed at compile time, undefined by default. Defining
+// LFS2_STATIC_READ_SIZE, LFS2_STATIC_PROG_SIZE, LFS2_STATIC_BLOCK_SIZE,
+// LFS2_STATIC_BLOCK_COUNT or LFS2_STATIC_CACHE_SIZE makes littlefs use the
+// constant in place of the matching lfs2_config field, which must still be
+// set to the same value. Alignment and block math then compile to shifts
+// and masks instead of library calls on cores without a hardware divide.
+
 // Possible error codes, these are negative to allow
 // valid positive return values
 enum lfs2_error {
@@ -136,6 +161,7 @@ enum lfs2_open_flags {
     LFS2_F_READING = 0x040000, // File has been read since last flush
     LFS2_F_ERRED   = 0x080000, // An error occured during write
     LFS2_F_INLINE  = 0x100000, // Currently inlined in directory entry
+    LFS2_F_QUEUED  = 0x200000, // Waiting on lfs2_fs_commit
 };
 
 // File seek flags
@@ -145,6 +171,20 @@ enum lfs2_whence_flags {
     LFS2_SEEK_END = 2,   // Seek relative to the end of the file
 };
 
+// Read-back validation of programmed data
+enum lfs2_validate {
+    LFS2_VALIDATE_ALL      = 0, // Compare file data and check metadata crcs
+    LFS2_VALIDATE_METADATA = 1, // Only check metadata crcs
+    LFS2_VALIDATE_NONE     = 2, // Trust the block device's program
+};
+
+// Appends to a partially filled last block of a file
+enum lfs2_append {
+    LFS2_APPEND_COPY    = 0, // Copy the last block to a new block
+    LFS2_APPEND_ERASED  = 1, // Program in place if the rest reads as 0xff
+    LFS2_APPEND_REWRITE = 2, // Program in place, the device can reprogram
+};
+
 
 // Configuration provided during initialization of the littlefs
 struct lfs2_config {
@@ -207,8 +247,8 @@ struct lfs2_config {
     // can track 8 blocks. Must be a multiple of 4.
     lfs2_size_t lookahead_size;
 
-    // Optional statically allocated read buffer. Must be cache_size.
-    // By default lfs2_malloc is used to allocate this buffer.
+    // Optional statically allocated read buffer. Must be cache_size times
+    // rcache_count. By default lfs2_malloc is used to allocate this buffer.
     void *read_buffer;
 
     // Optional statically allocated program buffer. Must be cache_size.
@@ -234,6 +274,96 @@ struct lfs2_config {
     // larger attributes size but must be <= LFS2_ATTR_MAX. Defaults to
     // LFS2_ATTR_MAX when zero.
     lfs2_size_t attr_max;
+
+    // Optional upper limit on files stored inline in their directory's
+    // metadata in bytes. Inline files share metadata blocks with other files,
+    // so small files don't need a block and an erase each. Smaller values
+    // keep fewer files in metadata with less frequent compactions. Must be
+    // <= LFS2_ATTR_MAX, <= cache_size and <= block_size/8, past which files
+    // end up with a metadata pair each. Defaults to that limit when zero.
+    // Stored in superblock and used by later mounts, limited to what their
+    // cache_size can hold.
+    lfs2_size_t inline_max;
+
+    // Optional size of a free-block map in bytes. When nonzero, littlefs
+    // tracks every block on the device in a bitmap that is built with a
+    // single traversal and then kept up to date as blocks are allocated and
+    // freed, instead of rescanning the filesystem each time the lookahead
+    // buffer runs out. The lookahead buffer is not used in this mode. Must be
+    // a multiple of 4 and large enough to hold block_count bits.
+    lfs2_size_t freemap_size;
+
+    // Optional statically allocated free-block map. Must be freemap_size.
+    // By default lfs2_malloc is used to allocate this buffer.
+    void *freemap_buffer;
+
+    // Optional number of lines in the read cache, each of cache_size. More
+    // lines let metadata, CTZ pointers, and inline files stay cached at the
+    // same time instead of evicting each other. The table of lines is
+    // allocated with lfs2_malloc if there is more than one. Must be <= 32.
+    // Defaults to 1 when zero.
+    lfs2_size_t rcache_count;
+
+    // Optional number of entries in the path cache. Each entry remembers
+    // where a directory was found by name, so paths through the same
+    // directories don't need to fetch each directory along the way. The
+    // entries are allocated with lfs2_malloc. Disabled when zero.
+    lfs2_size_t dcache_count;
+
+    // Optional policy for reading back what was programmed, see
+    // enum lfs2_validate. Relaxing this is only safe if the block device
+    // verifies its own programs, otherwise littlefs can't detect bad blocks.
+    // Defaults to LFS2_VALIDATE_ALL when zero.
+    uint32_t validate;
+
+    // Optional number of file caches shared by open files, each of
+    // cache_size. Files opened without their own buffer then only hold a
+    // cache while they are in use. When every cache is taken, the file that
+    // has held its cache the longest is flushed and gives it up. Inline
+    // files with unsynced writes are moved out to a block first. Must be
+    // <= 32. Disabled when zero, so every file allocates its own cache.
+    lfs2_size_t file_cache_count;
+
+    // Optional statically allocated buffer for the shared file caches.
+    // Must be file_cache_count*cache_size. By default lfs2_malloc is used
+    // to allocate this buffer.
+    void *file_cache_buffer;
+
+    // Optional number of free blocks to keep erased ahead of time. The pool
+    // is filled by lfs2_fs_maintain, and new file and metadata blocks are
+    // taken from it before falling back to the allocator and an erase.
+    // Disabled when zero.
+    lfs2_size_t erase_pool_count;
+
+    // Optional statically allocated buffer for the erase pool. Must be
+    // 4*erase_pool_count bytes. By default lfs2_malloc is used to allocate
+    // this buffer.
+    void *erase_pool_buffer;
+
+    // Optional threshold in bytes for compacting metadata pairs in
+    // lfs2_fs_gc. Pairs that have used more than this much of their block
+    // are compacted, so commits no longer need to compact them. Must be
+    // <= block_size. Defaults to block_size - block_size/8 when zero.
+    lfs2_size_t compact_thresh;
+
+    // Optional number of entries in the metadata index. Each entry remembers
+    // a metadata pair's parent and predecessor in the metadata list, so
+    // relocations and orphan repair can find them with a single fetch
+    // instead of scanning every metadata pair. Entries are only hints and
+    // are checked before use. The entries are allocated with lfs2_malloc.
+    // Disabled when zero.
+    lfs2_size_t mindex_count;
+
+    // Optional policy for appending to a file's partially filled last block,
+    // see enum lfs2_append. By default the block is copied to a new block
+    // first. LFS2_APPEND_ERASED programs the rest of the block in place when
+    // the append starts on a prog boundary and everything after it still
+    // reads as erased 0xff bytes. LFS2_APPEND_REWRITE always programs in
+    // place, and is only safe if the device can program data that has
+    // already been programmed without an erase. Files opened more than once,
+    // and files with changes that aren't synced yet, such as a truncate, are
+    // always copied. Defaults to LFS2_APPEND_COPY when zero.
+    uint32_t append;
 };
 
 // File info structure
@@ -251,6 +381,48 @@ struct lfs2_info {
     char name[LFS2_NAME_MAX+1];
 };
 
+// Filesystem statistics structure, counted since mount. Counters are
+// 32-bits and wrap, so compare samples by difference.
+struct lfs2_fsstats {
+    // Number of read, prog, erase, and sync calls into the block device
+    uint32_t read_count;
+    uint32_t prog_count;
+    uint32_t erase_count;
+    uint32_t sync_count;
+
+    // Number of bytes read from and programmed to the block device
+    uint32_t read_bytes;
+    uint32_t prog_bytes;
+
+    // Reads served by the shared read cache, and reads that had to load a
+    // cache line from the block device
+    uint32_t rcache_hits;
+    uint32_t rcache_misses;
+
+    // Programs merged into a program cache already in use, and programs
+    // that had to start a new program cache
+    uint32_t pcache_hits;
+    uint32_t pcache_misses;
+
+    // Path components found in, and missing from, the path cache
+    uint32_t dcache_hits;
+    uint32_t dcache_misses;
+
+    // Parent and predecessor lookups answered by the metadata index, and
+    // lookups that had to scan the metadata list
+    uint32_t mindex_hits;
+    uint32_t mindex_misses;
+
+    // Number of filesystem traversals to refill the lookahead buffer or
+    // rebuild the free-block map
+    uint32_t alloc_scans;
+
+    // Number of metadata pair compactions, and relocations of metadata
+    // pairs or file blocks away from worn out or bad blocks
+    uint32_t compact_count;
+    uint32_t relocate_count;
+};
+
 // Custom attribute structure, used to describe custom attributes
 // committed atomically during file writes.
 struct lfs2_attr {
@@ -265,6 +437,15 @@ struct lfs2_attr {
     lfs2_size_t size;
 };
 
+// Buffer segment for vectored file reads and writes
+struct lfs2_iovec {
+    // Pointer to the segment's data
+    void *buffer;
+
+    // Size of the segment in bytes
+    lfs2_size_t size;
+};
+
 // Optional configuration provided during lfs2_file_opencfg
 struct lfs2_file_config {
     // Optional statically allocated file buffer. Must be cache_size.
@@ -286,6 +467,39 @@ struct lfs2_file_config {
 
     // Number of custom attributes in the list
     lfs2_size_t attr_count;
+
+    // Optional size of an index into the file's CTZ skip-list in bytes.
+    // The index remembers blocks at evenly spaced points in the file as
+    // they are found, so seeks can start from a nearby block instead of
+    // from the end of the file. Each 4 bytes tracks one point. Must be a
+    // multiple of 4. Disabled when zero.
+    lfs2_size_t index_size;
+
+    // Optional statically allocated index buffer. Must be index_size.
+    // By default lfs2_malloc is used to allocate this buffer.
+    void *index_buffer;
+
+    // Optional size of a read-ahead window in bytes. While the file is read
+    // sequentially, the window holds the addresses of the next blocks, so
+    // they are found with one walk of the CTZ skip-list instead of one walk
+    // per block. Reads of at least cache_size also skip the file's cache
+    // and go straight to the buffer. Each 4 bytes holds one block. Must be
+    // a multiple of 4. Disabled when zero.
+    lfs2_size_t readahead_size;
+
+    // Optional statically allocated read-ahead buffer. Must be
+    // readahead_size. By default lfs2_malloc is used to allocate this buffer.
+    void *readahead_buffer;
+
+    // Optional size of a table of blocks reserved by lfs2_file_reserve in
+    // bytes. Each 4 bytes holds one block. Must be a multiple of 4. Only
+    // used with reserve_buffer.
+    lfs2_size_t reserve_size;
+
+    // Optional statically allocated table for reserved blocks. Must be
+    // reserve_size. By default lfs2_malloc is used to allocate this table
+    // when blocks are reserved.
+    void *reserve_buffer;
 };
 
 
@@ -317,6 +531,17 @@ typedef struct lfs2_dir {
 
     lfs2_off_t pos;
     lfs2_block_t head[2];
+
+    // where the offset of the last dir_tell lives, checked against the
+    // pair's commit before a seek trusts it
+    struct lfs2_dcursor {
+        lfs2_block_t pair[2];
+        uint32_t rev;
+        lfs2_off_t off;
+        uint32_t etag;
+        lfs2_off_t pos;
+        uint16_t id;
+    } cursor;
 } lfs2_dir_t;
 
 // littlefs file type
@@ -337,6 +562,27 @@ typedef struct lfs2_file {
     lfs2_off_t off;
     lfs2_cache_t cache;
 
+    struct lfs2_ctzindex {
+        lfs2_block_t head;
+        lfs2_off_t stride;
+        lfs2_size_t count;
+        lfs2_block_t *blocks;
+    } index;
+
+    struct lfs2_readahead {
+        lfs2_block_t head;
+        lfs2_off_t start;
+        lfs2_size_t fill;
+        lfs2_size_t count;
+        lfs2_block_t *blocks;
+    } readahead;
+
+    struct lfs2_reserve {
+        lfs2_size_t off;
+        lfs2_size_t count;
+        lfs2_block_t *blocks;
+    } reserve;
+
     const struct lfs2_file_config *cfg;
 } lfs2_file_t;
 
@@ -347,6 +593,7 @@ typedef struct lfs2_superblock {
     lfs2_size_t name_max;
     lfs2_size_t file_max;
     lfs2_size_t attr_max;
+    lfs2_size_t inline_max;
 } lfs2_superblock_t;
 
 // The littlefs filesystem type
@@ -354,6 +601,38 @@ typedef struct lfs2 {
     lfs2_cache_t rcache;
     lfs2_cache_t pcache;
 
+    struct lfs2_rlines {
+        lfs2_cache_t *lines;
+        lfs2_size_t count;
+        lfs2_size_t hand;
+        uint32_t ref;
+        uint32_t loads;
+    } rlines;
+
+    struct lfs2_dcache {
+        struct lfs2_dentry *entries;
+        lfs2_size_t count;
+        lfs2_size_t hand;
+    } dcache;
+
+    struct lfs2_mindex {
+        struct lfs2_mentry *entries;
+        lfs2_size_t count;
+        lfs2_size_t hand;
+    } mindex;
+
+    struct lfs2_fcache {
+        uint8_t *buffer;
+        lfs2_size_t count;
+        uint32_t free;
+    } fcache;
+
+    struct lfs2_epool {
+        lfs2_block_t *blocks;
+        lfs2_size_t count;
+        lfs2_block_t erased;
+    } epool;
+
     lfs2_block_t root[2];
     struct lfs2_mlist {
         struct lfs2_mlist *next;
@@ -367,12 +646,15 @@ typedef struct lfs2 {
         uint32_t tag;
         lfs2_block_t pair[2];
     } gstate, gpending, gdelta;
+    bool checkpointed;
 
     struct lfs2_free {
         lfs2_block_t off;
         lfs2_block_t size;
         lfs2_block_t i;
         lfs2_block_t ack;
+        lfs2_block_t used;
+        lfs2_block_t pending;
         uint32_t *buffer;
     } free;
 
@@ -380,6 +662,8 @@ typedef struct lfs2 {
     lfs2_size_t name_max;
     lfs2_size_t file_max;
     lfs2_size_t attr_max;
+    lfs2_size_t inline_max;
+    struct lfs2_fsstats stats;
 } lfs2_t;
 
 
@@ -504,6 +788,16 @@ int lfs2_file_close(lfs2_t *lfs2, lfs2_file_t *file);
 // Returns a negative error code on failure.
 int lfs2_file_sync(lfs2_t *lfs2, lfs2_file_t *file);
 
+// Queue a file's changes for the next lfs2_fs_commit
+//
+// Writes out any of the file's data that is still cached, but leaves the
+// file's metadata for lfs2_fs_commit, which writes the metadata of every
+// queued file in the same directory block with a single commit. Syncing or
+// closing a queued file commits it on its own as usual.
+//
+// Returns a negative error code on failure.
+int lfs2_file_queue(lfs2_t *lfs2, lfs2_file_t *file);
+
 // Read data from file
 //
 // Takes a buffer and size indicating where to store the read data.
@@ -520,6 +814,25 @@ lfs2_ssize_t lfs2_file_read(lfs2_t *lfs2, lfs2_file_t *file,
 lfs2_ssize_t lfs2_file_write(lfs2_t *lfs2, lfs2_file_t *file,
         const void *buffer, lfs2_size_t size);
 
+// Read data from file into many buffers
+//
+// Fills each of the iovcnt segments in order, the same as calling read for
+// each segment, but with the checks at the start of a read done only once.
+// Returns the number of bytes read, which is short only at the end of the
+// file, or a negative error code on failure.
+lfs2_ssize_t lfs2_file_readv(lfs2_t *lfs2, lfs2_file_t *file,
+        const struct lfs2_iovec *iov, lfs2_size_t iovcnt);
+
+// Write data to file from many buffers
+//
+// Writes each of the iovcnt segments in order, the same as one write of
+// their concatenation, streaming each segment straight into the file's
+// cache without gathering them first.
+//
+// Returns the number of bytes written, or a negative error code on failure.
+lfs2_ssize_t lfs2_file_writev(lfs2_t *lfs2, lfs2_file_t *file,
+        const struct lfs2_iovec *iov, lfs2_size_t iovcnt);
+
 // Change the position of the file
 //
 // The change in position is determined by the offset and whence flag.
@@ -532,6 +845,16 @@ lfs2_soff_t lfs2_file_seek(lfs2_t *lfs2, lfs2_file_t *file,
 // Returns a negative error code on failure.
 int lfs2_file_truncate(lfs2_t *lfs2, lfs2_file_t *file, lfs2_off_t size);
 
+// Reserves blocks so the file can grow to the specified size
+//
+// The blocks are allocated and erased up front and kept from any other
+// allocation until the file is closed. Writes that extend the file take
+// these blocks without touching the allocator. Reserving less than the
+// file already covers gives the extra blocks back.
+//
+// Returns a negative error code on failure.
+int lfs2_file_reserve(lfs2_t *lfs2, lfs2_file_t *file, lfs2_off_t size);
+
 // Return the position of the file
 //
 // Equivalent to lfs2_file_seek(lfs2, file, 0, LFS2_SEEK_CUR)
@@ -576,6 +899,21 @@ int lfs2_dir_close(lfs2_t *lfs2, lfs2_dir_t *dir);
 // Returns a negative error code on failure.
 int lfs2_dir_read(lfs2_t *lfs2, lfs2_dir_t *dir, struct lfs2_info *info);
 
+// Read many entries in the directory at once
+//
+// Fills out up to count info structures, the same as calling read count
+// times, but decodes all of the entries in a metadata pair with a single
+// scan. If attr_count is non-zero, attrs holds attr_count custom attributes
+// for each entry, so entry i reads into attrs[i*attr_count] onwards with
+// the types and sizes given there. Attributes an entry doesn't have read
+// as zeros. attr_count is limited to 30.
+//
+// Returns the number of entries read, 0 at the end of the directory, or a
+// negative error code on failure.
+lfs2_ssize_t lfs2_dir_readplus(lfs2_t *lfs2, lfs2_dir_t *dir,
+        struct lfs2_info *infos, lfs2_size_t count,
+        const struct lfs2_attr *attrs, lfs2_size_t attr_count);
+
 // Change the position of the directory
 //
 // The new off must be a value previous returned from tell and specifies
@@ -589,6 +927,11 @@ int lfs2_dir_seek(lfs2_t *lfs2, lfs2_dir_t *dir, lfs2_off_t off);
 // The returned offset is only meant to be consumed by seek and may not make
 // sense, but does indicate the current position in the directory iteration.
 //
+// Each directory remembers the metadata pair behind its most recent tell,
+// so seeking that directory back to that offset costs a single fetch as long
+// as nothing has been committed to the pair in the meantime. Otherwise, and
+// after the directory is reopened, seek walks the directory from its start.
+//
 // Returns the position of the directory, or a negative error code on failure.
 lfs2_soff_t lfs2_dir_tell(lfs2_t *lfs2, lfs2_dir_t *dir);
 
@@ -605,9 +948,76 @@ int lfs2_dir_rewind(lfs2_t *lfs2, lfs2_dir_t *dir);
 // Note: Result is best effort. If files share COW structures, the returned
 // size may be larger than the filesystem actually is.
 //
+// The count is cached and kept up to date by the block allocator, so this
+// only traverses the filesystem the first time it's called after mount,
+// after recovering from a power-loss, or after blocks were left behind by
+// relocations or by rewriting data that wasn't synced yet.
+//
 // Returns the number of allocated blocks, or a negative error code on failure.
 lfs2_ssize_t lfs2_fs_size(lfs2_t *lfs2);
 
+// Write a mount checkpoint
+//
+// Stores the root pair, the global state, and the block count next to the
+// superblock. The next mount that finds an intact checkpoint can stop as
+// soon as it reaches the superblock instead of scanning every metadata pair
+// in the filesystem. The checkpoint is dropped by the next change to the
+// metadata, so this is best called right before unmounting.
+//
+// Note: Other littlefs drivers ignore the checkpoint, but they also don't
+// drop it. Don't use checkpoints if the filesystem may be written by a
+// driver that doesn't know about them.
+//
+// Returns a negative error code on failure.
+int lfs2_fs_checkpoint(lfs2_t *lfs2);
+
+// Erase free blocks ahead of time
+//
+// Fills the erase pool with up to budget newly erased blocks, so later
+// writes can skip the erase. This can be called while the system is idle or
+// from a low-priority thread. Blocks in the pool are free, they are only
+// kept from other allocations until they are used or the filesystem is
+// unmounted, and will be used by the allocator when nothing else is left.
+//
+// Returns the number of blocks added to the pool, or a negative error code
+// on failure.
+lfs2_ssize_t lfs2_fs_maintain(lfs2_t *lfs2, lfs2_size_t budget);
+
+// Commit every file queued with lfs2_file_queue
+//
+// Queued files that share a metadata pair are committed together, up to
+// LFS2_COMMIT_MAX at a time, so either all of their changes are on disk
+// or none of them are. Files in different directory blocks are committed
+// one block at a time.
+//
+// Returns a negative error code on failure.
+int lfs2_fs_commit(lfs2_t *lfs2);
+
+// Do work that would otherwise land on later writes
+//
+// Finishes any pending orphan or move cleanup, and compacts metadata pairs
+// that have used more than compact_thresh of their blocks. Nothing on disk
+// changes meaning, so this is safe to call at any time, for example when
+// the system is idle.
+//
+// Returns a negative error code on failure.
+int lfs2_fs_gc(lfs2_t *lfs2);
+
+// Get filesystem statistics
+//
+// Fills out the stats structure with the counters collected since mount.
+// The counters are cheap to keep, so they are always enabled.
+//
+// Returns a negative error code on failure.
+int lfs2_fs_stats(lfs2_t *lfs2, struct lfs2_fsstats *stats);
+
+// Reset filesystem statistics
+//
+// Clears the counters, so lfs2_fs_stats only reports what happened since.
+//
+// Returns a negative error code on failure.
+int lfs2_fs_resetstats(lfs2_t *lfs2);
+
 // Traverse through all blocks in use by the filesystem
 //
 // The provided callback will be called with each block address that is
@@ -0,0 +1,111 @@
+/*
+ * Block device trace for littlefs
+ *
+ * Copyright (c) 2017, Arm Limited. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include "lfs2_trace.h"
+
+
+/// Recording ///
+static uint32_t lfs2_trace_now(lfs2_trace_t *trace) {
+    return trace->clock ? trace->clock() : 0;
+}
+
+static void lfs2_trace_record(lfs2_trace_t *trace, enum lfs2_trace_op op,
+        lfs2_block_t block, lfs2_off_t off, lfs2_size_t size,
+        uint32_t start) {
+    struct lfs2_trace_rec *rec;
+    if (trace->count < trace->size) {
+        rec = &trace->buffer[(trace->head + trace->count) % trace->size];
+        trace->count += 1;
+    } else {
+        // full, overwrite the oldest record
+        rec = &trace->buffer[trace->head];
+        trace->head = (trace->head + 1) % trace->size;
+        trace->lost += 1;
+    }
+
+    rec->time   = lfs2_tole32(start);
+    rec->dur    = lfs2_tole32(lfs2_trace_now(trace) - start);
+    rec->block  = lfs2_tole32(block);
+    rec->off    = lfs2_tole32(off);
+    rec->opsize = lfs2_tole32(((uint32_t)op << 28) | (size & 0x0fffffff));
+}
+
+int lfs2_trace_read(const struct lfs2_config *cfg, lfs2_block_t block,
+        lfs2_off_t off, void *buffer, lfs2_size_t size) {
+    lfs2_trace_t *trace = cfg->context;
+    uint32_t start = lfs2_trace_now(trace);
+    int err = trace->bd.read(&trace->bd, block, off, buffer, size);
+    lfs2_trace_record(trace, LFS2_TRACE_READ, block, off, size, start);
+    return err;
+}
+
+int lfs2_trace_prog(const struct lfs2_config *cfg, lfs2_block_t block,
+        lfs2_off_t off, const void *buffer, lfs2_size_t size) {
+    lfs2_trace_t *trace = cfg->context;
+    uint32_t start = lfs2_trace_now(trace);
+    int err = trace->bd.prog(&trace->bd, block, off, buffer, size);
+    lfs2_trace_record(trace, LFS2_TRACE_PROG, block, off, size, start);
+    return err;
+}
+
+int lfs2_trace_erase(const struct lfs2_config *cfg, lfs2_block_t block) {
+    lfs2_trace_t *trace = cfg->context;
+    uint32_t start = lfs2_trace_now(trace);
+    int err = trace->bd.erase(&trace->bd, block);
+    lfs2_trace_record(trace, LFS2_TRACE_ERASE, block, 0,
+            trace->bd.block_size, start);
+    return err;
+}
+
+int lfs2_trace_sync(const struct lfs2_config *cfg) {
+    lfs2_trace_t *trace = cfg->context;
+    uint32_t start = lfs2_trace_now(trace);
+    int err = trace->bd.sync(&trace->bd);
+    lfs2_trace_record(trace, LFS2_TRACE_SYNC, 0, 0, 0, start);
+    return err;
+}
+
+
+/// Trace management ///
+void lfs2_trace_create(lfs2_trace_t *trace, struct lfs2_config *cfg,
+        struct lfs2_trace_rec *buffer, lfs2_size_t size,
+        uint32_t (*clock)(void)) {
+    LFS2_ASSERT(size > 0);
+    trace->bd = *cfg;
+    trace->clock = clock;
+    trace->buffer = buffer;
+    trace->size = size;
+    trace->head = 0;
+    trace->count = 0;
+    trace->lost = 0;
+
+    cfg->context = trace;
+    cfg->read  = lfs2_trace_read;
+    cfg->prog  = lfs2_trace_prog;
+    cfg->erase = lfs2_trace_erase;
+    cfg->sync  = lfs2_trace_sync;
+}
+
+lfs2_size_t lfs2_trace_take(lfs2_trace_t *trace,
+        struct lfs2_trace_header *header,
+        struct lfs2_trace_rec *recs, lfs2_size_t count) {
+    count = lfs2_min(count, trace->count);
+    for (lfs2_size_t i = 0; i < count; i++) {
+        recs[i] = trace->buffer[trace->head];
+        trace->head = (trace->head + 1) % trace->size;
+    }
+    trace->count -= count;
+
+    header->magic       = lfs2_tole32(LFS2_TRACE_MAGIC);
+    header->version     = lfs2_tole32(LFS2_TRACE_VERSION);
+    header->read_size   = lfs2_tole32(trace->bd.read_size);
+    header->prog_size   = lfs2_tole32(trace->bd.prog_size);
+    header->block_size  = lfs2_tole32(trace->bd.block_size);
+    header->block_count = lfs2_tole32(trace->bd.block_count);
+    header->count       = lfs2_tole32(count);
+    header->lost        = lfs2_tole32(trace->lost);
+    return count;
+}
@@ -0,0 +1,129 @@
+/*
+ * Block device trace for littlefs
+ *
+ * Copyright (c) 2017, Arm Limited. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#ifndef LFS2_TRACE_H
+#define LFS2_TRACE_H
+
+#include "lfs2.h"
+#include "lfs2_util.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+// Trace format version, bumped on any change to the records or header
+#define LFS2_TRACE_VERSION 0x00000001
+
+// "ltrc" in little-endian, first word of a trace header
+#define LFS2_TRACE_MAGIC 0x6372746c
+
+// Traced block device operations
+enum lfs2_trace_op {
+    LFS2_TRACE_READ  = 0,
+    LFS2_TRACE_PROG  = 1,
+    LFS2_TRACE_ERASE = 2,
+    LFS2_TRACE_SYNC  = 3,
+};
+
+// One block device operation, 20 bytes stored little-endian so a run of
+// records can be written out as is. Erase records the block_size and sync
+// records zeros for block, off and size.
+struct lfs2_trace_rec {
+    // Clock ticks when the operation started, and how long it took
+    uint32_t time;
+    uint32_t dur;
+
+    uint32_t block;
+    uint32_t off;
+
+    // Operation in the top 4 bits, size in bytes in the lower 28 bits
+    uint32_t opsize;
+};
+
+// Describes the records that follow it in a trace file, also stored
+// little-endian
+struct lfs2_trace_header {
+    uint32_t magic;
+    uint32_t version;
+
+    // Geometry of the traced block device
+    uint32_t read_size;
+    uint32_t prog_size;
+    uint32_t block_size;
+    uint32_t block_count;
+
+    // Number of records that follow
+    uint32_t count;
+
+    // Records overwritten before they were taken, counted since the trace
+    // was created
+    uint32_t lost;
+};
+
+// Trace state, wraps the block device of an lfs2_config
+typedef struct lfs2_trace {
+    // Config handed to the traced block device
+    struct lfs2_config bd;
+
+    // Clock for timestamps, any unit, may be NULL
+    uint32_t (*clock)(void);
+
+    // Ring buffer of records, the oldest record is at head
+    struct lfs2_trace_rec *buffer;
+    lfs2_size_t size;
+    lfs2_size_t head;
+    lfs2_size_t count;
+    uint32_t lost;
+} lfs2_trace_t;
+
+
+// Start tracing the block device of cfg
+//
+// Saves a copy of cfg to call the block device with, then points the
+// block device callbacks and context of cfg at the trace. The trace keeps
+// the last size records in buffer, older records are overwritten and
+// counted as lost. cfg must be set up before tracing and passed to
+// lfs2_format or lfs2_mount after. To trace again, start from a copy of
+// the untraced cfg.
+void lfs2_trace_create(lfs2_trace_t *trace, struct lfs2_config *cfg,
+        struct lfs2_trace_rec *buffer, lfs2_size_t size,
+        uint32_t (*clock)(void));
+
+// Take up to count of the oldest records out of the trace
+//
+// Fills in header for the records taken, so header and records can be
+// written out together as a trace file. Returns the number of records
+// taken.
+lfs2_size_t lfs2_trace_take(lfs2_trace_t *trace,
+        struct lfs2_trace_header *header,
+        struct lfs2_trace_rec *recs, lfs2_size_t count);
+
+// Block device callbacks that record each operation, the context of the
+// config must be the trace
+int lfs2_trace_read(const struct lfs2_config *cfg, lfs2_block_t block,
+        lfs2_off_t off, void *buffer, lfs2_size_t size);
+int lfs2_trace_prog(const struct lfs2_config *cfg, lfs2_block_t block,
+        lfs2_off_t off, const void *buffer, lfs2_size_t size);
+int lfs2_trace_erase(const struct lfs2_config *cfg, lfs2_block_t block);
+int lfs2_trace_sync(const struct lfs2_config *cfg);
+
+// Decode a record's operation and size
+static inline enum lfs2_trace_op lfs2_trace_op(const struct lfs2_trace_rec *rec) {
+    return (enum lfs2_trace_op)(lfs2_fromle32(rec->opsize) >> 28);
+}
+
+static inline lfs2_size_t lfs2_trace_size(const struct lfs2_trace_rec *rec) {
+    return lfs2_fromle32(rec->opsize) & 0x0fffffff;
+}
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -57,6 +57,24 @@ extern "C"
 #define MBED_LFS2_INTRINSICS     true
 #endif
 
+// Geometry fixed at compile time through the mbed configuration, see
+// LFS2_STATIC_READ_SIZE in lfs2.h
+#if defined(MBED_LFS2_STATIC_READ_SIZE) && !defined(LFS2_STATIC_READ_SIZE)
+#define LFS2_STATIC_READ_SIZE MBED_LFS2_STATIC_READ_SIZE
+#endif
+#if defined(MBED_LFS2_STATIC_PROG_SIZE) && !defined(LFS2_STATIC_PROG_SIZE)
+#define LFS2_STATIC_PROG_SIZE MBED_LFS2_STATIC_PROG_SIZE
+#endif
+#if defined(MBED_LFS2_STATIC_BLOCK_SIZE) && !defined(LFS2_STATIC_BLOCK_SIZE)
+#define LFS2_STATIC_BLOCK_SIZE MBED_LFS2_STATIC_BLOCK_SIZE
+#endif
+#if defined(MBED_LFS2_STATIC_BLOCK_COUNT) && !defined(LFS2_STATIC_BLOCK_COUNT)
+#define LFS2_STATIC_BLOCK_COUNT MBED_LFS2_STATIC_BLOCK_COUNT
+#endif
+#if defined(MBED_LFS2_STATIC_CACHE_SIZE) && !defined(LFS2_STATIC_CACHE_SIZE)
+#define LFS2_STATIC_CACHE_SIZE MBED_LFS2_STATIC_CACHE_SIZE
+#endif
+
 // Logging functions
 #if !defined(LFS2_NO_INFO) && MBED_LFS2_ENABLE_INFO
 #define LFS2_INFO(fmt, ...)  printf("lfs2 info:%d: " fmt "\n", __LINE__, __VA_ARGS__)
@@ -2,6 +2,8 @@
 
 import struct
 import binascii
+import os
+import io
 
 TYPES = {
     (0x700, 0x400): 'splice',
@@ -34,6 +36,18 @@ def typeof(type):
     else:
         return '%02x' % type
 
+def openblock(block):
+    # blocks in a disk image are given as image:block
+    if ':' in block:
+        image, n = block.rsplit(':', 1)
+        with open(os.path.join(os.path.dirname(image), '.config'), 'rb') as file:
+            _, _, block_size, _ = struct.unpack('<LLLL', file.read())
+        with open(image, 'rb') as file:
+            file.seek(int(n, 16) * block_size)
+            return io.BytesIO(file.read(block_size))
+
+    return open(block, 'rb')
+
 def main(*blocks):
     # find most recent block
     file = None
@@ -43,7 +57,7 @@ def main(*blocks):
 
     for block in blocks:
         try:
-            nfile = open(block, 'rb')
+            nfile = openblock(block)
             ndata = nfile.read(4)
             ncrc = binascii.crc32(ndata)
             nrev, = struct.unpack('<I', ndata)
@@ -78,6 +92,10 @@ def main(*blocks):
         except struct.error:
             break
 
+        # stop at erased data, images aren't truncated after the last commit
+        if ntag == 0xffffffff:
+            break
+
         tag ^= ntag
         off += 4
 
@@ -16,7 +16,7 @@ def main():
 
     print 'real_size: %d' % sum(
         os.path.getsize(os.path.join('blocks', f))
-        for f in os.listdir('blocks') if re.match('\d+', f))
+        for f in os.listdir('blocks') if re.match('\d+', f) or f == 'image')
 
     with open('blocks/.stats') as file:
         s = struct.unpack('<QQQ', file.read())
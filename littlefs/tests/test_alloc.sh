@@ -481,5 +481,313 @@ tests/test.py << TEST
     lfs2_unmount(&lfs2) => 0;
 TEST
 
+echo "--- Block count test ---"
+rm -rf blocks
+tests/test.py << TEST
+    lfs2_format(&lfs2, &cfg) => 0;
+
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_fs_size(&lfs2) => 2;
+
+    // the cached count should always match a fresh count after remount
+    lfs2_ssize_t count;
+    size = strlen("blahblahblahblah");
+    memcpy(buffer, "blahblahblahblah", size);
+    lfs2_file_open(&lfs2, &file[0], "counted",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    for (lfs2_size_t i = 0; i < 8*cfg.block_size; i += size) {
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    count = lfs2_fs_size(&lfs2);
+    lfs2_unmount(&lfs2) => 0;
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // rewrite the middle of the file
+    lfs2_file_open(&lfs2, &file[0], "counted", LFS2_O_WRONLY) => 0;
+    lfs2_file_seek(&lfs2, &file[0], 3*cfg.block_size, LFS2_SEEK_SET)
+            => 3*cfg.block_size;
+    lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // shrink the file
+    lfs2_file_open(&lfs2, &file[0], "counted", LFS2_O_WRONLY) => 0;
+    lfs2_file_truncate(&lfs2, &file[0], 2*cfg.block_size) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    count = lfs2_fs_size(&lfs2);
+    lfs2_unmount(&lfs2) => 0;
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // replace it with a rename
+    lfs2_file_open(&lfs2, &file[0], "other",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    for (lfs2_size_t i = 0; i < 4*cfg.block_size; i += size) {
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_rename(&lfs2, "other", "counted") => 0;
+    count = lfs2_fs_size(&lfs2);
+    lfs2_unmount(&lfs2) => 0;
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // and remove everything
+    lfs2_mkdir(&lfs2, "dir") => 0;
+    lfs2_remove(&lfs2, "dir") => 0;
+    lfs2_remove(&lfs2, "counted") => 0;
+    lfs2_fs_size(&lfs2) => 2;
+    lfs2_unmount(&lfs2) => 0;
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_fs_size(&lfs2) => 2;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Block count drift test ---"
+rm -rf blocks
+tests/test.py << TEST
+    // relocate metadata pairs often
+    struct lfs2_config dcfg = cfg;
+    dcfg.block_cycles = 2;
+    lfs2_format(&lfs2, &dcfg) => 0;
+
+    // the cached count should always match a traversal, even when blocks
+    // are left behind without being freed
+    lfs2_mount(&lfs2, &dcfg) => 0;
+    unsigned count;
+    char path[32];
+    size = strlen("blahblahblahblah");
+    memcpy(buffer, "blahblahblahblah", size);
+    for (int i = 0; i < 40; i++) {
+        sprintf(path, "dir%d", i % 4);
+        lfs2_mkdir(&lfs2, path) => 0;
+        sprintf(path, "dir%d/file", i % 4);
+        lfs2_file_open(&lfs2, &file[0], path,
+                LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        if (i % 4 == 3) {
+            for (int j = 0; j < 4; j++) {
+                sprintf(path, "dir%d/file", j);
+                lfs2_remove(&lfs2, path) => 0;
+                sprintf(path, "dir%d", j);
+                lfs2_remove(&lfs2, path) => 0;
+            }
+        }
+    }
+    (lfs2.stats.relocate_count > 0) => 1;
+    count = 0;
+    lfs2_fs_traverse(&lfs2, test_count, &count) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // rewrite parts of a file that aren't synced yet
+    lfs2_file_open(&lfs2, &file[0], "counted",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    for (lfs2_size_t i = 0; i < 4*cfg.block_size; i += size) {
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    }
+    for (int i = 0; i < 4; i++) {
+        lfs2_file_seek(&lfs2, &file[0], i*cfg.block_size, LFS2_SEEK_SET)
+                => i*cfg.block_size;
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+        lfs2_file_seek(&lfs2, &file[0], 0, LFS2_SEEK_END)
+                => 4*cfg.block_size + i*size;
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    }
+    lfs2_file_truncate(&lfs2, &file[0], 2*cfg.block_size) => 0;
+    lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    count = 0;
+    lfs2_fs_traverse(&lfs2, test_count, &count) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // grow a file past the lookahead in one go
+    lfs2_file_open(&lfs2, &file[0], "counted", LFS2_O_WRONLY) => 0;
+    lfs2_file_truncate(&lfs2, &file[0],
+            (8*dcfg.lookahead_size + 16)*cfg.block_size) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    count = 0;
+    lfs2_fs_traverse(&lfs2, test_count, &count) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // replace and remove files that are still open
+    lfs2_file_open(&lfs2, &file[0], "other",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    for (lfs2_size_t i = 0; i < 2*cfg.block_size; i += size) {
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_file_open(&lfs2, &file[0], "counted", LFS2_O_RDONLY) => 0;
+    lfs2_rename(&lfs2, "other", "counted") => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_file_open(&lfs2, &file[0], "counted", LFS2_O_RDONLY) => 0;
+    lfs2_file_open(&lfs2, &file[1], "counted", LFS2_O_WRONLY) => 0;
+    lfs2_file_write(&lfs2, &file[1], buffer, size) => size;
+    lfs2_file_close(&lfs2, &file[1]) => 0;
+    lfs2_remove(&lfs2, "counted") => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    count = 0;
+    lfs2_fs_traverse(&lfs2, test_count, &count) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // and the checkpoint keeps the count across a remount
+    lfs2_file_open(&lfs2, &file[0], "counted",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    for (lfs2_size_t i = 0; i < 2*cfg.block_size; i += size) {
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    }
+    lfs2_file_seek(&lfs2, &file[0], 0, LFS2_SEEK_SET) => 0;
+    lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_fs_checkpoint(&lfs2) => 0;
+    lfs2_ssize_t used = lfs2_fs_size(&lfs2);
+    lfs2_unmount(&lfs2) => 0;
+    lfs2_mount(&lfs2, &dcfg) => 0;
+    lfs2_fs_size(&lfs2) => used;
+    count = 0;
+    lfs2_fs_traverse(&lfs2, test_count, &count) => 0;
+    count => used;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Reserve test ---"
+rm -rf blocks
+tests/test.py << TEST
+    lfs2_format(&lfs2, &cfg) => 0;
+
+    lfs2_mount(&lfs2, &cfg) => 0;
+    size = strlen("blahblahblahblah");
+    memcpy(buffer, "blahblahblahblah", size);
+    lfs2_file_open(&lfs2, &file[0], "reserved",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    lfs2_file_reserve(&lfs2, &file[0], 8*cfg.block_size) => 0;
+    lfs2_ssize_t reserved = lfs2_fs_size(&lfs2);
+    (reserved > 2+8) => 1;
+
+    // writes take the reserved blocks without the allocator
+    uint64_t erases = bd.stats.erase_count;
+    uint32_t scans = lfs2.stats.alloc_scans;
+    for (lfs2_size_t i = 0; i < 8*cfg.block_size; i += size) {
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    }
+    bd.stats.erase_count => erases;
+    lfs2.stats.alloc_scans => scans;
+    lfs2_fs_size(&lfs2) => reserved;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_ssize_t count = lfs2_fs_size(&lfs2);
+    lfs2_unmount(&lfs2) => 0;
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // unused blocks are given back on close
+    lfs2_file_open(&lfs2, &file[0], "reserved",
+            LFS2_O_WRONLY | LFS2_O_APPEND) => 0;
+    lfs2_file_reserve(&lfs2, &file[0], 16*cfg.block_size) => 0;
+    (lfs2_fs_size(&lfs2) > count) => 1;
+    for (lfs2_size_t i = 0; i < cfg.block_size; i += size) {
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    count = lfs2_fs_size(&lfs2);
+    lfs2_unmount(&lfs2) => 0;
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // or when reserving less
+    lfs2_file_open(&lfs2, &file[0], "reserved",
+            LFS2_O_WRONLY | LFS2_O_APPEND) => 0;
+    lfs2_file_reserve(&lfs2, &file[0], 16*cfg.block_size) => 0;
+    (lfs2_fs_size(&lfs2) > count) => 1;
+    lfs2_file_reserve(&lfs2, &file[0], 0) => 0;
+    lfs2_fs_size(&lfs2) => count;
+
+    // reserving more than fits takes nothing
+    lfs2_file_reserve(&lfs2, &file[0],
+            cfg.block_count*cfg.block_size) => LFS2_ERR_NOSPC;
+    lfs2_fs_size(&lfs2) => count;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_fs_size(&lfs2) => count;
+    lfs2_file_open(&lfs2, &file[0], "reserved", LFS2_O_RDONLY) => 0;
+    lfs2_file_size(&lfs2, &file[0]) => 9*cfg.block_size;
+    for (lfs2_size_t i = 0; i < 9*cfg.block_size; i += size) {
+        lfs2_file_read(&lfs2, &file[0], rbuffer, size) => size;
+        memcmp(rbuffer, buffer, size) => 0;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Erase pool test ---"
+rm -rf blocks
+tests/test.py << TEST
+    struct lfs2_config pcfg = cfg;
+    pcfg.erase_pool_count = 8;
+    lfs2_format(&lfs2, &pcfg) => 0;
+
+    // trace the block device to see which blocks are erased
+    static struct lfs2_trace_rec recs[8192];
+    struct lfs2_trace_header header;
+    lfs2_trace_t trace;
+    lfs2_trace_create(&trace, &pcfg, recs, 8192, NULL);
+
+    lfs2_mount(&lfs2, &pcfg) => 0;
+    lfs2_fs_maintain(&lfs2, 4) => 4;
+    lfs2_fs_maintain(&lfs2, 8) => 4;
+    lfs2_fs_maintain(&lfs2, 8) => 0;
+    lfs2_fs_size(&lfs2) => 2;
+
+    // new blocks come from the pool without an erase, metadata may still
+    // need erasing when a single commit fills a block
+    lfs2_block_t pooled[8];
+    memcpy(pooled, lfs2.epool.blocks, sizeof(pooled));
+    lfs2_trace_take(&trace, &header, recs, 8192);
+    uint32_t lost = header.lost;
+    size = strlen("blahblahblahblah");
+    memcpy(buffer, "blahblahblahblah", size);
+    lfs2_file_open(&lfs2, &file[0], "pooled",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    for (lfs2_size_t i = 0; i < 3*cfg.block_size; i += size) {
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    }
+    lfs2_size_t count = lfs2_trace_take(&trace, &header, recs, 8192);
+    header.lost => lost;
+    for (lfs2_size_t i = 0; i < count; i++) {
+        for (int j = 0; j < 8; j++) {
+            (lfs2_trace_op(&recs[i]) == LFS2_TRACE_ERASE &&
+                lfs2_fromle32(recs[i].block) == pooled[j]) => 0;
+        }
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+
+    (lfs2_fs_maintain(&lfs2, 8) > 0) => 1;
+    lfs2.epool.count => 8;
+    lfs2_mkdir(&lfs2, "pooldir") => 0;
+    lfs2_file_open(&lfs2, &file[0], "pooldir/pooled",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_ssize_t used = lfs2_fs_size(&lfs2);
+    lfs2_unmount(&lfs2) => 0;
+
+    lfs2_mount(&lfs2, &pcfg) => 0;
+    lfs2_fs_size(&lfs2) => used;
+    lfs2_file_open(&lfs2, &file[0], "pooled", LFS2_O_RDONLY) => 0;
+    for (lfs2_size_t i = 0; i < 3*cfg.block_size; i += size) {
+        lfs2_file_read(&lfs2, &file[0], rbuffer, size) => size;
+        memcmp(rbuffer, buffer, size) => 0;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_file_open(&lfs2, &file[0], "pooldir/pooled", LFS2_O_RDONLY) => 0;
+    lfs2_file_read(&lfs2, &file[0], rbuffer, size) => size;
+    memcmp(rbuffer, buffer, size) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
 echo "--- Results ---"
 tests/stats.py
@@ -0,0 +1,87 @@
+#!/bin/bash
+set -eu
+
+echo "=== Checkpoint tests ==="
+rm -rf blocks
+tests/test.py << TEST
+    lfs2_format(&lfs2, &cfg) => 0;
+TEST
+
+echo "--- Checkpoint mount ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    for (int i = 0; i < 10; i++) {
+        sprintf((char*)buffer, "dir%d", i);
+        lfs2_mkdir(&lfs2, (char*)buffer) => 0;
+        sprintf((char*)buffer, "dir%d/file", i);
+        lfs2_file_open(&lfs2, &file[0], (char*)buffer,
+                LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+        lfs2_file_write(&lfs2, &file[0], buffer, strlen((char*)buffer))
+                => strlen((char*)buffer);
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+    }
+    lfs2_ssize_t before = lfs2_fs_size(&lfs2);
+    lfs2_unmount(&lfs2) => 0;
+
+    uint64_t reads = bd.stats.read_count;
+    lfs2_mount(&lfs2, &cfg) => 0;
+    uint64_t scanned = bd.stats.read_count - reads;
+    lfs2_fs_checkpoint(&lfs2) => 0;
+    lfs2_fs_checkpoint(&lfs2) => 0;
+    lfs2_unmount(&lfs2) => 0;
+
+    reads = bd.stats.read_count;
+    lfs2_mount(&lfs2, &cfg) => 0;
+    uint64_t checkpointed = bd.stats.read_count - reads;
+    (checkpointed < scanned) => 1;
+    lfs2_fs_size(&lfs2) => before;
+    for (int i = 0; i < 10; i++) {
+        sprintf((char*)buffer, "dir%d/file", i);
+        lfs2_stat(&lfs2, (char*)buffer, &info) => 0;
+        info.type => LFS2_TYPE_REG;
+        info.size => strlen((char*)buffer);
+    }
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Checkpoint invalidation ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_fs_checkpoint(&lfs2) => 0;
+    lfs2_file_open(&lfs2, &file[0], "dir3/file",
+            LFS2_O_WRONLY | LFS2_O_APPEND) => 0;
+    memset(buffer, 'c', 2*LFS2_BLOCK_SIZE);
+    lfs2_file_write(&lfs2, &file[0], buffer, 2*LFS2_BLOCK_SIZE)
+            => 2*LFS2_BLOCK_SIZE;
+    lfs2_fs_checkpoint(&lfs2) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_ssize_t before = lfs2_fs_size(&lfs2);
+    lfs2_unmount(&lfs2) => 0;
+
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_stat(&lfs2, "dir3/file", &info) => 0;
+    info.size => strlen("dir3/file") + 2*LFS2_BLOCK_SIZE;
+    lfs2_fs_size(&lfs2) => before;
+    unsigned count = 0;
+    lfs2_fs_traverse(&lfs2, test_count, &count) => 0;
+    count => before;
+
+    lfs2_fs_checkpoint(&lfs2) => 0;
+    lfs2_setattr(&lfs2, "/", 'A', "aaaa", 4) => 0;
+    lfs2_remove(&lfs2, "dir9/file") => 0;
+    lfs2_remove(&lfs2, "dir9") => 0;
+    lfs2_fs_checkpoint(&lfs2) => 0;
+    lfs2_rename(&lfs2, "dir8", "dir9") => 0;
+    lfs2_unmount(&lfs2) => 0;
+
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_getattr(&lfs2, "/", 'A', buffer, 4) => 4;
+    memcmp(buffer, "aaaa", 4) => 0;
+    lfs2_stat(&lfs2, "dir8", &info) => LFS2_ERR_NOENT;
+    lfs2_stat(&lfs2, "dir9/file", &info) => 0;
+    info.size => strlen("dir8/file");
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Results ---"
+tests/stats.py
@@ -480,5 +480,152 @@ tests/test.py << TEST
     lfs2_unmount(&lfs2) => 0;
 TEST
 
+echo "--- Metadata gc ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_mkdir(&lfs2, "gc") => 0;
+    for (int i = 0; i < 16; i++) {
+        lfs2_file_open(&lfs2, &file[0], "gc/rewritten",
+                LFS2_O_WRONLY | LFS2_O_CREAT | LFS2_O_TRUNC) => 0;
+        sprintf((char*)buffer, "rewrite %d", i);
+        size = strlen((char*)buffer);
+        lfs2_file_write(&lfs2, &file[0], buffer, size) => size;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+    }
+    lfs2_unmount(&lfs2) => 0;
+
+    // with a low threshold every pair that can shrink is compacted
+    struct lfs2_config gcfg = cfg;
+    gcfg.compact_thresh = 32;
+    lfs2_mount(&lfs2, &gcfg) => 0;
+    uint64_t erases = bd.stats.erase_count;
+    uint32_t compacts = lfs2.stats.compact_count;
+    lfs2_fs_gc(&lfs2) => 0;
+    if (cfg.prog_size < cfg.block_size) {
+        (bd.stats.erase_count > erases) => 1;
+        (lfs2.stats.compact_count > compacts) => 1;
+    } else {
+        // when a single commit fills a block there is nothing to reclaim
+        bd.stats.erase_count => erases;
+        lfs2.stats.compact_count => compacts;
+    }
+    lfs2_unmount(&lfs2) => 0;
+
+    // freshly compacted pairs are under the default threshold
+    lfs2_mount(&lfs2, &cfg) => 0;
+    erases = bd.stats.erase_count;
+    lfs2_fs_gc(&lfs2) => 0;
+    bd.stats.erase_count => erases;
+    lfs2_file_open(&lfs2, &file[0], "gc/rewritten", LFS2_O_RDONLY) => 0;
+    lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer)) => size;
+    memcmp(rbuffer, buffer, size) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Bulk directory read ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_mkdir(&lfs2, "plus") => 0;
+    for (int i = 0; i < $LARGESIZE; i++) {
+        sprintf((char*)buffer, "plus/entry%03d", i);
+        if (i % 5 == 0) {
+            lfs2_mkdir(&lfs2, (char*)buffer) => 0;
+            continue;
+        }
+
+        lfs2_file_open(&lfs2, &file[0], (char*)buffer,
+                LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+        memset(wbuffer, 'c', 7*i);
+        lfs2_file_write(&lfs2, &file[0], wbuffer, 7*i) => 7*i;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        if (i % 3 == 0) {
+            uint32_t v = i;
+            lfs2_setattr(&lfs2, (char*)buffer, 'A', &v, sizeof(v)) => 0;
+        }
+    }
+    for (int i = 0; i < $LARGESIZE; i += 7) {
+        sprintf((char*)buffer, "plus/entry%03d", i);
+        lfs2_remove(&lfs2, (char*)buffer) => 0;
+    }
+    lfs2_unmount(&lfs2) => 0;
+TEST
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    struct lfs2_info infos[5];
+    uint32_t as[5];
+    uint8_t bs[5][8];
+    struct lfs2_attr attrs[5][2];
+    for (int i = 0; i < 5; i++) {
+        attrs[i][0] = (struct lfs2_attr){'A', &as[i], sizeof(as[i])};
+        attrs[i][1] = (struct lfs2_attr){'B', bs[i], sizeof(bs[i])};
+    }
+
+    lfs2_dir_open(&lfs2, &dir[0], "plus") => 0;
+    lfs2_dir_open(&lfs2, &dir[1], "plus") => 0;
+    int count = 0;
+    while (true) {
+        lfs2_ssize_t n = lfs2_dir_readplus(&lfs2, &dir[0],
+                infos, 5, &attrs[0][0], 2);
+        n >= 0 => 1;
+        if (n == 0) {
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            lfs2_dir_read(&lfs2, &dir[1], &info) => 1;
+            strcmp(infos[i].name, info.name) => 0;
+            infos[i].type => info.type;
+            infos[i].size => info.size;
+            for (int j = 0; j < 8; j++) {
+                bs[i][j] => 0;
+            }
+            if (info.name[0] == '.') {
+                as[i] => 0;
+                continue;
+            }
+
+            int e = atoi(&info.name[5]);
+            (e % 7 != 0) => 1;
+            info.type => (e % 5 == 0) ? LFS2_TYPE_DIR : LFS2_TYPE_REG;
+            info.size => (e % 5 == 0) ? 0 : 7*e;
+            as[i] => (e % 3 == 0 && e % 5 != 0) ? e : 0;
+            count += 1;
+        }
+
+        lfs2_dir_tell(&lfs2, &dir[0]) => lfs2_dir_tell(&lfs2, &dir[1]);
+    }
+    lfs2_dir_read(&lfs2, &dir[1], &info) => 0;
+    count => $LARGESIZE - ($LARGESIZE+6)/7;
+
+    // reading without attrs, and once more past the end
+    lfs2_dir_readplus(&lfs2, &dir[0], infos, 5, NULL, 0) => 0;
+    lfs2_dir_rewind(&lfs2, &dir[0]) => 0;
+    lfs2_dir_readplus(&lfs2, &dir[0], infos, 3, NULL, 0) => 3;
+    strcmp(infos[0].name, ".") => 0;
+    strcmp(infos[1].name, "..") => 0;
+    strcmp(infos[2].name, "entry001") => 0;
+    lfs2_dir_close(&lfs2, &dir[1]) => 0;
+    lfs2_dir_close(&lfs2, &dir[0]) => 0;
+
+    // one scan per pair reads less than a lookup per entry
+    uint64_t reads = bd.stats.read_count;
+    lfs2_dir_open(&lfs2, &dir[0], "plus") => 0;
+    while (lfs2_dir_readplus(&lfs2, &dir[0], infos, 5, &attrs[0][0], 2) > 0);
+    lfs2_dir_close(&lfs2, &dir[0]) => 0;
+    uint64_t plus = bd.stats.read_count - reads;
+
+    reads = bd.stats.read_count;
+    lfs2_dir_open(&lfs2, &dir[0], "plus") => 0;
+    while (lfs2_dir_read(&lfs2, &dir[0], &info) > 0) {
+        sprintf((char*)buffer, "plus/%s", info.name);
+        lfs2_getattr(&lfs2, (char*)buffer, 'A', &as[0], sizeof(as[0]));
+        lfs2_getattr(&lfs2, (char*)buffer, 'B', bs[0], sizeof(bs[0]));
+    }
+    lfs2_dir_close(&lfs2, &dir[0]) => 0;
+    (plus < bd.stats.read_count - reads) => 1;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
 echo "--- Results ---"
 tests/stats.py
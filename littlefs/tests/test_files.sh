@@ -154,5 +154,637 @@ tests/test.py << TEST
     lfs2_unmount(&lfs2) => 0;
 TEST
 
+echo "--- Validation policy test ---"
+tests/test.py << TEST
+    struct lfs2_config vcfg = cfg;
+    uint64_t reads[3];
+    for (int v = LFS2_VALIDATE_ALL; v <= LFS2_VALIDATE_NONE; v++) {
+        vcfg.validate = v;
+        lfs2_format(&lfs2, &vcfg) => 0;
+        uint64_t before = bd.stats.read_count;
+        lfs2_mount(&lfs2, &vcfg) => 0;
+        lfs2_file_open(&lfs2, &file[0], "validate",
+                LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+        for (int i = 0; i < 16; i++) {
+            memset(wbuffer, 'a'+i, sizeof(wbuffer));
+            lfs2_file_write(&lfs2, &file[0], wbuffer, sizeof(wbuffer))
+                    => sizeof(wbuffer);
+        }
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+        reads[v] = bd.stats.read_count - before;
+
+        lfs2_mount(&lfs2, &cfg) => 0;
+        lfs2_file_open(&lfs2, &file[0], "validate", LFS2_O_RDONLY) => 0;
+        for (int i = 0; i < 16; i++) {
+            lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer))
+                    => sizeof(rbuffer);
+            memset(wbuffer, 'a'+i, sizeof(wbuffer));
+            memcmp(rbuffer, wbuffer, sizeof(rbuffer)) => 0;
+        }
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+    }
+    (reads[LFS2_VALIDATE_METADATA] < reads[LFS2_VALIDATE_ALL]) => 1;
+    (reads[LFS2_VALIDATE_NONE] < reads[LFS2_VALIDATE_METADATA]) => 1;
+TEST
+
+echo "--- Shared file cache test ---"
+tests/test.py << TEST
+    struct lfs2_config fcfg = cfg;
+    fcfg.file_cache_count = 2;
+    lfs2_mount(&lfs2, &fcfg) => 0;
+    for (int j = 0; j < 4; j++) {
+        sprintf((char*)buffer, "shared%d", j);
+        lfs2_file_open(&lfs2, &file[j], (char*)buffer,
+                LFS2_O_WRONLY | LFS2_O_CREAT | LFS2_O_TRUNC) => 0;
+    }
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) {
+            memset(wbuffer, 'a'+i+j, sizeof(wbuffer));
+            lfs2_file_write(&lfs2, &file[j], wbuffer, sizeof(wbuffer))
+                    => sizeof(wbuffer);
+        }
+    }
+    for (int j = 0; j < 4; j++) {
+        lfs2_file_close(&lfs2, &file[j]) => 0;
+    }
+
+    for (int j = 0; j < 4; j++) {
+        sprintf((char*)buffer, "shared%d", j);
+        lfs2_file_open(&lfs2, &file[j], (char*)buffer, LFS2_O_RDONLY) => 0;
+    }
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) {
+            lfs2_file_read(&lfs2, &file[j], rbuffer, sizeof(rbuffer))
+                    => sizeof(rbuffer);
+            memset(wbuffer, 'a'+i+j, sizeof(wbuffer));
+            memcmp(rbuffer, wbuffer, sizeof(rbuffer)) => 0;
+        }
+    }
+    for (int j = 0; j < 4; j++) {
+        lfs2_file_close(&lfs2, &file[j]) => 0;
+    }
+
+    // dirty inline files move out of their cache when it's taken
+    for (int j = 0; j < 3; j++) {
+        sprintf((char*)buffer, "inline%d", j);
+        lfs2_file_open(&lfs2, &file[j], (char*)buffer,
+                LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    }
+    lfs2_file_write(&lfs2, &file[0], "hello", 5) => 5;
+    lfs2_file_write(&lfs2, &file[1], "world", 5) => 5;
+    lfs2_file_write(&lfs2, &file[2], "again", 5) => 5;
+    lfs2_file_write(&lfs2, &file[0], "!", 1) => 1;
+    lfs2_file_sync(&lfs2, &file[1]) => 0;
+    lfs2_file_write(&lfs2, &file[2], "?", 1) => 1;
+    lfs2_file_seek(&lfs2, &file[2], 0, LFS2_SEEK_SET) => 0;
+    for (int j = 0; j < 3; j++) {
+        lfs2_file_close(&lfs2, &file[j]) => 0;
+    }
+    lfs2_unmount(&lfs2) => 0;
+
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_file_open(&lfs2, &file[0], "inline0", LFS2_O_RDONLY) => 0;
+    lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer)) => 6;
+    memcmp(rbuffer, "hello!", 6) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_file_open(&lfs2, &file[0], "inline1", LFS2_O_RDONLY) => 0;
+    lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer)) => 5;
+    memcmp(rbuffer, "world", 5) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_file_open(&lfs2, &file[0], "inline2", LFS2_O_RDONLY) => 0;
+    lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer)) => 6;
+    memcmp(rbuffer, "again?", 6) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Queued commit test ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_mkdir(&lfs2, "queued") => 0;
+    uint64_t progs[2];
+    for (int k = 0; k < 2; k++) {
+        for (int j = 0; j < 4; j++) {
+            sprintf((char*)buffer, "queued/config%d", j);
+            lfs2_file_open(&lfs2, &file[j], (char*)buffer,
+                    LFS2_O_WRONLY | LFS2_O_CREAT | LFS2_O_TRUNC) => 0;
+            sprintf((char*)buffer, "config %d version %d", j, k);
+            size = strlen((char*)buffer);
+            lfs2_file_write(&lfs2, &file[j], buffer, size) => size;
+        }
+
+        uint64_t before = bd.stats.prog_count;
+        if (k == 0) {
+            for (int j = 0; j < 4; j++) {
+                lfs2_file_sync(&lfs2, &file[j]) => 0;
+            }
+        } else {
+            for (int j = 0; j < 4; j++) {
+                lfs2_file_queue(&lfs2, &file[j]) => 0;
+            }
+            lfs2_fs_commit(&lfs2) => 0;
+        }
+        progs[k] = bd.stats.prog_count - before;
+
+        for (int j = 0; j < 4; j++) {
+            lfs2_file_close(&lfs2, &file[j]) => 0;
+        }
+    }
+    (progs[1] < progs[0]) => 1;
+
+    // nothing queued is on disk until committed
+    for (int j = 0; j < 4; j++) {
+        sprintf((char*)buffer, "queued/config%d", j);
+        lfs2_file_open(&lfs2, &file[j], (char*)buffer,
+                LFS2_O_WRONLY | LFS2_O_TRUNC) => 0;
+        lfs2_file_write(&lfs2, &file[j], "lost", 4) => 4;
+        lfs2_file_queue(&lfs2, &file[j]) => 0;
+    }
+    lfs2_unmount(&lfs2) => 0;
+
+    lfs2_mount(&lfs2, &cfg) => 0;
+    for (int j = 0; j < 4; j++) {
+        sprintf((char*)buffer, "queued/config%d", j);
+        lfs2_file_open(&lfs2, &file[0], (char*)buffer, LFS2_O_RDONLY) => 0;
+        sprintf((char*)buffer, "config %d version %d", j, 1);
+        size = strlen((char*)buffer);
+        lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer)) => size;
+        memcmp(rbuffer, buffer, size) => 0;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+    }
+
+    // files in other directories and large files commit too
+    lfs2_file_open(&lfs2, &file[0], "queued/config0",
+            LFS2_O_WRONLY | LFS2_O_TRUNC) => 0;
+    lfs2_file_open(&lfs2, &file[1], "queued/large",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    lfs2_file_open(&lfs2, &file[2], "rootconfig",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    lfs2_file_write(&lfs2, &file[0], "small", 5) => 5;
+    memset(wbuffer, 'q', sizeof(wbuffer));
+    for (int i = 0; i < 4; i++) {
+        lfs2_file_write(&lfs2, &file[1], wbuffer, sizeof(wbuffer))
+                => sizeof(wbuffer);
+    }
+    lfs2_file_write(&lfs2, &file[2], "root", 4) => 4;
+    for (int j = 0; j < 3; j++) {
+        lfs2_file_queue(&lfs2, &file[j]) => 0;
+    }
+    lfs2_fs_commit(&lfs2) => 0;
+    lfs2_fs_commit(&lfs2) => 0;
+    lfs2_unmount(&lfs2) => 0;
+
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_stat(&lfs2, "queued/config0", &info) => 0;
+    info.size => 5;
+    lfs2_stat(&lfs2, "queued/large", &info) => 0;
+    info.size => 4*sizeof(wbuffer);
+    lfs2_stat(&lfs2, "rootconfig", &info) => 0;
+    info.size => 4;
+    lfs2_file_open(&lfs2, &file[0], "queued/large", LFS2_O_RDONLY) => 0;
+    for (int i = 0; i < 4; i++) {
+        lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer))
+                => sizeof(rbuffer);
+        memcmp(rbuffer, wbuffer, sizeof(rbuffer)) => 0;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Queued split test ---"
+tests/test.py << TEST
+    // creating the later files splits the directory under the earlier ones
+    lfs2_file_t files[LFS2_COMMIT_MAX];
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_mkdir(&lfs2, "split") => 0;
+    for (int j = 0; j < LFS2_COMMIT_MAX; j++) {
+        sprintf((char*)buffer, "split/%064d", j);
+        lfs2_file_open(&lfs2, &files[j], (char*)buffer,
+                LFS2_O_WRONLY | LFS2_O_CREAT | LFS2_O_EXCL) => 0;
+        sprintf((char*)wbuffer, "file %d", j);
+        size = strlen((char*)wbuffer);
+        lfs2_file_write(&lfs2, &files[j], wbuffer, size) => size;
+    }
+    for (int j = 0; j < LFS2_COMMIT_MAX; j++) {
+        lfs2_file_queue(&lfs2, &files[j]) => 0;
+    }
+    lfs2_fs_commit(&lfs2) => 0;
+    for (int j = 0; j < LFS2_COMMIT_MAX; j++) {
+        lfs2_file_close(&lfs2, &files[j]) => 0;
+    }
+    lfs2_unmount(&lfs2) => 0;
+
+    lfs2_mount(&lfs2, &cfg) => 0;
+    for (int j = 0; j < LFS2_COMMIT_MAX; j++) {
+        sprintf((char*)buffer, "split/%064d", j);
+        lfs2_file_open(&lfs2, &file[0], (char*)buffer, LFS2_O_RDONLY) => 0;
+        sprintf((char*)wbuffer, "file %d", j);
+        size = strlen((char*)wbuffer);
+        lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer)) => size;
+        memcmp(rbuffer, wbuffer, size) => 0;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+    }
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Filesystem stats test ---"
+tests/test.py << TEST
+    uint64_t reads = bd.stats.read_count;
+    uint64_t progs = bd.stats.prog_count;
+    uint64_t erases = bd.stats.erase_count;
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_file_open(&lfs2, &file[0], "stats",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    for (int i = 0; i < 16; i++) {
+        memset(wbuffer, 'a'+i, sizeof(wbuffer));
+        lfs2_file_write(&lfs2, &file[0], wbuffer, sizeof(wbuffer))
+                => sizeof(wbuffer);
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_file_open(&lfs2, &file[0], "stats", LFS2_O_RDONLY) => 0;
+    for (int i = 0; i < 16; i++) {
+        lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer))
+                => sizeof(rbuffer);
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+
+    struct lfs2_fsstats stats;
+    lfs2_fs_stats(&lfs2, &stats) => 0;
+    stats.read_count => bd.stats.read_count - reads;
+    stats.prog_count => bd.stats.prog_count - progs;
+    stats.erase_count => bd.stats.erase_count - erases;
+    (stats.sync_count > 0) => 1;
+    (stats.read_bytes >= 16*sizeof(rbuffer)) => 1;
+    (stats.prog_bytes >= 16*sizeof(wbuffer)) => 1;
+    (stats.rcache_misses > 0) => 1;
+    (stats.pcache_misses > 0) => 1;
+
+    lfs2_fs_resetstats(&lfs2) => 0;
+    lfs2_fs_stats(&lfs2, &stats) => 0;
+    stats.read_count => 0;
+    stats.prog_count => 0;
+    stats.rcache_misses => 0;
+    lfs2_stat(&lfs2, "stats", &info) => 0;
+    lfs2_fs_stats(&lfs2, &stats) => 0;
+    (stats.read_count > 0) => 1;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Vectored I/O test ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    uint8_t header[4] = {'h', 'd', 'r', ':'};
+    uint8_t trailer[2] = {';', '\\n'};
+    lfs2_file_open(&lfs2, &file[0], "vectored",
+            LFS2_O_WRONLY | LFS2_O_CREAT | LFS2_O_APPEND) => 0;
+    for (int i = 0; i < 64; i++) {
+        sprintf((char*)buffer, "record %02d", i);
+        struct lfs2_iovec iov[3] = {
+            {header, sizeof(header)},
+            {buffer, strlen((char*)buffer)},
+            {trailer, sizeof(trailer)},
+        };
+        lfs2_file_writev(&lfs2, &file[0], iov, 3) => 15;
+    }
+    lfs2_file_writev(&lfs2, &file[0], NULL, 0) => 0;
+    lfs2_file_readv(&lfs2, &file[0], NULL, 0) => LFS2_ERR_BADF;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+
+    // same bytes as the records written one piece at a time
+    lfs2_file_open(&lfs2, &file[0], "vectored", LFS2_O_RDONLY) => 0;
+    lfs2_file_size(&lfs2, &file[0]) => 64*15;
+    for (int i = 0; i < 64; i++) {
+        sprintf((char*)wbuffer, "hdr:record %02d;\\n", i);
+        lfs2_file_read(&lfs2, &file[0], rbuffer, 15) => 15;
+        memcmp(rbuffer, wbuffer, 15) => 0;
+    }
+    struct lfs2_iovec iov[2] = {{buffer, 15}, {rbuffer, 15}};
+    lfs2_file_writev(&lfs2, &file[0], iov, 2) => LFS2_ERR_BADF;
+
+    // split reads across segments and stop short at eof
+    lfs2_file_seek(&lfs2, &file[0], 4, LFS2_SEEK_SET) => 4;
+    iov[0].size = 9;
+    iov[1].size = 2;
+    lfs2_file_readv(&lfs2, &file[0], iov, 2) => 11;
+    memcmp(buffer, "record 00", 9) => 0;
+    memcmp(rbuffer, ";\\n", 2) => 0;
+    lfs2_file_seek(&lfs2, &file[0], 63*15, LFS2_SEEK_SET) => 63*15;
+    iov[0].size = 10;
+    iov[1].size = 10;
+    lfs2_file_readv(&lfs2, &file[0], iov, 2) => 15;
+    memcmp(buffer, "hdr:record", 10) => 0;
+    memcmp(rbuffer, " 63;\\n", 5) => 0;
+    lfs2_file_readv(&lfs2, &file[0], iov, 2) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Append in place test ---"
+tests/test.py << TEST
+    struct lfs2_config acfg = cfg;
+    lfs2_size_t n = lfs2_min(cfg.prog_size, 64);
+    uint64_t erases[3];
+    for (int a = LFS2_APPEND_COPY; a <= LFS2_APPEND_REWRITE; a++) {
+        acfg.append = a;
+        lfs2_format(&lfs2, &acfg) => 0;
+        lfs2_mount(&lfs2, &acfg) => 0;
+        lfs2_file_open(&lfs2, &file[0], "log",
+                LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+        memset(wbuffer, 'a', 128);
+        lfs2_file_write(&lfs2, &file[0], wbuffer, 128) => 128;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+
+        // reopen and append a prog at a time like a logger would
+        uint64_t before = bd.stats.erase_count;
+        for (int i = 0; i < 8; i++) {
+            lfs2_file_open(&lfs2, &file[0], "log",
+                    LFS2_O_WRONLY | LFS2_O_APPEND) => 0;
+            memset(wbuffer, 'b'+i, n);
+            lfs2_file_write(&lfs2, &file[0], wbuffer, n) => n;
+            lfs2_file_close(&lfs2, &file[0]) => 0;
+        }
+        erases[a] = bd.stats.erase_count - before;
+
+        // appending after a truncate starts where the file now ends, the
+        // data left behind is copied around, found not to be erased, or
+        // with LFS2_APPEND_REWRITE programmed over
+        lfs2_file_open(&lfs2, &file[0], "log", LFS2_O_WRONLY) => 0;
+        lfs2_file_truncate(&lfs2, &file[0], 128+3*n) => 0;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_file_open(&lfs2, &file[0], "log",
+                LFS2_O_WRONLY | LFS2_O_APPEND) => 0;
+        lfs2_file_write(&lfs2, &file[0], "xyz", 3) => 3;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+
+        lfs2_mount(&lfs2, &cfg) => 0;
+        lfs2_file_open(&lfs2, &file[0], "log", LFS2_O_RDONLY) => 0;
+        lfs2_file_size(&lfs2, &file[0]) => 128+3*n+3;
+        lfs2_file_read(&lfs2, &file[0], rbuffer, 128) => 128;
+        memset(wbuffer, 'a', 128);
+        memcmp(rbuffer, wbuffer, 128) => 0;
+        for (int i = 0; i < 3; i++) {
+            lfs2_file_read(&lfs2, &file[0], rbuffer, n) => n;
+            memset(wbuffer, 'b'+i, n);
+            memcmp(rbuffer, wbuffer, n) => 0;
+        }
+        lfs2_file_read(&lfs2, &file[0], rbuffer, 4) => 3;
+        memcmp(rbuffer, "xyz", 3) => 0;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+    }
+
+    // only appends inside a block can skip the copy
+    if (n == cfg.prog_size && 128+8*n <= cfg.block_size) {
+        (erases[LFS2_APPEND_REWRITE] < erases[LFS2_APPEND_COPY]) => 1;
+        // only an image reads back unprogrammed bytes as erased
+        (erases[LFS2_APPEND_ERASED] < erases[LFS2_APPEND_COPY])
+                => (bd.image != NULL);
+    }
+TEST
+
+echo "--- Append in place after truncate test ---"
+tests/test.py << TEST
+    // appending after an unsynced truncate must not program over the data
+    // the last commit still points to
+    struct lfs2_config acfg = cfg;
+    for (int a = LFS2_APPEND_COPY; a <= LFS2_APPEND_REWRITE; a++) {
+        for (int erased = 0; erased < 2; erased++) {
+            acfg.append = a;
+            lfs2_format(&lfs2, &acfg) => 0;
+            lfs2_mount(&lfs2, &acfg) => 0;
+            lfs2_file_open(&lfs2, &file[0], "log",
+                    LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+            for (int i = 0; i < 800; i++) {
+                wbuffer[i] = (erased) ? 0xff : 'a' + i%26;
+            }
+            lfs2_file_write(&lfs2, &file[0], wbuffer, 800) => 800;
+            lfs2_file_close(&lfs2, &file[0]) => 0;
+
+            lfs2_file_open(&lfs2, &file[0], "log", LFS2_O_WRONLY) => 0;
+            lfs2_file_truncate(&lfs2, &file[0], 636) => 0;
+            lfs2_file_seek(&lfs2, &file[0], 636, LFS2_SEEK_SET) => 636;
+            memset(rbuffer, 'x', 64);
+            lfs2_file_write(&lfs2, &file[0], rbuffer, 64) => 64;
+            // seeking flushes the data out, then power is lost
+            lfs2_file_seek(&lfs2, &file[0], 0, LFS2_SEEK_SET) => 0;
+            lfs2_unmount(&lfs2) => 0;
+
+            lfs2_mount(&lfs2, &acfg) => 0;
+            lfs2_file_open(&lfs2, &file[0], "log", LFS2_O_RDONLY) => 0;
+            lfs2_file_read(&lfs2, &file[0], rbuffer, 1024) => 800;
+            memcmp(rbuffer, wbuffer, 800) => 0;
+            lfs2_file_close(&lfs2, &file[0]) => 0;
+            lfs2_unmount(&lfs2) => 0;
+        }
+    }
+TEST
+
+echo "--- Inline threshold test ---"
+tests/test.py << TEST
+    // a cache that could hold larger inline files, geometry fixed at
+    // compile time can't be changed here
+    struct lfs2_config icfg = cfg;
+    if (!TEST_STATIC_GEOMETRY) {
+        icfg.cache_size = lfs2_max(cfg.cache_size, cfg.block_size/4);
+    }
+    struct lfs2_config mcfg = icfg;
+    lfs2_size_t limit = lfs2_min(icfg.cache_size, cfg.block_size/8);
+    lfs2_size_t thresholds[2] = {limit/2, limit};
+    char path[32];
+    for (int j = 0; j < 2; j++) {
+        icfg.inline_max = thresholds[j];
+        lfs2_format(&lfs2, &icfg) => 0;
+
+        // later mounts pick the threshold up from the superblock
+        lfs2_mount(&lfs2, &mcfg) => 0;
+        lfs2_ssize_t before = lfs2_fs_size(&lfs2);
+        memset(wbuffer, 'i', sizeof(wbuffer));
+        lfs2_file_open(&lfs2, &file[0], "inline",
+                LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+        lfs2_file_write(&lfs2, &file[0], wbuffer, thresholds[j])
+                => thresholds[j];
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_fs_size(&lfs2) => before;
+
+        // one byte more and the file needs a block of its own
+        lfs2_file_open(&lfs2, &file[0], "outline",
+                LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+        lfs2_file_write(&lfs2, &file[0], wbuffer, thresholds[j]+1)
+                => thresholds[j]+1;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_fs_size(&lfs2) => before+1;
+
+        // many files at the threshold use fewer blocks inline than out of
+        // line, even with the splits they cause
+        before = lfs2_fs_size(&lfs2);
+        for (int i = 0; i < 50; i++) {
+            sprintf(path, "inline%03d", i);
+            lfs2_file_open(&lfs2, &file[0], path,
+                    LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+            lfs2_file_write(&lfs2, &file[0], wbuffer, thresholds[j])
+                    => thresholds[j];
+            lfs2_file_close(&lfs2, &file[0]) => 0;
+        }
+        lfs2_ssize_t inlined = lfs2_fs_size(&lfs2) - before;
+
+        before = lfs2_fs_size(&lfs2);
+        for (int i = 0; i < 50; i++) {
+            sprintf(path, "outline%03d", i);
+            lfs2_file_open(&lfs2, &file[0], path,
+                    LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+            lfs2_file_write(&lfs2, &file[0], wbuffer, thresholds[j]+1)
+                    => thresholds[j]+1;
+            lfs2_file_close(&lfs2, &file[0]) => 0;
+        }
+        lfs2_ssize_t outlined = lfs2_fs_size(&lfs2) - before;
+        (inlined < outlined) => 1;
+        lfs2_unmount(&lfs2) => 0;
+
+        lfs2_mount(&lfs2, &mcfg) => 0;
+        lfs2_file_open(&lfs2, &file[0], "inline", LFS2_O_RDONLY) => 0;
+        lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer))
+                => thresholds[j];
+        memcmp(rbuffer, wbuffer, thresholds[j]) => 0;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+    }
+TEST
+
+echo "--- Small cache inline read test ---"
+tests/test.py << TEST
+    // inline files written with a large cache are still readable with a
+    // smaller one, geometry fixed at compile time can't be changed here
+    struct lfs2_config ccfg = cfg;
+    ccfg.cache_size = 1024;
+    ccfg.block_size = lfs2_max(cfg.block_size, 4096);
+    ccfg.block_count = cfg.block_count / (ccfg.block_size / cfg.block_size);
+    ccfg.inline_max = 300;
+    struct lfs2_config scfg = ccfg;
+    scfg.cache_size = lfs2_max(128, lfs2_max(cfg.read_size, cfg.prog_size));
+    scfg.inline_max = 0;
+    if (!TEST_STATIC_GEOMETRY) {
+        lfs2_format(&lfs2, &ccfg) => 0;
+        lfs2_mount(&lfs2, &ccfg) => 0;
+        for (int i = 0; i < 300; i++) {
+            wbuffer[i] = 'a' + i%26;
+        }
+        lfs2_file_open(&lfs2, &file[0], "inline",
+                LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+        lfs2_file_write(&lfs2, &file[0], wbuffer, 300) => 300;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+
+        lfs2_mount(&lfs2, &scfg) => 0;
+        lfs2_file_open(&lfs2, &file[0], "inline", LFS2_O_RDONLY) => 0;
+        lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer)) => 300;
+        memcmp(rbuffer, wbuffer, 300) => 0;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+    }
+
+    // writing into a file that no longer fits moves all of it out of its
+    // metadata
+    if (!TEST_STATIC_GEOMETRY && scfg.cache_size < 300) {
+        lfs2_mount(&lfs2, &scfg) => 0;
+        lfs2_file_open(&lfs2, &file[0], "inline", LFS2_O_WRONLY) => 0;
+        lfs2_file_write(&lfs2, &file[0], "A", 1) => 1;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+
+        lfs2_mount(&lfs2, &scfg) => 0;
+        wbuffer[0] = 'A';
+        lfs2_file_open(&lfs2, &file[0], "inline", LFS2_O_RDONLY) => 0;
+        lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer)) => 300;
+        memcmp(rbuffer, wbuffer, 300) => 0;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+    }
+TEST
+
+echo "--- Large cache inline test ---"
+tests/test.py << TEST
+    // a tag's size can't hold a cache_size of 1024, geometry fixed at
+    // compile time can't be changed here
+    struct lfs2_config ccfg = cfg;
+    ccfg.cache_size = 1024;
+    ccfg.block_size = lfs2_max(cfg.block_size, 1024);
+    ccfg.block_count = cfg.block_count / (ccfg.block_size / cfg.block_size);
+    for (int j = 0; j < 2 && !TEST_STATIC_GEOMETRY; j++) {
+        // with and without shared file caches
+        ccfg.file_cache_count = j;
+        lfs2_format(&lfs2, &ccfg) => 0;
+        lfs2_mount(&lfs2, &ccfg) => 0;
+        memset(wbuffer, 'c', 64);
+        lfs2_file_open(&lfs2, &file[0], "inline",
+                LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+        lfs2_file_write(&lfs2, &file[0], wbuffer, 64) => 64;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+
+        lfs2_mount(&lfs2, &ccfg) => 0;
+        lfs2_file_open(&lfs2, &file[0], "inline", LFS2_O_RDONLY) => 0;
+        lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer)) => 64;
+        memcmp(rbuffer, wbuffer, 64) => 0;
+        lfs2_file_close(&lfs2, &file[0]) => 0;
+        lfs2_unmount(&lfs2) => 0;
+    }
+TEST
+
+echo "--- Block device trace test ---"
+tests/test.py << TEST
+    // every block device operation is recorded in order
+    static struct lfs2_trace_rec recs[8192];
+    struct lfs2_trace_header header;
+    lfs2_trace_t trace;
+    struct lfs2_config tcfg = cfg;
+    lfs2_trace_create(&trace, &tcfg, recs, 8192, NULL);
+
+    lfs2_emubd_t before = bd;
+    lfs2_mount(&lfs2, &tcfg) => 0;
+    lfs2_file_open(&lfs2, &file[0], "traced",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    memset(wbuffer, 't', sizeof(wbuffer));
+    lfs2_file_write(&lfs2, &file[0], wbuffer, sizeof(wbuffer))
+            => sizeof(wbuffer);
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+
+    static struct lfs2_trace_rec taken[8192];
+    lfs2_size_t count = lfs2_trace_take(&trace, &header, taken, 8192);
+    header.magic => LFS2_TRACE_MAGIC;
+    header.block_size => cfg.block_size;
+    header.count => count;
+    header.lost => 0;
+
+    uint64_t counts[4] = {0};
+    uint64_t progged = 0;
+    for (lfs2_size_t i = 0; i < count; i++) {
+        counts[lfs2_trace_op(&taken[i])] += 1;
+        if (lfs2_trace_op(&taken[i]) == LFS2_TRACE_PROG) {
+            progged += lfs2_trace_size(&taken[i]);
+        }
+    }
+    counts[LFS2_TRACE_READ] => bd.stats.read_count - before.stats.read_count;
+    counts[LFS2_TRACE_PROG] => bd.stats.prog_count - before.stats.prog_count;
+    counts[LFS2_TRACE_ERASE]
+            => bd.stats.erase_count - before.stats.erase_count;
+    (counts[LFS2_TRACE_SYNC] > 0) => 1;
+    (progged >= sizeof(wbuffer)) => 1;
+    lfs2_trace_take(&trace, &header, taken, 8192) => 0;
+
+    // a full trace keeps the newest records, mounting only reads, and
+    // reads both blocks of the superblock pair at least
+    tcfg = cfg;
+    lfs2_trace_create(&trace, &tcfg, recs, 1, NULL);
+    lfs2_mount(&lfs2, &tcfg) => 0;
+    lfs2_unmount(&lfs2) => 0;
+    lfs2_trace_take(&trace, &header, taken, 8192) => 1;
+    (header.lost > 0) => 1;
+    lfs2_trace_op(&taken[0]) => LFS2_TRACE_READ;
+TEST
+
 echo "--- Results ---"
 tests/stats.py
@@ -0,0 +1,78 @@
+#!/bin/bash
+set -eu
+
+echo "=== Image tests ==="
+rm -rf blocks image.src image image256
+make --no-print-directory -s mkimage
+
+# files on both sides of every cache_size and inline threshold below
+mkdir -p image.src/dir/nested
+letter=a
+for size in 16 100 200 300 512 600 5000; do
+    head -c $size /dev/zero | tr '\0' $letter > image.src/file$size
+    head -c $size /dev/zero | tr '\0' $letter > image.src/dir/nested/file$size
+    letter=$(echo $letter | tr 'a-y' 'b-z')
+done
+
+echo "--- Build images ---"
+mkdir -p image image256
+tools/mkimage -b 4096 -c 80 -p 16 image.src image/image
+tools/mkimage -b 4096 -c 80 -p 16 -C 256 image.src image256/image
+
+echo "--- Mount images with device caches ---"
+tests/test.py << TEST
+    // mount the images like a device with a smaller cache would
+    const char *images[2] = {"image", "image256"};
+    const lfs2_size_t sizes[7] = {16, 100, 200, 300, 512, 600, 5000};
+    const lfs2_size_t caches[2] = {256, 128};
+    lfs2_emubd_t ibd;
+    struct lfs2_config icfg = cfg;
+    icfg.context = &ibd;
+    icfg.read_size = 16;
+    icfg.prog_size = 16;
+    icfg.block_size = 4096;
+    icfg.block_count = 80;
+    icfg.inline_max = 0;
+    char path[64];
+    for (int i = 0; i < 2; i++) {
+        for (int c = 0; c < 2; c++) {
+            icfg.cache_size = caches[c];
+            lfs2_emubd_createimage(&icfg, images[i]) => 0;
+            fprintf(stderr, "mount %d %d\n", i, c);
+            lfs2_mount(&lfs2, &icfg) => 0;
+            for (int j = 0; j < 14; j++) {
+                sprintf(path, "%sfile%"PRIu32, (j < 7) ? "" : "dir/nested/",
+                        sizes[j%7]);
+                fprintf(stderr, "%s\n", path);
+                lfs2_file_open(&lfs2, &file[0], path, LFS2_O_RDONLY) => 0;
+                lfs2_size_t total = 0;
+                while (true) {
+                    lfs2_ssize_t res = lfs2_file_read(&lfs2, &file[0],
+                            rbuffer, sizeof(rbuffer));
+                    (res >= 0) => 1;
+                    if (res == 0) {
+                        break;
+                    }
+
+                    for (lfs2_ssize_t k = 0; k < res; k++) {
+                        rbuffer[k] => 'a' + j%7;
+                    }
+                    total += res;
+                }
+                total => sizes[j%7];
+                lfs2_file_close(&lfs2, &file[0]) => 0;
+            }
+
+            // and the device can keep writing to them, the write leaves
+            // the file as it was for the next mount
+            lfs2_file_open(&lfs2, &file[0], "file300", LFS2_O_WRONLY) => 0;
+            lfs2_file_write(&lfs2, &file[0], "d", 1) => 1;
+            lfs2_file_close(&lfs2, &file[0]) => 0;
+            lfs2_unmount(&lfs2) => 0;
+            lfs2_emubd_destroy(&icfg);
+        }
+    }
+TEST
+
+echo "--- Results ---"
+tests/stats.py
@@ -41,5 +41,60 @@ tests/test.py << TEST
     lfs2_unmount(&lfs2) => 0;
 TEST
 
+echo "--- Indexed relocation test ---"
+tests/test.py << TEST
+    uint64_t reads[2];
+    uint32_t relocations[2];
+    for (int k = 0; k < 2; k++) {
+        struct lfs2_config icfg = cfg;
+        icfg.block_cycles = 2;
+        icfg.mindex_count = (k == 0) ? 0 : 32;
+        lfs2_format(&lfs2, &icfg) => 0;
+        lfs2_mount(&lfs2, &icfg) => 0;
+        for (int i = 0; i < 16; i++) {
+            sprintf((char*)buffer, "dir%02d", i);
+            lfs2_mkdir(&lfs2, (char*)buffer) => 0;
+            sprintf((char*)buffer, "dir%02d/sub", i);
+            lfs2_mkdir(&lfs2, (char*)buffer) => 0;
+        }
+
+        uint64_t before = bd.stats.read_count;
+        uint32_t relocated = lfs2.stats.relocate_count;
+        for (int j = 0; j < 32; j++) {
+            for (int i = 0; i < 16; i++) {
+                sprintf((char*)buffer, "dir%02d/sub/file", i);
+                lfs2_file_open(&lfs2, &file[0], (char*)buffer,
+                        LFS2_O_WRONLY | LFS2_O_CREAT | LFS2_O_TRUNC) => 0;
+                sprintf((char*)wbuffer, "round %d of %d", j, i);
+                size = strlen((char*)wbuffer);
+                lfs2_file_write(&lfs2, &file[0], wbuffer, size) => size;
+                lfs2_file_close(&lfs2, &file[0]) => 0;
+            }
+        }
+        reads[k] = bd.stats.read_count - before;
+        relocations[k] = lfs2.stats.relocate_count - relocated;
+        if (k == 1) {
+            (lfs2.stats.mindex_hits > 0) => 1;
+        }
+        lfs2_unmount(&lfs2) => 0;
+
+        // everything is still where it belongs
+        lfs2_mount(&lfs2, &cfg) => 0;
+        for (int i = 0; i < 16; i++) {
+            sprintf((char*)buffer, "dir%02d/sub/file", i);
+            lfs2_file_open(&lfs2, &file[0], (char*)buffer,
+                    LFS2_O_RDONLY) => 0;
+            sprintf((char*)wbuffer, "round %d of %d", 31, i);
+            size = strlen((char*)wbuffer);
+            lfs2_file_read(&lfs2, &file[0], rbuffer, sizeof(rbuffer)) => size;
+            memcmp(rbuffer, wbuffer, size) => 0;
+            lfs2_file_close(&lfs2, &file[0]) => 0;
+        }
+        lfs2_unmount(&lfs2) => 0;
+    }
+    (relocations[0] > 0) => 1;
+    (reads[1] < reads[0]) => 1;
+TEST
+
 echo "--- Results ---"
 tests/stats.py
@@ -165,5 +165,53 @@ tests/test.py << TEST
     lfs2_unmount(&lfs2) => 0;
 TEST
 
+echo "--- Cached path test ---"
+tests/test.py << TEST
+    struct lfs2_config dcfg = cfg;
+    dcfg.dcache_count = 4;
+    lfs2_mount(&lfs2, &dcfg) => 0;
+    lfs2_mkdir(&lfs2, "cache") => 0;
+    lfs2_mkdir(&lfs2, "cache/tea") => 0;
+    lfs2_mkdir(&lfs2, "cache/tea/sencha") => 0;
+    lfs2_file_open(&lfs2, &file[0], "cache/tea/sencha/leaf",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+
+    for (int i = 0; i < 3; i++) {
+        lfs2_stat(&lfs2, "cache/tea/sencha/leaf", &info) => 0;
+        info.type => LFS2_TYPE_REG;
+    }
+    (lfs2.stats.dcache_hits > 0) => 1;
+    lfs2_stat(&lfs2, "cache/tea/sencha", &info) => 0;
+    info.type => LFS2_TYPE_DIR;
+    lfs2_stat(&lfs2, "cache/tea/../tea/./sencha/leaf", &info) => 0;
+    info.type => LFS2_TYPE_REG;
+    lfs2_stat(&lfs2, "cache/tea/sencha/leaf/..", &info) => 0;
+    info.type => LFS2_TYPE_DIR;
+
+    lfs2_rename(&lfs2, "cache/tea", "cache/coffee") => 0;
+    lfs2_stat(&lfs2, "cache/tea/sencha/leaf", &info) => LFS2_ERR_NOENT;
+    lfs2_stat(&lfs2, "cache/coffee/sencha/leaf", &info) => 0;
+
+    lfs2_remove(&lfs2, "cache/coffee/sencha/leaf") => 0;
+    lfs2_remove(&lfs2, "cache/coffee/sencha") => 0;
+    lfs2_stat(&lfs2, "cache/coffee/sencha/leaf", &info) => LFS2_ERR_NOENT;
+    lfs2_mkdir(&lfs2, "cache/coffee/sencha") => 0;
+    lfs2_file_open(&lfs2, &file[0], "cache/coffee/sencha/bean",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_stat(&lfs2, "cache/coffee/sencha/leaf", &info) => LFS2_ERR_NOENT;
+    lfs2_stat(&lfs2, "cache/coffee/sencha/bean", &info) => 0;
+
+    memset(buffer, 'w', LFS2_DCACHE_NAME_MAX+1);
+    buffer[LFS2_DCACHE_NAME_MAX+1] = '\0';
+    lfs2_mkdir(&lfs2, (char*)buffer) => 0;
+    strcat((char*)buffer, "/tea");
+    lfs2_mkdir(&lfs2, (char*)buffer) => 0;
+    lfs2_stat(&lfs2, (char*)buffer, &info) => 0;
+    info.type => LFS2_TYPE_DIR;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
 echo "--- Results ---"
 tests/stats.py
@@ -357,5 +357,284 @@ tests/test.py << TEST
     lfs2_unmount(&lfs2) => 0;
 TEST
 
+echo "--- Indexed file seek ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_file_open(&lfs2, &file[0], "hello/indexed",
+            LFS2_O_WRONLY | LFS2_O_CREAT) => 0;
+    lfs2_size_t records = 64*cfg.block_size / 16;
+    for (lfs2_size_t i = 0; i < records; i++) {
+        sprintf((char*)buffer, "record%09d", i);
+        lfs2_file_write(&lfs2, &file[0], buffer, 16) => 16;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+
+    uint32_t index[8];
+    struct lfs2_file_config indexcfg = {
+        .index_size = sizeof(index),
+        .index_buffer = index,
+    };
+    lfs2_file_opencfg(&lfs2, &file[0], "hello/indexed",
+            LFS2_O_RDWR, &indexcfg) => 0;
+
+    uint32_t prng = 42;
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 100; i++) {
+            prng = 1103515245*prng + 12345;
+            lfs2_size_t r = (prng >> 8) % records;
+            lfs2_file_seek(&lfs2, &file[0], 16*r, LFS2_SEEK_SET) => 16*r;
+            lfs2_file_read(&lfs2, &file[0], buffer, 16) => 16;
+            sprintf((char*)wbuffer, "record%09d", r);
+            memcmp(buffer, wbuffer, 16) => 0;
+        }
+
+        // rewriting the middle of the file changes the skip-list
+        lfs2_size_t r = records/2;
+        lfs2_file_seek(&lfs2, &file[0], 16*r, LFS2_SEEK_SET) => 16*r;
+        sprintf((char*)buffer, "record%09d", r);
+        lfs2_file_write(&lfs2, &file[0], buffer, 16) => 16;
+        lfs2_file_sync(&lfs2, &file[0]) => 0;
+    }
+
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Indexed file reused head ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    uint32_t index[8];
+    struct lfs2_file_config indexcfg = {
+        .index_size = sizeof(index),
+        .index_buffer = index,
+    };
+    lfs2_file_opencfg(&lfs2, &file[0], "hello/reused",
+            LFS2_O_RDWR | LFS2_O_CREAT, &indexcfg) => 0;
+    lfs2_size_t records = 4*cfg.block_size / 16;
+    for (lfs2_size_t i = 0; i < records/2; i++) {
+        sprintf((char*)buffer, "%04d record%04d", 0, i);
+        lfs2_file_write(&lfs2, &file[0], buffer, 16) => 16;
+    }
+    lfs2_file_sync(&lfs2, &file[0]) => 0;
+    lfs2_file_seek(&lfs2, &file[0], 0, LFS2_SEEK_SET) => 0;
+    lfs2_file_read(&lfs2, &file[0], buffer, 16) => 16;
+
+    // rewriting from the start doesn't look at the old skip-list, keep
+    // going until the freed head comes back with more blocks behind it
+    lfs2_block_t head = file[0].ctz.head;
+    int j = 0;
+    do {
+        j += 1;
+        lfs2_file_open(&lfs2, &file[1], "hello/spacer",
+                LFS2_O_WRONLY | LFS2_O_CREAT | LFS2_O_TRUNC) => 0;
+        memset(wbuffer, 's', 16);
+        for (lfs2_size_t i = 0; i < (j % 3)*cfg.block_size / 16; i++) {
+            lfs2_file_write(&lfs2, &file[1], wbuffer, 16) => 16;
+        }
+        lfs2_file_close(&lfs2, &file[1]) => 0;
+
+        lfs2_file_seek(&lfs2, &file[0], 0, LFS2_SEEK_SET) => 0;
+        for (lfs2_size_t i = 0; i < records; i++) {
+            sprintf((char*)buffer, "%04d record%04d", j, i);
+            lfs2_file_write(&lfs2, &file[0], buffer, 16) => 16;
+        }
+        lfs2_file_sync(&lfs2, &file[0]) => 0;
+    } while (file[0].ctz.head != head && j < 4*cfg.block_count);
+
+    for (lfs2_size_t i = 0; i < records; i++) {
+        lfs2_size_t r = records-1 - i;
+        lfs2_file_seek(&lfs2, &file[0], 16*r, LFS2_SEEK_SET) => 16*r;
+        lfs2_file_read(&lfs2, &file[0], buffer, 16) => 16;
+        sprintf((char*)wbuffer, "%04d record%04d", j, r);
+        memcmp(buffer, wbuffer, 16) => 0;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Read-ahead file read ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_size_t records = 64*cfg.block_size / 16;
+    uint32_t window[8];
+    struct lfs2_file_config streamcfg = {
+        .readahead_size = sizeof(window),
+        .readahead_buffer = window,
+    };
+
+    uint64_t reads = bd.stats.read_count;
+    lfs2_file_open(&lfs2, &file[0], "hello/indexed", LFS2_O_RDONLY) => 0;
+    for (lfs2_size_t i = 0; i < records; i++) {
+        lfs2_file_read(&lfs2, &file[0], buffer, 16) => 16;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    uint64_t plain = bd.stats.read_count - reads;
+
+    reads = bd.stats.read_count;
+    lfs2_file_opencfg(&lfs2, &file[0], "hello/indexed",
+            LFS2_O_RDONLY, &streamcfg) => 0;
+    for (lfs2_size_t i = 0; i < records; i++) {
+        lfs2_file_read(&lfs2, &file[0], buffer, 16) => 16;
+        sprintf((char*)wbuffer, "record%09d", i);
+        memcmp(buffer, wbuffer, 16) => 0;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    uint64_t streamed = bd.stats.read_count - reads;
+    (streamed < plain) => 1;
+
+    // large reads, seeks, and writes in the middle of a stream
+    lfs2_file_opencfg(&lfs2, &file[0], "hello/indexed",
+            LFS2_O_RDWR, &streamcfg) => 0;
+    for (lfs2_size_t i = 0; i < records; i += 64) {
+        if (i == 2*64) {
+            lfs2_file_seek(&lfs2, &file[0], 16*(records-64),
+                    LFS2_SEEK_SET) => 16*(records-64);
+            lfs2_file_read(&lfs2, &file[0], rbuffer, 1024) => 1024;
+            sprintf((char*)wbuffer, "record%09d", records-64);
+            memcmp(rbuffer, wbuffer, 16) => 0;
+            lfs2_file_seek(&lfs2, &file[0], 16*i, LFS2_SEEK_SET) => 16*i;
+        } else if (i == 8*64) {
+            sprintf((char*)wbuffer, "record%09d", i);
+            lfs2_file_write(&lfs2, &file[0], wbuffer, 16) => 16;
+            lfs2_file_seek(&lfs2, &file[0], 16*i, LFS2_SEEK_SET) => 16*i;
+        }
+
+        lfs2_file_read(&lfs2, &file[0], rbuffer, 1024) => 1024;
+        for (lfs2_size_t j = 0; j < 64; j++) {
+            sprintf((char*)wbuffer, "record%09d", i+j);
+            memcmp(&rbuffer[16*j], wbuffer, 16) => 0;
+        }
+    }
+    lfs2_file_read(&lfs2, &file[0], rbuffer, 16) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Read-ahead reused head ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    uint32_t window[8];
+    struct lfs2_file_config streamcfg = {
+        .readahead_size = sizeof(window),
+        .readahead_buffer = window,
+    };
+    lfs2_file_opencfg(&lfs2, &file[0], "hello/streamed",
+            LFS2_O_RDWR | LFS2_O_CREAT, &streamcfg) => 0;
+    lfs2_size_t records = 4*cfg.block_size / 16;
+    for (lfs2_size_t i = 0; i < records/2; i++) {
+        sprintf((char*)buffer, "%04d record%04d", 0, i);
+        lfs2_file_write(&lfs2, &file[0], buffer, 16) => 16;
+    }
+    lfs2_file_sync(&lfs2, &file[0]) => 0;
+    lfs2_file_seek(&lfs2, &file[0], 0, LFS2_SEEK_SET) => 0;
+    for (lfs2_size_t i = 0; i < records/2; i++) {
+        lfs2_file_read(&lfs2, &file[0], buffer, 16) => 16;
+    }
+
+    // rewriting from the start doesn't look at the old skip-list, keep
+    // going until the freed head comes back with more blocks behind it
+    lfs2_block_t head = file[0].ctz.head;
+    int j = 0;
+    do {
+        j += 1;
+        lfs2_file_open(&lfs2, &file[1], "hello/spacer",
+                LFS2_O_WRONLY | LFS2_O_CREAT | LFS2_O_TRUNC) => 0;
+        memset(wbuffer, 's', 16);
+        for (lfs2_size_t i = 0; i < (j % 3)*cfg.block_size / 16; i++) {
+            lfs2_file_write(&lfs2, &file[1], wbuffer, 16) => 16;
+        }
+        lfs2_file_close(&lfs2, &file[1]) => 0;
+
+        lfs2_file_seek(&lfs2, &file[0], 0, LFS2_SEEK_SET) => 0;
+        for (lfs2_size_t i = 0; i < records; i++) {
+            sprintf((char*)buffer, "%04d record%04d", j, i);
+            lfs2_file_write(&lfs2, &file[0], buffer, 16) => 16;
+        }
+        lfs2_file_sync(&lfs2, &file[0]) => 0;
+    } while (file[0].ctz.head != head && j < 4*cfg.block_count);
+
+    lfs2_file_seek(&lfs2, &file[0], 0, LFS2_SEEK_SET) => 0;
+    for (lfs2_size_t i = 0; i < records; i++) {
+        lfs2_file_read(&lfs2, &file[0], buffer, 16) => 16;
+        sprintf((char*)wbuffer, "%04d record%04d", j, i);
+        memcmp(buffer, wbuffer, 16) => 0;
+    }
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
+echo "--- Cursor dir seek ---"
+tests/test.py << TEST
+    // a low threshold lets gc compact the pairs below
+    struct lfs2_config gcfg = cfg;
+    gcfg.compact_thresh = 32;
+    lfs2_mount(&lfs2, &gcfg) => 0;
+    lfs2_dir_open(&lfs2, &dir[0], "hello") => 0;
+    for (int i = 0; i < 2+$MEDIUMSIZE; i++) {
+        lfs2_dir_read(&lfs2, &dir[0], &info) => 1;
+    }
+    lfs2_soff_t pos = lfs2_dir_tell(&lfs2, &dir[0]);
+    lfs2_dir_read(&lfs2, &dir[0], &info) => 1;
+    char name[LFS2_NAME_MAX+1];
+    strcpy(name, info.name);
+
+    // a tell in another dir leaves our cursor alone
+    lfs2_dir_open(&lfs2, &dir[1], "/") => 0;
+    lfs2_dir_read(&lfs2, &dir[1], &info) => 1;
+    lfs2_dir_read(&lfs2, &dir[1], &info) => 1;
+    lfs2_dir_tell(&lfs2, &dir[1]) => 2;
+
+    // resume from the cursor
+    lfs2_dir_rewind(&lfs2, &dir[0]) => 0;
+    uint64_t reads = bd.stats.read_count;
+    lfs2_dir_seek(&lfs2, &dir[0], pos) => 0;
+    uint64_t cursor = bd.stats.read_count - reads;
+    lfs2_dir_read(&lfs2, &dir[0], &info) => 1;
+    strcmp(info.name, name) => 0;
+    lfs2_dir_tell(&lfs2, &dir[0]) => pos+1;
+
+    // a newer tell replaces the cursor, so this seek walks the dir
+    lfs2_dir_rewind(&lfs2, &dir[0]) => 0;
+    lfs2_dir_tell(&lfs2, &dir[0]) => 0;
+    reads = bd.stats.read_count;
+    lfs2_dir_seek(&lfs2, &dir[0], pos) => 0;
+    uint64_t walk = bd.stats.read_count - reads;
+    lfs2_dir_read(&lfs2, &dir[0], &info) => 1;
+    strcmp(info.name, name) => 0;
+    (cursor < walk) => 1;
+
+    // the cursor only applies to the dir it came from
+    lfs2_dir_seek(&lfs2, &dir[0], pos) => 0;
+    lfs2_dir_tell(&lfs2, &dir[0]) => pos;
+    lfs2_dir_seek(&lfs2, &dir[1], pos) => LFS2_ERR_INVAL;
+    lfs2_dir_close(&lfs2, &dir[1]) => 0;
+
+    // a commit to the pair falls back to a walk
+    char path[1024];
+    sprintf(path, "hello/%s", name);
+    lfs2_setattr(&lfs2, path, 'A', "a", 1) => 0;
+    lfs2_dir_seek(&lfs2, &dir[0], pos) => 0;
+    lfs2_dir_read(&lfs2, &dir[0], &info) => 1;
+    strcmp(info.name, name) => 0;
+
+    // so does compacting the pair
+    lfs2_dir_seek(&lfs2, &dir[0], pos) => 0;
+    lfs2_dir_tell(&lfs2, &dir[0]) => pos;
+    uint32_t compacts = lfs2.stats.compact_count;
+    lfs2_fs_gc(&lfs2) => 0;
+    if (lfs2.stats.compact_count == compacts) {
+        // gc has nothing to reclaim when a commit fills a block, but then
+        // every commit compacts
+        lfs2_setattr(&lfs2, path, 'A', "b", 1) => 0;
+    }
+    (lfs2.stats.compact_count > compacts) => 1;
+    dir[0].cursor.pos => 0;
+    lfs2_dir_seek(&lfs2, &dir[0], pos) => 0;
+    lfs2_dir_read(&lfs2, &dir[0], &info) => 1;
+    strcmp(info.name, name) => 0;
+    lfs2_dir_close(&lfs2, &dir[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
 echo "--- Results ---"
 tests/stats.py
@@ -154,5 +154,35 @@ truncate_test \
     "2*$LARGESIZE, 2*$LARGESIZE, 2*$LARGESIZE, 2*$LARGESIZE, 2*$LARGESIZE" \
     "2*$LARGESIZE, 2*$LARGESIZE, 2*$LARGESIZE, 2*$LARGESIZE, 2*$LARGESIZE"
 
+echo "--- Zero-filling truncate and write ---"
+tests/test.py << TEST
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_file_open(&lfs2, &file[0], "zeros",
+            LFS2_O_RDWR | LFS2_O_CREAT | LFS2_O_TRUNC) => 0;
+    lfs2_file_write(&lfs2, &file[0], "hello", 5) => 5;
+    lfs2_file_truncate(&lfs2, &file[0], 4*$LARGESIZE) => 0;
+    lfs2_file_seek(&lfs2, &file[0], 6*$LARGESIZE, LFS2_SEEK_SET)
+            => 6*$LARGESIZE;
+    lfs2_file_write(&lfs2, &file[0], "world", 5) => 5;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+
+    lfs2_mount(&lfs2, &cfg) => 0;
+    lfs2_file_open(&lfs2, &file[0], "zeros", LFS2_O_RDONLY) => 0;
+    lfs2_file_size(&lfs2, &file[0]) => 6*$LARGESIZE+5;
+    lfs2_file_read(&lfs2, &file[0], buffer, 5) => 5;
+    memcmp(buffer, "hello", 5) => 0;
+    memset(wbuffer, 0, sizeof(wbuffer));
+    for (lfs2_off_t i = 5; i < 6*$LARGESIZE; i += size) {
+        size = lfs2_min(sizeof(rbuffer), 6*$LARGESIZE - i);
+        lfs2_file_read(&lfs2, &file[0], rbuffer, size) => size;
+        memcmp(rbuffer, wbuffer, size) => 0;
+    }
+    lfs2_file_read(&lfs2, &file[0], buffer, 5) => 5;
+    memcmp(buffer, "world", 5) => 0;
+    lfs2_file_close(&lfs2, &file[0]) => 0;
+    lfs2_unmount(&lfs2) => 0;
+TEST
+
 echo "--- Results ---"
 tests/stats.py
@@ -0,0 +1,317 @@
+/*
+ * Build a littlefs image from a directory on the host
+ *
+ * Copyright (c) 2017, Arm Limited. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "lfs2.h"
+#include "emubd/lfs2_emubd.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Image builder state
+static lfs2_t lfs2;
+static lfs2_emubd_t bd;
+static struct lfs2_config cfg;
+static uint8_t *buffer;
+static uint8_t *rbuffer;
+
+static struct {
+    lfs2_size_t dirs;
+    lfs2_size_t files;
+    uint64_t bytes;
+} totals;
+
+enum {
+    PASS_DIRS   = 0, // Create every directory first, so data stays contiguous
+    PASS_FILES  = 1, // Write every file
+    PASS_VERIFY = 2, // Compare every file with its source
+};
+
+static void usage(void) {
+    fprintf(stderr, "usage: mkimage -b block_size -c block_count "
+            "-p prog_size [-C cache_size] [-i inline_max] "
+            "<source> <image>\n");
+    exit(2);
+}
+
+static void fail(const char *path, const char *what, int err) {
+    fprintf(stderr, "mkimage: %s: %s (%d)\n", path, what, err);
+    exit(1);
+}
+
+static int skipdots(const struct dirent *entry) {
+    return strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+}
+
+static void copy(lfs2_file_t *file, const char *src, const char *dst) {
+    FILE *f = fopen(src, "rb");
+    if (!f) {
+        fail(src, strerror(errno), -errno);
+    }
+
+    int err = lfs2_file_open(&lfs2, file, dst,
+            LFS2_O_WRONLY | LFS2_O_CREAT | LFS2_O_EXCL);
+    if (err) {
+        fail(dst, "open failed", err);
+    }
+
+    // stream the whole file before the next one starts, so its blocks
+    // are allocated one after another
+    while (true) {
+        size_t res = fread(buffer, 1, cfg.block_size, f);
+        if (res == 0) {
+            break;
+        }
+
+        lfs2_ssize_t written = lfs2_file_write(&lfs2, file, buffer, res);
+        if (written < 0) {
+            fail(dst, "write failed", written);
+        }
+        totals.bytes += res;
+    }
+
+    if (ferror(f)) {
+        fail(src, strerror(errno), -errno);
+    }
+    fclose(f);
+
+    // leave the metadata for one commit per batch
+    err = lfs2_file_queue(&lfs2, file);
+    if (err) {
+        fail(dst, "write failed", err);
+    }
+    totals.files += 1;
+}
+
+static void verify(const char *src, const char *dst) {
+    FILE *f = fopen(src, "rb");
+    if (!f) {
+        fail(src, strerror(errno), -errno);
+    }
+
+    lfs2_file_t file;
+    int err = lfs2_file_open(&lfs2, &file, dst, LFS2_O_RDONLY);
+    if (err) {
+        fail(dst, "open failed", err);
+    }
+
+    while (true) {
+        size_t res = fread(buffer, 1, cfg.block_size, f);
+        lfs2_ssize_t read = lfs2_file_read(&lfs2, &file, rbuffer, res);
+        if (read < 0) {
+            fail(dst, "read failed", read);
+        }
+
+        if ((size_t)read != res || memcmp(buffer, rbuffer, res) != 0) {
+            fail(dst, "differs from source", LFS2_ERR_CORRUPT);
+        }
+
+        if (res == 0) {
+            break;
+        }
+    }
+
+    fclose(f);
+    err = lfs2_file_close(&lfs2, &file);
+    if (err) {
+        fail(dst, "close failed", err);
+    }
+}
+
+static void walk(const char *src, const char *dst, int pass) {
+    // sort entries so the same tree always builds the same image
+    struct dirent **entries;
+    int count = scandir(src, &entries, skipdots, alphasort);
+    if (count < 0) {
+        fail(src, strerror(errno), -errno);
+    }
+
+    lfs2_file_t files[LFS2_COMMIT_MAX];
+    int queued = 0;
+    for (int i = 0; i < count; i++) {
+        char spath[PATH_MAX];
+        char dpath[PATH_MAX];
+        snprintf(spath, sizeof(spath), "%s/%s", src, entries[i]->d_name);
+        snprintf(dpath, sizeof(dpath), "%s/%s", dst, entries[i]->d_name);
+
+        struct stat st;
+        if (lstat(spath, &st)) {
+            fail(spath, strerror(errno), -errno);
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (pass == PASS_DIRS) {
+                int err = lfs2_mkdir(&lfs2, dpath);
+                if (err) {
+                    fail(dpath, "mkdir failed", err);
+                }
+                totals.dirs += 1;
+            }
+
+            walk(spath, dpath, pass);
+        } else if (!S_ISREG(st.st_mode)) {
+            if (pass == PASS_DIRS) {
+                fprintf(stderr, "mkimage: %s: skipped, not a file\n", spath);
+            }
+        } else if (pass == PASS_FILES) {
+            copy(&files[queued], spath, dpath);
+            queued += 1;
+        } else if (pass == PASS_VERIFY) {
+            verify(spath, dpath);
+        }
+
+        // commit the directory entries of a full batch at once
+        if (queued == LFS2_COMMIT_MAX || (queued > 0 && i == count-1)) {
+            int err = lfs2_fs_commit(&lfs2);
+            if (err) {
+                fail(dst, "commit failed", err);
+            }
+
+            for (int j = 0; j < queued; j++) {
+                err = lfs2_file_close(&lfs2, &files[j]);
+                if (err) {
+                    fail(dst, "close failed", err);
+                }
+            }
+            queued = 0;
+        }
+
+        free(entries[i]);
+    }
+
+    free(entries);
+}
+
+int main(int argc, char **argv) {
+    lfs2_size_t block_size = 0;
+    lfs2_size_t block_count = 0;
+    lfs2_size_t prog_size = 0;
+    lfs2_size_t cache_size = 0;
+    lfs2_size_t inline_max = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:c:p:C:i:")) != -1) {
+        lfs2_size_t value = strtoul(optarg, NULL, 0);
+        switch (opt) {
+            case 'b': block_size = value; break;
+            case 'c': block_count = value; break;
+            case 'p': prog_size = value; break;
+            case 'C': cache_size = value; break;
+            case 'i': inline_max = value; break;
+            default: usage();
+        }
+    }
+
+    if (argc - optind != 2 || !block_size || !block_count || !prog_size ||
+            block_size % prog_size != 0) {
+        usage();
+    }
+
+    // inline files are limited by the device's cache_size, not ours
+    if (!cache_size) {
+        cache_size = block_size;
+    }
+    if (!inline_max) {
+        inline_max = lfs2_min(LFS2_ATTR_MAX,
+                lfs2_min(cache_size, block_size/8));
+    }
+    if (cache_size % prog_size != 0 || block_size % cache_size != 0 ||
+            inline_max > cache_size) {
+        usage();
+    }
+    const char *source = argv[optind];
+    const char *image = argv[optind+1];
+
+    // commits are padded to prog_size, so it has to match the device, but
+    // everything else can be as large as the host likes
+    cfg.context        = &bd;
+    cfg.read           = lfs2_emubd_read;
+    cfg.prog           = lfs2_emubd_prog;
+    cfg.erase          = lfs2_emubd_erase;
+    cfg.sync           = lfs2_emubd_sync;
+    cfg.read_size      = prog_size;
+    cfg.prog_size      = prog_size;
+    cfg.block_size     = block_size;
+    cfg.block_count    = block_count;
+    cfg.cache_size     = block_size;
+    cfg.lookahead_size = 4*((block_count+31)/32);
+    cfg.freemap_size   = 4*((block_count+31)/32);
+    cfg.inline_max     = inline_max;
+    cfg.validate       = LFS2_VALIDATE_NONE;
+    cfg.compact_thresh = prog_size;
+
+    buffer = malloc(block_size);
+    rbuffer = malloc(block_size);
+    if (!buffer || !rbuffer) {
+        fail(image, "out of memory", LFS2_ERR_NOMEM);
+    }
+
+    int err = lfs2_emubd_createimage(&cfg, NULL);
+    if (err) {
+        fail(image, "can't create image", err);
+    }
+
+    err = lfs2_format(&lfs2, &cfg);
+    if (err) {
+        fail(image, "format failed", err);
+    }
+
+    err = lfs2_mount(&lfs2, &cfg);
+    if (err) {
+        fail(image, "mount failed", err);
+    }
+
+    walk(source, "", PASS_DIRS);
+    walk(source, "", PASS_FILES);
+
+    // compact every metadata pair so it only holds live entries
+    err = lfs2_fs_gc(&lfs2);
+    if (err) {
+        fail(image, "compaction failed", err);
+    }
+
+    lfs2_ssize_t used = lfs2_fs_size(&lfs2);
+    if (used < 0) {
+        fail(image, "traversal failed", used);
+    }
+
+    err = lfs2_unmount(&lfs2);
+    if (err) {
+        fail(image, "unmount failed", err);
+    }
+
+    // read everything back through a fresh mount, with the device's cache
+    cfg.cache_size = cache_size;
+    err = lfs2_mount(&lfs2, &cfg);
+    if (err) {
+        fail(image, "mount failed", err);
+    }
+    walk(source, "", PASS_VERIFY);
+    lfs2_unmount(&lfs2);
+
+    // erased blocks are 0xff, so the image can be flashed as is
+    FILE *f = fopen(image, "wb");
+    if (!f || fwrite(bd.image, block_size, block_count, f) != block_count ||
+            fclose(f)) {
+        fail(image, strerror(errno), -errno);
+    }
+
+    printf("%s: %"PRIu32" dirs, %"PRIu32" files, %"PRIu64" bytes, "
+            "%"PRId32"/%"PRIu32" blocks\n", image,
+            totals.dirs, totals.files, totals.bytes, used, block_count);
+
+    lfs2_emubd_destroy(&cfg);
+    free(buffer);
+    free(rbuffer);
+    return 0;
+}
@@ -0,0 +1,284 @@
+/*
+ * Replay a block device trace onto an emulated block device
+ *
+ * Copyright (c) 2017, Arm Limited. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "lfs2.h"
+#include "lfs2_trace.h"
+#include "emubd/lfs2_emubd.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+
+// Replay state
+static lfs2_emubd_t bd;
+static struct lfs2_config cfg;
+static uint8_t *buffer;
+static uint32_t *wear;
+
+// Cost of each operation on the replayed device, per byte for reads and
+// programs, per block for erases
+static struct {
+    uint64_t read_ns;
+    uint64_t prog_ns;
+    uint64_t erase_us;
+    uint64_t sync_us;
+} cost;
+
+static struct {
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t recorded;
+    uint32_t slowest;
+    uint64_t modeled_us;
+} totals[4];
+
+static const char *names[4] = {"read", "prog", "erase", "sync"};
+
+static void usage(void) {
+    fprintf(stderr, "usage: replay [-r read_size] [-p prog_size] "
+            "[-b block_size] [-c block_count] "
+            "[-t read_ns,prog_ns,erase_us,sync_us] <trace>...\n");
+    exit(2);
+}
+
+static void fail(const char *path, const char *what, int err) {
+    fprintf(stderr, "replay: %s: %s (%d)\n", path, what, err);
+    exit(1);
+}
+
+// Replay one record, split across the device's blocks
+static int replay(const struct lfs2_trace_header *header,
+        const struct lfs2_trace_rec *rec) {
+    enum lfs2_trace_op op = lfs2_trace_op(rec);
+    lfs2_size_t size = lfs2_trace_size(rec);
+    uint64_t addr = (uint64_t)lfs2_fromle32(rec->block) *
+            lfs2_fromle32(header->block_size) + lfs2_fromle32(rec->off);
+
+    if (op == LFS2_TRACE_SYNC) {
+        totals[op].modeled_us += cost.sync_us;
+        return lfs2_emubd_sync(&cfg);
+    } else if (op > LFS2_TRACE_SYNC) {
+        return LFS2_ERR_CORRUPT;
+    }
+
+    if (addr + size > (uint64_t)cfg.block_size * cfg.block_count) {
+        return LFS2_ERR_INVAL;
+    }
+
+    if (op == LFS2_TRACE_READ &&
+            (addr % cfg.read_size != 0 || size % cfg.read_size != 0)) {
+        return LFS2_ERR_INVAL;
+    } else if (op == LFS2_TRACE_PROG &&
+            (addr % cfg.prog_size != 0 || size % cfg.prog_size != 0)) {
+        return LFS2_ERR_INVAL;
+    }
+
+    totals[op].bytes += size;
+    while (size > 0) {
+        lfs2_block_t block = addr / cfg.block_size;
+        lfs2_off_t off = addr % cfg.block_size;
+        lfs2_size_t diff = lfs2_min(size, cfg.block_size - off);
+
+        int err = 0;
+        if (op == LFS2_TRACE_READ) {
+            err = lfs2_emubd_read(&cfg, block, off, buffer, diff);
+            totals[op].modeled_us += (cost.read_ns*diff + 999) / 1000;
+        } else if (op == LFS2_TRACE_PROG) {
+            memset(buffer, 0, diff);
+            err = lfs2_emubd_prog(&cfg, block, off, buffer, diff);
+            totals[op].modeled_us += (cost.prog_ns*diff + 999) / 1000;
+        } else {
+            err = lfs2_emubd_erase(&cfg, block);
+            totals[op].modeled_us += cost.erase_us;
+            wear[block] += 1;
+        }
+
+        if (err) {
+            return err;
+        }
+
+        addr += diff;
+        size -= diff;
+    }
+
+    return 0;
+}
+
+static lfs2_size_t load(const char *path, struct lfs2_trace_header *first) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fail(path, strerror(errno), -errno);
+    }
+
+    // a trace file is any number of headers, each followed by its records
+    lfs2_size_t records = 0;
+    struct lfs2_trace_header header;
+    while (fread(&header, sizeof(header), 1, f) == 1) {
+        if (lfs2_fromle32(header.magic) != LFS2_TRACE_MAGIC ||
+                lfs2_fromle32(header.version) != LFS2_TRACE_VERSION) {
+            fail(path, "not a trace", LFS2_ERR_CORRUPT);
+        }
+
+        if (memcmp(&header.read_size, &first->read_size,
+                    4*sizeof(uint32_t)) != 0) {
+            fail(path, "traced geometry changed", LFS2_ERR_CORRUPT);
+        }
+        first->lost = header.lost;
+
+        for (uint32_t i = 0; i < lfs2_fromle32(header.count); i++) {
+            struct lfs2_trace_rec rec;
+            if (fread(&rec, sizeof(rec), 1, f) != 1) {
+                fail(path, "truncated trace", LFS2_ERR_CORRUPT);
+            }
+
+            int err = replay(&header, &rec);
+            if (err) {
+                fprintf(stderr, "replay: %s: record %"PRIu32": %s "
+                        "of %"PRIu32" bytes at block %"PRIu32" "
+                        "off %"PRIu32" failed (%d)\n", path, records,
+                        names[lfs2_trace_op(&rec) & 3], lfs2_trace_size(&rec),
+                        lfs2_fromle32(rec.block), lfs2_fromle32(rec.off), err);
+                exit(1);
+            }
+
+            enum lfs2_trace_op op = lfs2_trace_op(&rec);
+            uint32_t dur = lfs2_fromle32(rec.dur);
+            totals[op].count += 1;
+            totals[op].recorded += dur;
+            totals[op].slowest = lfs2_max(totals[op].slowest, dur);
+            records += 1;
+        }
+    }
+
+    if (ferror(f)) {
+        fail(path, strerror(errno), -errno);
+    }
+    fclose(f);
+    return records;
+}
+
+static void peek(const char *path, struct lfs2_trace_header *header) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fail(path, strerror(errno), -errno);
+    }
+
+    if (fread(header, sizeof(*header), 1, f) != 1 ||
+            lfs2_fromle32(header->magic) != LFS2_TRACE_MAGIC ||
+            lfs2_fromle32(header->version) != LFS2_TRACE_VERSION) {
+        fail(path, "not a trace", LFS2_ERR_CORRUPT);
+    }
+    fclose(f);
+}
+
+int main(int argc, char **argv) {
+    lfs2_size_t read_size = 0;
+    lfs2_size_t prog_size = 0;
+    lfs2_size_t block_size = 0;
+    lfs2_size_t block_count = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:p:b:c:t:")) != -1) {
+        lfs2_size_t value = strtoul(optarg, NULL, 0);
+        switch (opt) {
+            case 'r': read_size = value; break;
+            case 'p': prog_size = value; break;
+            case 'b': block_size = value; break;
+            case 'c': block_count = value; break;
+            case 't':
+                if (sscanf(optarg, "%"SCNu64",%"SCNu64",%"SCNu64",%"SCNu64,
+                        &cost.read_ns, &cost.prog_ns,
+                        &cost.erase_us, &cost.sync_us) != 4) {
+                    usage();
+                }
+                break;
+            default: usage();
+        }
+    }
+
+    if (optind >= argc) {
+        usage();
+    }
+
+    // default to the traced geometry
+    struct lfs2_trace_header header;
+    peek(argv[optind], &header);
+    lfs2_size_t traced_size = lfs2_fromle32(header.block_size);
+    cfg.read_size   = read_size ? read_size : lfs2_fromle32(header.read_size);
+    cfg.prog_size   = prog_size ? prog_size : lfs2_fromle32(header.prog_size);
+    cfg.block_size  = block_size ? block_size : traced_size;
+    cfg.block_count = block_count ? block_count :
+            (uint64_t)lfs2_fromle32(header.block_count) *
+            traced_size / cfg.block_size;
+
+    // a traced erase has to cover whole blocks of the replayed device
+    if (!cfg.read_size || !cfg.prog_size || !cfg.block_size ||
+            !cfg.block_count || traced_size % cfg.block_size != 0) {
+        usage();
+    }
+
+    cfg.context = &bd;
+    cfg.read    = lfs2_emubd_read;
+    cfg.prog    = lfs2_emubd_prog;
+    cfg.erase   = lfs2_emubd_erase;
+    cfg.sync    = lfs2_emubd_sync;
+
+    buffer = malloc(cfg.block_size);
+    wear = calloc(cfg.block_count, sizeof(uint32_t));
+    if (!buffer || !wear) {
+        fail(argv[optind], "out of memory", LFS2_ERR_NOMEM);
+    }
+
+    int err = lfs2_emubd_createimage(&cfg, NULL);
+    if (err) {
+        fail(argv[optind], "can't create device", err);
+    }
+
+    lfs2_size_t records = 0;
+    for (int i = optind; i < argc; i++) {
+        records += load(argv[i], &header);
+    }
+
+    printf("%"PRIu32" records, %"PRIu32" lost, device %"PRIu32"x%"PRIu32
+            " read %"PRIu32" prog %"PRIu32"\n", records,
+            lfs2_fromle32(header.lost), cfg.block_count, cfg.block_size,
+            cfg.read_size, cfg.prog_size);
+    printf("%-6s %10s %12s %12s %10s %12s\n",
+            "op", "count", "bytes", "recorded", "slowest", "modeled_us");
+    uint64_t recorded = 0;
+    uint64_t modeled = 0;
+    for (int op = 0; op < 4; op++) {
+        printf("%-6s %10"PRIu64" %12"PRIu64" %12"PRIu64" %10"PRIu32
+                " %12"PRIu64"\n", names[op], totals[op].count,
+                totals[op].bytes, totals[op].recorded, totals[op].slowest,
+                totals[op].modeled_us);
+        recorded += totals[op].recorded;
+        modeled += totals[op].modeled_us;
+    }
+    printf("%-6s %10s %12s %12"PRIu64" %10s %12"PRIu64"\n",
+            "total", "", "", recorded, "", modeled);
+
+    // wear of the replayed device
+    uint32_t erased = 0;
+    uint32_t worst = 0;
+    for (lfs2_block_t i = 0; i < cfg.block_count; i++) {
+        erased += (wear[i] > 0);
+        worst = lfs2_max(worst, wear[i]);
+    }
+    printf("device: %"PRIu64" reads, %"PRIu64" progs, %"PRIu64" erases, "
+            "%"PRIu32"/%"PRIu32" blocks erased, at most %"PRIu32" times\n",
+            bd.stats.read_count, bd.stats.prog_count, bd.stats.erase_count,
+            erased, cfg.block_count, worst);
+
+    lfs2_emubd_destroy(&cfg);
+    free(buffer);
+    free(wear);
+    return 0;
+}